@@ -0,0 +1,348 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <map>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <string>
+
+namespace support {
+
+  /// what a counter saw, a consistent enough copy of it
+  struct alloc_counts {
+    uint64_t  allocations;
+    uint64_t  frees;
+    uint64_t  bytes;      /// allocated in all
+    uint64_t  live;       /// allocated and not yet freed
+    uint64_t  peak;       /// most live at once since the last reset
+  };
+
+  /**
+   * Class: Alloc Counter
+   *
+   * Allocations charged to one stage or document type. A block is
+   * charged to the counter current when it was allocated and credited
+   * back to the same one when freed, whichever scope frees it, so live
+   * and peak follow a stage's memory, e.g. a DOM kept until the next
+   * parse. Safe to charge from any number of threads.
+   */
+  class alloc_counter {
+  public:
+
+    alloc_counter();
+
+    void charge(size_t size);
+    void release(size_t size);
+
+    alloc_counts counts() const;
+
+    /// counts from zero, the peak from what is live now
+    void reset();
+
+  private:
+
+    alloc_counter(const alloc_counter&);
+    alloc_counter& operator=(const alloc_counter&);
+
+    std::atomic<uint64_t>  allocations_;
+    std::atomic<uint64_t>  frees_;
+    std::atomic<uint64_t>  bytes_;
+    std::atomic<uint64_t>  live_;
+    std::atomic<uint64_t>  peak_;
+  };
+
+  /**
+   * Class: Alloc Scope
+   *
+   * Makes a counter the one charged on this thread until the scope
+   * ends, scopes nest. Only allocations that go through alloc_stats are
+   * seen: the xerces memory manager, the zlib hooks, and operator new
+   * in a program that defines SUPPORT_COUNT_NEW before including this
+   * header, in exactly one translation unit.
+   */
+  class alloc_scope {
+  public:
+
+    explicit alloc_scope(alloc_counter& counter);
+    ~alloc_scope();
+
+    /// null outside any scope
+    static alloc_counter* current();
+
+  private:
+
+    alloc_scope(const alloc_scope&);
+    alloc_scope& operator=(const alloc_scope&);
+
+    static alloc_counter*& slot();
+
+    alloc_counter*  previous_;
+  };
+
+  /**
+   * Class: Alloc Stats
+   *
+   * Named counters that live as long as the process, blocks may point
+   * at them after everything else is gone, and the allocation hooks.
+   * Each block carries its size and its counter in a header in front
+   * of it, so a free needs neither.
+   */
+  class alloc_stats {
+  public:
+
+    /// the counter by that name, created on first use
+    static alloc_counter& of(const std::string& name);
+
+    static std::map<std::string, alloc_counts> all();
+    static void reset();
+
+    /// null on failure, charged to the current scope or 'owner'
+    static void* allocate(size_t size);
+    static void* allocate(size_t size, alloc_counter* owner);
+    static void deallocate(void* p);
+
+  private:
+
+    struct header {
+      size_t          size;
+      alloc_counter*  owner;
+    };
+
+    /// keeps what follows it aligned as malloc would
+    static const size_t header_size =
+      (sizeof(header) + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+
+    struct registry {
+      std::mutex                                lock;
+      std::map<std::string, alloc_counter*>     counters;
+    };
+    static registry& counters();
+  };
+
+  inline
+  alloc_counter::
+  alloc_counter() :
+    allocations_(0),
+    frees_(0),
+    bytes_(0),
+    live_(0),
+    peak_(0)
+  {}
+
+  inline void
+  alloc_counter::
+  charge(size_t size) {
+
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    bytes_.fetch_add(size, std::memory_order_relaxed);
+    uint64_t live = live_.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = peak_.load(std::memory_order_relaxed);
+    while (live > peak &&
+           ! peak_.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+  }
+
+  inline void
+  alloc_counter::
+  release(size_t size) {
+    frees_.fetch_add(1, std::memory_order_relaxed);
+    live_.fetch_sub(size, std::memory_order_relaxed);
+  }
+
+  inline alloc_counts
+  alloc_counter::
+  counts() const {
+
+    alloc_counts c;
+    c.allocations = allocations_.load(std::memory_order_relaxed);
+    c.frees = frees_.load(std::memory_order_relaxed);
+    c.bytes = bytes_.load(std::memory_order_relaxed);
+    c.live = live_.load(std::memory_order_relaxed);
+    c.peak = peak_.load(std::memory_order_relaxed);
+    return c;
+  }
+
+  inline void
+  alloc_counter::
+  reset() {
+    allocations_ = 0;
+    frees_ = 0;
+    bytes_ = 0;
+    peak_ = live_.load();
+  }
+
+  inline
+  alloc_scope::
+  alloc_scope(alloc_counter& counter) :
+    previous_(slot()) {
+    slot() = &counter;
+  }
+
+  inline
+  alloc_scope::
+  ~alloc_scope() {
+    slot() = previous_;
+  }
+
+  inline alloc_counter*&
+  alloc_scope::
+  slot() {
+    /// constant initialized, safe from inside operator new
+    static thread_local alloc_counter* current = 0;
+    return current;
+  }
+
+  inline alloc_counter*
+  alloc_scope::
+  current() {
+    return slot();
+  }
+
+  inline alloc_stats::registry&
+  alloc_stats::
+  counters() {
+    /// never destroyed, blocks freed at exit still credit their counter
+    static registry* r = new registry;
+    return *r;
+  }
+
+  inline alloc_counter&
+  alloc_stats::
+  of(const std::string& name) {
+
+    registry& r = counters();
+    std::lock_guard<std::mutex> guard(r.lock);
+    alloc_counter*& c = r.counters[name];
+    if (! c) {
+      c = new alloc_counter;
+    }
+    return *c;
+  }
+
+  inline std::map<std::string, alloc_counts>
+  alloc_stats::
+  all() {
+
+    registry& r = counters();
+    std::lock_guard<std::mutex> guard(r.lock);
+    std::map<std::string, alloc_counts> out;
+    std::map<std::string, alloc_counter*>::const_iterator i = r.counters.begin();
+    for (; i != r.counters.end(); ++i) {
+      out[i->first] = i->second->counts();
+    }
+    return out;
+  }
+
+  inline void
+  alloc_stats::
+  reset() {
+
+    registry& r = counters();
+    std::lock_guard<std::mutex> guard(r.lock);
+    std::map<std::string, alloc_counter*>::iterator i = r.counters.begin();
+    for (; i != r.counters.end(); ++i) {
+      i->second->reset();
+    }
+  }
+
+  inline void*
+  alloc_stats::
+  allocate(size_t size) {
+    return allocate(size, alloc_scope::current());
+  }
+
+  inline void*
+  alloc_stats::
+  allocate(size_t size,
+           alloc_counter* owner) {
+
+    char* block = (char*) ::malloc(header_size + size);
+    if (! block) {
+      return 0;
+    }
+    header* h = (header*) block;
+    h->size = size;
+    h->owner = owner;
+    if (owner) {
+      owner->charge(size);
+    }
+    return block + header_size;
+  }
+
+  inline void
+  alloc_stats::
+  deallocate(void* p) {
+
+    if (! p) {
+      return;
+    }
+    char* block = (char*) p - header_size;
+    header* h = (header*) block;
+    if (h->owner) {
+      h->owner->release(h->size);
+    }
+    /// gcc takes operator new inlined into a caller for a mismatch
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+    ::free(block);
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+  }
+
+}  /// namespace support
+
+#ifdef SUPPORT_COUNT_NEW
+
+/// every std:: container and new expression of the program, through
+/// alloc_stats, so they are charged to the current scope
+void* operator new(size_t size) {
+  void* p = support::alloc_stats::allocate(size ? size : 1);
+  if (! p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return support::alloc_stats::allocate(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return support::alloc_stats::allocate(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+  support::alloc_stats::deallocate(p);
+}
+
+void operator delete[](void* p) noexcept {
+  support::alloc_stats::deallocate(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  support::alloc_stats::deallocate(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  support::alloc_stats::deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  support::alloc_stats::deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  support::alloc_stats::deallocate(p);
+}
+
+#endif
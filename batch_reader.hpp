@@ -0,0 +1,601 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define INGEST_HAVE_URING 1
+#endif
+#include <atomic>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <functional>
+#include <error_code.hpp>
+#include "bounded_queue.hpp"
+
+namespace ingest {
+
+  /**
+   * Class: Read Buffer
+   *
+   * A whole file, grown as needed and reused from file to file. Unlike
+   * a vector growing it does not zero the new bytes.
+   */
+  class read_buffer {
+  public:
+
+    read_buffer();
+    ~read_buffer();
+
+    const unsigned char* data() const;
+    size_t size() const;
+
+  private:
+
+    read_buffer(const read_buffer&);
+    read_buffer& operator=(const read_buffer&);
+
+    friend class batch_reader;
+
+    /// keeps the contents
+    bool reserve(size_t capacity);
+
+    unsigned char*  data_;
+    size_t          size_;
+    size_t          capacity_;
+  };
+
+  /**
+   * Class: Batch Reader
+   *
+   * Reads many small files with many reads in flight. On linux it
+   * drives io_uring directly, one submit and wait syscall per batch of
+   * completions rather than a blocking read per file. Where io_uring
+   * is missing or not permitted a pool of threads does plain reads.
+   *
+   * Either way the handler runs on the calling thread, once per file,
+   * in completion order. The buffer goes back to the pool when the
+   * handler returns, so it feeds zlib_adapter::uncompress or
+   * parser::parse in place, without a copy.
+   */
+  class batch_reader {
+  public:
+
+    typedef std::function<void (const support::error_code& err,
+                                const std::string& path,
+                                const read_buffer& buffer)> handler;
+
+    /// first read of a file, the buffer doubles from there
+    static const size_t initial_size = 16 * 1024;
+
+    explicit batch_reader(unsigned depth = 64,
+                          unsigned threads = 4,
+                          bool uring = true);
+    ~batch_reader();
+
+    /// whether reads go through io_uring
+    bool uring() const;
+
+    /// returns the number of files read without error
+    size_t read(const std::vector<std::string>& paths, const handler& h);
+
+  private:
+
+    batch_reader(const batch_reader&);
+    batch_reader& operator=(const batch_reader&);
+
+    struct slot {
+      slot() : busy(false) {}
+      bool          busy;
+      size_t        index;
+      int           fd;
+      read_buffer*  buffer;
+      struct iovec  iov;
+    };
+
+    struct completion {
+      size_t               index;
+      read_buffer*         buffer;
+      support::error_code  err;
+    };
+
+    read_buffer* acquire();
+    void release(read_buffer* b);
+
+    static bool open(support::error_code& err, const std::string& path, int& fd);
+    static void failed(support::error_code& err, const char* what,
+                       const std::string& path, int code);
+
+    /// blocking read of the whole file
+    static bool slurp(support::error_code& err, int fd,
+                      const std::string& path, read_buffer& b);
+
+    size_t threaded(const std::vector<std::string>& paths, const handler& h);
+
+#if defined(INGEST_HAVE_URING)
+    bool setup();
+    void teardown();
+    size_t ring(const std::vector<std::string>& paths, const handler& h);
+    bool submit(slot& s);
+    /// returns how many entries the kernel took, retries a signal
+    int enter(unsigned submit, unsigned wait);
+
+    int                   ring_fd_;
+    void*                 sq_ptr_;
+    size_t                sq_size_;
+    void*                 cq_ptr_;
+    size_t                cq_size_;
+    struct io_uring_sqe*  sqes_;
+    size_t                sqes_size_;
+    unsigned*             sq_head_;
+    unsigned*             sq_tail_;
+    unsigned*             sq_mask_;
+    unsigned*             sq_array_;
+    unsigned*             cq_head_;
+    unsigned*             cq_tail_;
+    unsigned*             cq_mask_;
+    struct io_uring_cqe*  cqes_;
+    unsigned              pending_;
+#endif
+
+    unsigned                            depth_;
+    unsigned                            threads_;
+    bool                                uring_;
+    support::bounded_queue<read_buffer*> pool_;
+  };
+
+  inline
+  read_buffer::
+  read_buffer() : data_(0), size_(0), capacity_(0)
+  {}
+
+  inline
+  read_buffer::
+  ~read_buffer() {
+    ::free(data_);
+  }
+
+  inline const unsigned char*
+  read_buffer::
+  data() const {
+    return data_;
+  }
+
+  inline size_t
+  read_buffer::
+  size() const {
+    return size_;
+  }
+
+  inline bool
+  read_buffer::
+  reserve(size_t capacity) {
+
+    if (capacity <= capacity_) {
+      return true;
+    }
+    unsigned char* p = (unsigned char*) ::realloc(data_, capacity);
+    if (! p) {
+      return false;
+    }
+    data_ = p;
+    capacity_ = capacity;
+    return true;
+  }
+
+  inline
+  batch_reader::
+  batch_reader(unsigned depth,
+               unsigned threads,
+               bool uring) :
+    depth_(depth ? depth : 1),
+    threads_(threads ? threads : 1),
+    uring_(false),
+    pool_(depth_ + threads_) {
+
+#if defined(INGEST_HAVE_URING)
+    ring_fd_ = -1;
+    uring_ = uring && setup();
+#endif
+  }
+
+  inline
+  batch_reader::
+  ~batch_reader() {
+
+#if defined(INGEST_HAVE_URING)
+    teardown();
+#endif
+    read_buffer* b = 0;
+    while (pool_.try_pop(b)) {
+      delete b;
+    }
+  }
+
+  inline bool
+  batch_reader::
+  uring() const {
+    return uring_;
+  }
+
+  inline read_buffer*
+  batch_reader::
+  acquire() {
+    read_buffer* b = 0;
+    if (! pool_.try_pop(b)) {
+      b = new read_buffer;
+    }
+    b->size_ = 0;
+    return b;
+  }
+
+  inline void
+  batch_reader::
+  release(read_buffer* b) {
+    if (! pool_.try_push(b)) {
+      delete b;
+    }
+  }
+
+  inline void
+  batch_reader::
+  failed(support::error_code& err,
+         const char* what,
+         const std::string& path,
+         int code) {
+
+    std::ostringstream oss;
+    oss << "Failed to " << what << " " << path << ": " << ::strerror(code);
+    support::error_code::attach_or_create(err, -1, oss.str());
+  }
+
+  inline bool
+  batch_reader::
+  open(support::error_code& err,
+       const std::string& path,
+       int& fd) {
+
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      failed(err, "open", path, errno);
+      return false;
+    }
+    return true;
+  }
+
+  inline bool
+  batch_reader::
+  slurp(support::error_code& err,
+        int fd,
+        const std::string& path,
+        read_buffer& b) {
+
+    for (;;) {
+      if (b.size_ == b.capacity_ &&
+          ! b.reserve(b.capacity_ ? b.capacity_ * 2 : initial_size)) {
+        failed(err, "allocate for", path, ENOMEM);
+        return false;
+      }
+      ssize_t count = ::read(fd, b.data_ + b.size_, b.capacity_ - b.size_);
+      if (count < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        failed(err, "read", path, errno);
+        return false;
+      }
+      if (count == 0) {
+        return true;
+      }
+      b.size_ += count;
+    }
+  }
+
+  inline size_t
+  batch_reader::
+  read(const std::vector<std::string>& paths,
+       const handler& h) {
+
+#if defined(INGEST_HAVE_URING)
+    if (uring_) {
+      return ring(paths, h);
+    }
+#endif
+    return threaded(paths, h);
+  }
+
+  inline size_t
+  batch_reader::
+  threaded(const std::vector<std::string>& paths,
+           const handler& h) {
+
+    /// workers claim files in order, the queue holds finished ones and
+    /// bounds how far ahead of the handler they get
+    support::bounded_queue<completion*> done(depth_);
+    std::atomic<size_t> next(0);
+    std::atomic<unsigned> live(threads_);
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads_; ++t) {
+      workers.push_back(std::thread([&]() {
+        size_t i = 0;
+        while ((i = next++) < paths.size()) {
+          completion* c = new completion;
+          c->index = i;
+          c->buffer = acquire();
+          int fd = -1;
+          if (open(c->err, paths[i], fd)) {
+            slurp(c->err, fd, paths[i], *c->buffer);
+            ::close(fd);
+          }
+          done.push(c);
+        }
+        if (--live == 0) {
+          done.close();
+        }
+      }));
+    }
+
+    size_t count = 0;
+    completion* c = 0;
+    while (done.pop(c)) {
+      h(c->err, paths[c->index], *c->buffer);
+      count += c->err.code() == 0;
+      release(c->buffer);
+      delete c;
+    }
+    for (size_t t = 0; t < workers.size(); ++t) {
+      workers[t].join();
+    }
+    return count;
+  }
+
+#if defined(INGEST_HAVE_URING)
+
+  inline bool
+  batch_reader::
+  setup() {
+
+    struct io_uring_params p;
+    ::memset(&p, 0, sizeof(p));
+    ring_fd_ = ::syscall(__NR_io_uring_setup, depth_, &p);
+    if (ring_fd_ < 0) {
+      return false;
+    }
+
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sq_ptr_ = ::mmap(0, sq_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+      sq_ptr_ = 0;
+      teardown();
+      return false;
+    }
+    cq_ptr_ = single ? sq_ptr_ :
+      ::mmap(0, cq_size_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ptr_ == MAP_FAILED) {
+      cq_ptr_ = 0;
+      teardown();
+      return false;
+    }
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = (struct io_uring_sqe*) ::mmap(0, sqes_size_, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+      sqes_ = 0;
+      teardown();
+      return false;
+    }
+
+    char* sq = (char*) sq_ptr_;
+    sq_head_ = (unsigned*) (sq + p.sq_off.head);
+    sq_tail_ = (unsigned*) (sq + p.sq_off.tail);
+    sq_mask_ = (unsigned*) (sq + p.sq_off.ring_mask);
+    sq_array_ = (unsigned*) (sq + p.sq_off.array);
+    char* cq = (char*) cq_ptr_;
+    cq_head_ = (unsigned*) (cq + p.cq_off.head);
+    cq_tail_ = (unsigned*) (cq + p.cq_off.tail);
+    cq_mask_ = (unsigned*) (cq + p.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    /// never more in flight than the ring holds
+    depth_ = std::min(depth_, p.sq_entries);
+    pending_ = 0;
+    return true;
+  }
+
+  inline void
+  batch_reader::
+  teardown() {
+
+    if (ring_fd_ < 0) {
+      return;
+    }
+    if (sqes_) {
+      ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_) {
+      ::munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_) {
+      ::munmap(sq_ptr_, sq_size_);
+    }
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+  }
+
+  inline int
+  batch_reader::
+  enter(unsigned submit,
+        unsigned wait) {
+
+    int ret = 0;
+    do {
+      ret = ::syscall(__NR_io_uring_enter, ring_fd_, submit, wait,
+                      wait ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+    }
+    while (ret < 0 && errno == EINTR);
+    return ret;
+  }
+
+  inline bool
+  batch_reader::
+  submit(slot& s) {
+
+    read_buffer& b = *s.buffer;
+    if (b.size_ == b.capacity_ &&
+        ! b.reserve(b.capacity_ ? b.capacity_ * 2 : initial_size)) {
+      return false;
+    }
+    s.iov.iov_base = b.data_ + b.size_;
+    s.iov.iov_len = b.capacity_ - b.size_;
+
+    /// only this thread produces, the kernel reads the tail
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe* sqe = &sqes_[index];
+    ::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = s.fd;
+    sqe->off = b.size_;
+    sqe->addr = (uint64_t) (uintptr_t) &s.iov;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t) (uintptr_t) &s;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++pending_;
+    return true;
+  }
+
+  inline size_t
+  batch_reader::
+  ring(const std::vector<std::string>& paths,
+       const handler& h) {
+
+    std::vector<slot> slots(depth_);
+    std::vector<slot*> free;
+    for (size_t i = 0; i < slots.size(); ++i) {
+      free.push_back(&slots[i]);
+    }
+
+    size_t next = 0;
+    size_t count = 0;
+    unsigned inflight = 0;
+    while (next < paths.size() || inflight) {
+
+      /// top up the ring
+      while (next < paths.size() && ! free.empty()) {
+        size_t i = next++;
+        support::error_code err;
+        int fd = -1;
+        if (! open(err, paths[i], fd)) {
+          read_buffer empty;
+          h(err, paths[i], empty);
+          continue;
+        }
+        slot& s = *free.back();
+        free.pop_back();
+        s.index = i;
+        s.fd = fd;
+        s.buffer = acquire();
+        s.busy = true;
+        if (! submit(s)) {
+          s.busy = false;
+          failed(err, "allocate for", paths[i], ENOMEM);
+          h(err, paths[i], *s.buffer);
+          ::close(fd);
+          release(s.buffer);
+          free.push_back(&s);
+          continue;
+        }
+        ++inflight;
+      }
+
+      /// entries the kernel did not take stay queued for the next
+      /// enter, short of room it wants completions reaped first
+      int submitted = enter(pending_, inflight ? 1 : 0);
+      if (submitted < 0 && inflight && (errno == EAGAIN || errno == EBUSY)) {
+        submitted = 0;
+      }
+      else if (submitted < 0) {
+        break;
+      }
+      pending_ -= std::min<unsigned>(submitted, pending_);
+
+      unsigned head = *cq_head_;
+      unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head) {
+
+        struct io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+        slot& s = *(slot*) (uintptr_t) cqe->user_data;
+        int res = cqe->res;
+        read_buffer& b = *s.buffer;
+        support::error_code err;
+
+        if (res > 0) {
+
+          /// a read may come back short anywhere, only a read of
+          /// nothing is the end of the file
+          b.size_ += res;
+          if (submit(s)) {
+            continue;
+          }
+          failed(err, "allocate for", paths[s.index], ENOMEM);
+        }
+        else if (res < 0) {
+          failed(err, "read", paths[s.index], -res);
+        }
+        h(err, paths[s.index], b);
+        count += err.code() == 0;
+        ::close(s.fd);
+        release(s.buffer);
+        s.busy = false;
+        free.push_back(&s);
+        --inflight;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    if (next < paths.size() || inflight) {
+
+      /// the ring is broken, reads already submitted may still land in
+      /// their buffers, so those files fail and their buffers are given
+      /// up rather than reused, the rest are read the blocking way
+      int code = errno;
+      for (size_t i = 0; i < slots.size(); ++i) {
+        if (! slots[i].busy) {
+          continue;
+        }
+        support::error_code err;
+        failed(err, "read", paths[slots[i].index], code);
+        read_buffer empty;
+        h(err, paths[slots[i].index], empty);
+        ::close(slots[i].fd);
+      }
+      teardown();
+      uring_ = false;
+      std::vector<std::string> rest(paths.begin() + next, paths.end());
+      count += threaded(rest, h);
+    }
+    return count;
+  }
+
+#endif
+
+}  /// namespace ingest
@@ -0,0 +1,755 @@
+/// counts every std:: allocation of the bench, see alloc_stats.hpp
+#define SUPPORT_COUNT_NEW
+
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <xercesc/util/PlatformUtils.hpp>
+#include <xercesc/util/XMLUni.hpp>
+#include <xercesc/dom/DOM.hpp>
+#include <xercesc/parsers/XercesDOMParser.hpp>
+#include <xercesc/util/OutOfMemoryException.hpp>
+#include "vmaster.hpp"
+#include "xmlcolumns.hpp"
+#include "xmlquery.hpp"
+#include "xmlgrammar.hpp"
+#include "zlib_adapter.hpp"
+#include "alloc_stats.hpp"
+
+namespace test {
+
+  /// a list of leaves, one row per tag in the "tag" scope
+  struct tagged : xml::binding::composite {
+
+    tagged() {
+      insert("tag", tags);
+    }
+    xml::binding::nodelist<xml::binding::element_string> tags;
+  };
+
+  /// a feed wrapped in an envelope, the choice mapped under both names
+  struct envelope : xml::binding::composite {
+
+    envelope() {
+      insert("vMasterMessage", feed);
+      insert("vMasterCancel",  feed);
+    }
+    vmaster_feed feed;
+  };
+
+  /**
+   * Class: Bind Bench
+   *
+   * Parse and bind timings for vMaster messages of growing size.
+   * Allocations per message are gated: exec() fails once binding a
+   * vMasterMessage takes more than 'max_allocations', 0 for no gate.
+   */
+  class bind_bench {
+  public:
+
+    bind_bench(int iterations, uint64_t max_allocations);
+    bool exec();
+
+  private:
+
+    typedef std::chrono::steady_clock clock;
+
+    std::string sample(size_t sections) const;
+    double per_message(const std::string& doc, const xml::dom::projection* proj);
+    void projection();
+    bool delta();
+    bool columns();
+    void transcoding();
+    void parallel();
+    void querying();
+    void choosing();
+    void validating();
+    void reusing();
+    bool allocations();
+
+    std::string  template_;
+    int          iterations_;
+    uint64_t     max_allocations_;
+  };
+
+  bind_bench::
+  bind_bench(int iterations,
+             uint64_t max_allocations) :
+    iterations_(iterations),
+    max_allocations_(max_allocations) {
+
+    std::ifstream ifs("./p.xml");
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    template_ = oss.str();
+  }
+
+  std::string
+  bind_bench::
+  sample(size_t sections) const {
+
+    /// pad the header with sections nothing binds, the bound fields
+    /// stay the same whatever the size of the document
+    std::ostringstream oss;
+    for (size_t i = 0; i < sections; ++i) {
+      oss << "    <vMasterLegs id=\"" << i << "\">\n";
+      for (int j = 0; j < 8; ++j) {
+        oss << "      <vMasterLeg><notional>1000000</notional>"
+            << "<currency>GBP</currency><rate>0.0125</rate>"
+            << "<schedule><date>2010-01-04</date><date>2010-07-04</date>"
+            << "</schedule></vMasterLeg>\n";
+      }
+      oss << "    </vMasterLegs>\n";
+    }
+    std::string doc = template_;
+    std::string::size_type p = doc.find("    <vMasterDiary>");
+    doc.insert(p, oss.str());
+    return doc;
+  }
+
+  double
+  bind_bench::
+  per_message(const std::string& doc,
+              const xml::dom::projection* proj) {
+
+    xml::dom::parser par;
+    clock::time_point start = clock::now();
+    for (int i = 0; i < iterations_; ++i) {
+
+      support::error_code err;
+      bool result = proj ? par.parse(err, doc, *proj) : par.parse(err, doc);
+      vmaster_message vm;
+      result = result && vm.bind(err, par.root());
+      if (! result) {
+        std::cout << "Failed: " << err << std::endl;
+        return 0;
+      }
+    }
+    std::chrono::duration<double, std::micro> elapsed = clock::now() - start;
+    return elapsed.count() / iterations_;
+  }
+
+  void
+  bind_bench::
+  projection() {
+
+    vmaster_message proto;
+    xml::dom::projection proj;
+    proto.project(proj);
+
+    std::cout << "projection pushdown, parse + bind per message" << std::endl;
+    std::cout << std::setw(10) << "sections"
+              << std::setw(12) << "bytes"
+              << std::setw(14) << "full us"
+              << std::setw(14) << "projected us"
+              << std::endl;
+
+    size_t sizes[] = { 0, 10, 100, 1000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+      std::string doc = sample(sizes[i]);
+      std::cout << std::setw(10) << sizes[i]
+                << std::setw(12) << doc.size()
+                << std::setw(14) << per_message(doc, 0)
+                << std::setw(14) << per_message(doc, &proj)
+                << std::endl;
+    }
+  }
+
+  bool
+  bind_bench::
+  delta() {
+
+    /// a trade status update: new status, revision date and diary entry
+    std::string before = sample(10);
+    std::string after = before;
+    after.replace(after.find("PENDING_UNAPPROVED"), 18, "APPROVED");
+    after.replace(after.find("Dec 10 2009 3:36:45.000AM</vMasterRevisionDate>"), 25,
+                  "Dec 11 2009 9:12:01.000AM");
+    after.insert(after.find("</vMasterDiary>"),
+                 "  <vMasterDiaryEntry>\n"
+                 "        <diaryText>approved</diaryText>\n"
+                 "      </vMasterDiaryEntry>\n    ");
+
+    xml::dom::parser par;
+    support::error_code err;
+    par.parse(err, before);
+    vmaster_message vm;
+    vm.bind(err, par.root());
+
+    clock::time_point start = clock::now();
+    for (int i = 0; i < iterations_; ++i) {
+      vmaster_message full;
+      par.parse(err, after);
+      full.bind(err, par.root());
+    }
+    std::chrono::duration<double, std::micro> full = clock::now() - start;
+
+    /// alternate between the two versions so every pass has work to do
+    xml::binding::delta d;
+    start = clock::now();
+    for (int i = 0; i < iterations_; ++i) {
+      d.rebind(err, vm, i % 2 ? after : before, i % 2 ? before : after);
+    }
+    std::chrono::duration<double, std::micro> incremental = clock::now() - start;
+
+    std::cout << "delta rebind, " << after.size() << " bytes, "
+              << d.changed().size() << " changed fields" << std::endl;
+    std::cout << std::setw(14) << "full us"
+              << std::setw(14) << "delta us" << std::endl;
+    std::cout << std::setw(14) << full.count() / iterations_
+              << std::setw(14) << incremental.count() / iterations_
+              << std::endl;
+
+    /// a trade cancelled and reinstated, the choice switches both ways
+    std::string trade = "<envelope>" + template_ + "</envelope>";
+    std::string cancelled = "<envelope><vMasterCancel><vMasterTradeOriginID>test</vMasterTradeOriginID>"
+                            "<vMasterReason>duplicate</vMasterReason></vMasterCancel></envelope>";
+    envelope env;
+    par.parse(err, trade);
+    bool ok = env.bind(err, par.root()) && env.has(env.feed) && env.feed.is<vmaster_message>();
+    ok = d.rebind(err, env, trade, cancelled) && ok;
+    ok = ok && env.has(env.feed) && env.feed.is<vmaster_cancel>();
+    ok = d.rebind(err, env, cancelled, trade) && ok;
+    ok = ok && env.has(env.feed) && env.feed.is<vmaster_message>();
+    if (! ok) {
+      std::cout << "delta switching alternatives lost the choice" << std::endl;
+    }
+    return ok;
+  }
+
+  bool
+  bind_bench::
+  columns() {
+
+    /// a batch of headers over a handful of desks
+    const char* desks[] = { "SWAPSLON", "RATESNY", "CREDITLON", "FXTKY" };
+    const size_t count = iterations_ * 50;
+
+    std::vector<vmaster_message> objects;
+    objects.reserve(count);
+    xml::binding::column_binder<vmaster_message> binder;
+    xml::dom::parser par;
+    support::error_code err;
+    for (size_t i = 0; i < count; ++i) {
+
+      std::string doc = template_;
+      doc.replace(doc.find("SWAPSLON"), 8, desks[i % 4]);
+      doc.replace(doc.find("95280"), 5, std::to_string(90000 + i % 10000));
+      par.parse(err, doc);
+      objects.push_back(vmaster_message());
+      objects.back().bind(err, par.root());
+      binder.bind(err, par.root());
+    }
+    /// group by desk, count coper ids above a threshold
+    clock::time_point start = clock::now();
+    std::map<std::string, size_t> by_desk;
+    size_t filtered = 0;
+    for (size_t i = 0; i < objects.size(); ++i) {
+      const vmaster_header& h = objects[i].vm_header;
+      ++by_desk[h.desk()];
+      filtered += h.entity_coper_id() > 90500;
+    }
+    std::chrono::duration<double, std::micro> rows = clock::now() - start;
+
+    const xml::binding::columns& cols = binder.data();
+    start = clock::now();
+    const xml::binding::column* desk = cols.find("vMasterHeader/vMasterDesk");
+    const xml::binding::column* coper = cols.find("vMasterHeader/vMasterEntityCoperID");
+    std::vector<size_t> per_code(desk->dictionary().size());
+    const std::vector<uint32_t>& codes = desk->codes();
+    for (size_t i = 0; i < codes.size(); ++i) {
+      ++per_code[codes[i]];
+    }
+    size_t matched = 0;
+    const std::vector<int64_t>& ids = coper->integers();
+    for (size_t i = 0; i < ids.size(); ++i) {
+      matched += ids[i] > 90500;
+    }
+    std::chrono::duration<double, std::micro> scan = clock::now() - start;
+
+    std::cout << "columnar batch of " << count << " headers, group by desk"
+              << " and filter on coper id (" << filtered << "/" << matched << ")"
+              << std::endl;
+    std::cout << std::setw(14) << "objects us"
+              << std::setw(14) << "columns us"
+              << std::setw(18) << "object sizeof"
+              << std::setw(18) << "column bytes/rec" << std::endl;
+    std::cout << std::setw(14) << rows.count()
+              << std::setw(14) << scan.count()
+              << std::setw(18) << sizeof(vmaster_message)
+              << std::setw(18) << cols.bytes() / count << std::endl;
+
+    /// a nodelist of strings, each tag its own row under the list
+    xml::binding::column_binder<tagged> tag_binder;
+    size_t tags = 0;
+    std::string last;
+    for (size_t i = 0; i < count; ++i) {
+      std::string doc = "<tagged>";
+      for (size_t t = 0; t < i % 4; ++t) {
+        doc += std::string("<tag>") + desks[t] + "</tag>";
+        last = desks[t];
+      }
+      doc += "</tagged>";
+      tags += i % 4;
+      par.parse(err, doc);
+      tag_binder.bind(err, par.root());
+    }
+    const xml::binding::columns& tag_cols = tag_binder.data();
+    const xml::binding::column* list = tag_cols.find("tag");
+    const xml::binding::column* items = tag_cols.find("tag/tag");
+    bool ok = list && items && tag_cols.rows("tag") == tags && items->size() == tags
+           && list->items().back() == tags && items->str(tags - 1) == last;
+    std::cout << "list of leaves, " << tags << " tags over " << count << " rows"
+              << (ok ? "" : ", rows out of step") << std::endl;
+    return ok;
+  }
+
+  void
+  bind_bench::
+  transcoding() {
+
+    /// every name and value of the sample, as xerces hands them over
+    std::vector<std::u16string> corpus;
+    xml::dom::scanner sc(template_.data(), template_.data() + template_.size());
+    xml::dom::scanner::token t;
+    while (sc.next(t)) {
+      std::string s = t.type == xml::dom::scanner::text ?
+        std::string(t.begin, t.end) : std::string(t.name ? t.name : "", t.name_size);
+      corpus.push_back(std::u16string(s.begin(), s.end()));
+    }
+    const int rounds = iterations_ * 100;
+    size_t bytes = 0;
+
+    clock::time_point start = clock::now();
+    for (int r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < corpus.size(); ++i) {
+        char* tmp = xercesc::XMLString::transcode((const XMLCh*) corpus[i].c_str());
+        bytes += ::strlen(tmp);
+        xercesc::XMLString::release(&tmp);
+      }
+    }
+    std::chrono::duration<double, std::nano> xerces = clock::now() - start;
+
+    std::string out;
+    start = clock::now();
+    for (int r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < corpus.size(); ++i) {
+        xml::dom::transcoder::utf8((const XMLCh*) corpus[i].c_str(), out);
+        bytes += out.size();
+      }
+    }
+    std::chrono::duration<double, std::nano> simd = clock::now() - start;
+
+    double strings = double(rounds) * corpus.size();
+    std::cout << "transcoding " << corpus.size() << " vMaster strings ("
+              << bytes / 2 / rounds << " bytes) per round" << std::endl;
+    std::cout << std::setw(14) << "xerces ns/str"
+              << std::setw(14) << "utf8 ns/str" << std::endl;
+    std::cout << std::setw(14) << xerces.count() / strings
+              << std::setw(14) << simd.count() / strings << std::endl;
+  }
+
+  void
+  bind_bench::
+  parallel() {
+
+    /// one header with a long diary, the list is where the time goes
+    const size_t entries = iterations_ * 250;
+    std::ostringstream oss;
+    oss << "    <vMasterDiary>\n";
+    for (size_t i = 0; i < entries; ++i) {
+      oss << "      <vMasterDiaryEntry><diaryText>entry " << i
+          << "</diaryText></vMasterDiaryEntry>\n";
+    }
+    std::string doc = template_;
+    std::string::size_type first = doc.find("    <vMasterDiary>");
+    std::string::size_type last = doc.find("</vMasterDiary>") + 16;
+    doc.replace(first, last - first, oss.str() + "    </vMasterDiary>\n");
+
+    support::error_code err;
+    xml::dom::parser par;
+    if (! par.parse(err, doc)) {
+      std::cout << "Failed: " << err << std::endl;
+      return;
+    }
+    const int rounds = iterations_ / 20 ? iterations_ / 20 : 1;
+
+    vmaster_message serial;
+    clock::time_point start = clock::now();
+    for (int r = 0; r < rounds; ++r) {
+      serial = vmaster_message();
+      serial.bind(err, par.root());
+    }
+    std::chrono::duration<double, std::micro> base = clock::now() - start;
+
+    std::cout << "binding a diary of " << entries << " entries" << std::endl;
+    std::cout << std::setw(10) << "threads"
+              << std::setw(14) << "bind us"
+              << std::setw(10) << "speedup"
+              << std::setw(10) << "same" << std::endl;
+    std::cout << std::setw(10) << "serial"
+              << std::setw(14) << base.count() / rounds
+              << std::setw(10) << 1.0
+              << std::setw(10) << "yes" << std::endl;
+
+    unsigned threads[] = { 1, 2, 4 };
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+      support::work_pool pool(threads[t]);
+      vmaster_message vm;
+      start = clock::now();
+      for (int r = 0; r < rounds; ++r) {
+        vm = vmaster_message();
+        vm.vm_header.diary.entries.parallelize(pool);
+        vm.bind(err, par.root());
+      }
+      std::chrono::duration<double, std::micro> elapsed = clock::now() - start;
+
+      const xml::binding::nodelist<vmaster_diary_entry>& a = serial.vm_header.diary.entries;
+      const xml::binding::nodelist<vmaster_diary_entry>& b = vm.vm_header.diary.entries;
+      bool same = a.size() == b.size();
+      for (size_t i = 0; same && i < a.size(); ++i) {
+        same = a[i].text() == b[i].text();
+      }
+      std::cout << std::setw(10) << threads[t]
+                << std::setw(14) << elapsed.count() / rounds
+                << std::setw(10) << base.count() / elapsed.count()
+                << std::setw(10) << (same ? "yes" : "no") << std::endl;
+    }
+  }
+
+  void
+  bind_bench::
+  querying() {
+
+    /// three values out of a padded message, by query and by binding
+    std::string doc = sample(64);
+    xml::dom::query q;
+    support::error_code err;
+    size_t desk = 0;
+    size_t type = 0;
+    size_t coper = 0;
+    q.add(err, "vMasterHeader/vMasterDesk", desk);
+    q.add(err, "vMasterHeader/@type", type);
+    q.add(err, "vMasterHeader/vMasterEntityCoperID", coper);
+
+    xml::dom::parser par;
+    xml::dom::query::results r;
+    int64_t sum = 0;
+    clock::time_point start = clock::now();
+    for (int i = 0; i < iterations_; ++i) {
+      vmaster_message vm;
+      par.parse(err, doc);
+      vm.bind(err, par.root());
+      sum += vm.vm_header.entity_coper_id();
+    }
+    std::chrono::duration<double, std::micro> bound = clock::now() - start;
+
+    start = clock::now();
+    for (int i = 0; i < iterations_; ++i) {
+      int64_t v = 0;
+      par.parse(err, doc);
+      par.select(err, q, r);
+      r.integer(err, coper, v);
+      sum += v;
+    }
+    std::chrono::duration<double, std::micro> selected = clock::now() - start;
+
+    start = clock::now();
+    for (int i = 0; i < iterations_; ++i) {
+      int64_t v = 0;
+      q.scan(err, doc, r);
+      r.integer(err, coper, v);
+      sum += v;
+    }
+    std::chrono::duration<double, std::micro> scanned = clock::now() - start;
+
+    std::cout << "three paths out of " << doc.size() << " bytes (" << r.text(desk)
+              << ", " << r.text(type) << ", " << sum / (3 * iterations_) << ")" << std::endl;
+    std::cout << std::setw(14) << "bind us"
+              << std::setw(14) << "select us"
+              << std::setw(14) << "scan us" << std::endl;
+    std::cout << std::setw(14) << bound.count() / iterations_
+              << std::setw(14) << selected.count() / iterations_
+              << std::setw(14) << scanned.count() / iterations_ << std::endl;
+  }
+
+  void
+  bind_bench::
+  choosing() {
+
+    /// a feed of trades with a cancel every fourth message
+    std::string cancel = "<vMasterCancel><vMasterTradeOriginID>test</vMasterTradeOriginID>"
+                         "<vMasterReason>duplicate</vMasterReason></vMasterCancel>";
+    const std::string* docs[] = { &template_, &template_, &template_, &cancel };
+    const int count = iterations_ * 4;
+    xml::dom::parser par;
+    support::error_code err;
+    size_t cancels = 0;
+
+    /// parse to see what it is, then again to bind it
+    clock::time_point start = clock::now();
+    for (int i = 0; i < count; ++i) {
+      const std::string& doc = *docs[i % 4];
+      par.parse(err, doc);
+      std::string root;
+      xml::dom::transcode(par.root()->xerces_node()->getNodeName(), root);
+      par.parse(err, doc);
+      if (root == vmaster_cancel::key()) {
+        vmaster_cancel vc;
+        cancels += vc.bind(err, par.root());
+      }
+      else {
+        vmaster_message vm;
+        vm.bind(err, par.root());
+      }
+    }
+    std::chrono::duration<double, std::micro> peek = clock::now() - start;
+
+    start = clock::now();
+    for (int i = 0; i < count; ++i) {
+      vmaster_feed feed;
+      par.parse(err, *docs[i % 4]);
+      feed.bind(err, par.root());
+      cancels += feed.is<vmaster_cancel>();
+    }
+    std::chrono::duration<double, std::micro> chosen = clock::now() - start;
+
+    std::cout << "mixed feed, " << cancels / 2 << " cancels in " << count << " messages" << std::endl;
+    std::cout << std::setw(14) << "peek us"
+              << std::setw(14) << "choice us" << std::endl;
+    std::cout << std::setw(14) << peek.count() / count
+              << std::setw(14) << chosen.count() / count << std::endl;
+  }
+
+  void
+  bind_bench::
+  validating() {
+
+    std::ifstream ifs("./vmaster.xsd");
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    std::string schema = oss.str();
+
+    /// compiled once, shared by every validating parser
+    support::error_code err;
+    xml::dom::grammar_pool grammars;
+    clock::time_point start = clock::now();
+    if (! grammars.load(err, schema.data(), schema.size(), "vmaster.xsd")) {
+      std::cout << "Failed: " << err << std::endl;
+      return;
+    }
+    grammars.lock();
+    std::chrono::duration<double, std::micro> compile = clock::now() - start;
+
+    std::cout << "schema validation, parse + bind per message, schema compiles in "
+              << compile.count() << " us" << std::endl;
+    std::cout << std::setw(10) << "sections"
+              << std::setw(12) << "bytes"
+              << std::setw(14) << "plain us"
+              << std::setw(14) << "pooled us"
+              << std::setw(14) << "reload us" << std::endl;
+
+    size_t sizes[] = { 0, 10, 100 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+
+      std::string doc = sample(sizes[i]);
+      xml::dom::parser par(grammars);
+      start = clock::now();
+      for (int n = 0; n < iterations_; ++n) {
+        vmaster_message vm;
+        if (! par.parse(err, doc) || ! vm.bind(err, par.root())) {
+          std::cout << "Failed: " << err << std::endl;
+          return;
+        }
+      }
+      std::chrono::duration<double, std::micro> pooled = clock::now() - start;
+
+      /// what validating costs without the pool, the schema every time
+      start = clock::now();
+      for (int n = 0; n < iterations_; ++n) {
+        xml::dom::grammar_pool once;
+        once.load(err, schema.data(), schema.size(), "vmaster.xsd");
+        xml::dom::parser fresh(once);
+        vmaster_message vm;
+        fresh.parse(err, doc) && vm.bind(err, fresh.root());
+      }
+      std::chrono::duration<double, std::micro> reload = clock::now() - start;
+
+      std::cout << std::setw(10) << sizes[i]
+                << std::setw(12) << doc.size()
+                << std::setw(14) << per_message(doc, 0)
+                << std::setw(14) << pooled.count() / iterations_
+                << std::setw(14) << reload.count() / iterations_ << std::endl;
+    }
+  }
+
+  bool
+  bind_bench::
+  allocations() {
+
+    std::string cancel = "<vMasterCancel><vMasterTradeOriginID>test</vMasterTradeOriginID>"
+                         "<vMasterReason>duplicate</vMasterReason></vMasterCancel>";
+    const char* types[] = { "vMasterMessage", "vMasterCancel" };
+    const std::string* docs[] = { &template_, &cancel };
+    const char* stages[] = { "parse", "bind", "compress" };
+
+    mangle::compress_settings settings;
+    settings.zalloc = &mangle::counting_zalloc;
+    settings.zfree = &mangle::counting_zfree;
+
+    std::cout << "allocations per message, xerces, zlib and std::" << std::endl;
+    std::cout << std::setw(16) << "type"
+              << std::setw(10) << "stage"
+              << std::setw(10) << "allocs"
+              << std::setw(12) << "bytes"
+              << std::setw(12) << "peak bytes" << std::endl;
+
+    bool result = true;
+    for (int t = 0; t < 2; ++t) {
+
+      support::alloc_counter* counters[3];
+      uint64_t live[3];
+      for (int s = 0; s < 3; ++s) {
+        counters[s] = &support::alloc_stats::of(std::string(stages[s]) + "/" + types[t]);
+        counters[s]->reset();
+        live[s] = counters[s]->counts().live;
+      }
+      xml::dom::parser par;
+      support::error_code err;
+      for (int i = 0; i < iterations_; ++i) {
+        {
+          support::alloc_scope scope(*counters[0]);
+          par.parse(err, *docs[t]);
+        }
+        {
+          support::alloc_scope scope(*counters[1]);
+          vmaster_feed feed;
+          feed.bind(err, par.root());
+        }
+        {
+          support::alloc_scope scope(*counters[2]);
+          mangle::bytes out;
+          mangle::zlib_adapter::compress(err, out, *docs[t], settings);
+        }
+      }
+      for (int s = 0; s < 3; ++s) {
+        support::alloc_counts c = counters[s]->counts();
+        std::cout << std::setw(16) << types[t]
+                  << std::setw(10) << stages[s]
+                  << std::setw(10) << c.allocations / iterations_
+                  << std::setw(12) << c.bytes / iterations_
+                  << std::setw(12) << c.peak - live[s] << std::endl;
+      }
+      /// the regression gate, on bound trades
+      uint64_t bound = counters[1]->counts().allocations / iterations_;
+      if (t == 0 && max_allocations_ && bound > max_allocations_) {
+        std::cout << "FAILED: binding a " << types[t] << " takes " << bound
+                  << " allocations, the limit is " << max_allocations_ << std::endl;
+        result = false;
+      }
+    }
+    return result;
+  }
+
+  void
+  bind_bench::
+  reusing() {
+
+    /// a steady stream, the same fields with different values
+    std::vector<std::string> docs;
+    for (int i = 0; i < 16; ++i) {
+      std::string doc = template_;
+      std::string desk = "SWAPSLON";
+      std::string::size_type p = doc.find(desk);
+      doc.replace(p, desk.size(), "DESK" + std::to_string(i));
+      std::string coper = "95280";
+      p = doc.find(coper);
+      doc.replace(p, coper.size(), std::to_string(95280 + i * 7));
+      docs.push_back(doc);
+    }
+    const int count = iterations_ * 4;
+    support::error_code err;
+
+    /// a parser, a document and a binding per message
+    clock::time_point start = clock::now();
+    for (int i = 0; i < count; ++i) {
+      xml::dom::parser par;
+      vmaster_message vm;
+      par.parse(err, docs[i % docs.size()]);
+      vm.bind(err, par.root());
+    }
+    std::chrono::duration<double, std::micro> fresh = clock::now() - start;
+
+    /// the parser kept, its document pool recycled
+    xml::dom::parser par;
+    start = clock::now();
+    for (int i = 0; i < count; ++i) {
+      vmaster_message vm;
+      par.parse(err, docs[i % docs.size()]);
+      vm.bind(err, par.root());
+    }
+    std::chrono::duration<double, std::micro> kept = clock::now() - start;
+
+    /// same shape, the text assigned in place
+    xml::binding::shape_binder<vmaster_message> binder;
+    size_t reused = 0;
+    long sum = 0;
+    start = clock::now();
+    for (int i = 0; i < count; ++i) {
+      binder.bind(err, docs[i % docs.size()]);
+      reused += binder.reused();
+      sum += binder.get().vm_header.entity_coper_id;
+    }
+    std::chrono::duration<double, std::micro> shaped = clock::now() - start;
+
+    std::cout << "same shape stream, " << reused << " of " << count
+              << " bound in place (" << binder.get().vm_header.desk()
+              << ", " << sum / count << ")" << std::endl;
+    std::cout << std::setw(14) << "fresh us"
+              << std::setw(14) << "kept us"
+              << std::setw(14) << "shape us" << std::endl;
+    std::cout << std::setw(14) << fresh.count() / count
+              << std::setw(14) << kept.count() / count
+              << std::setw(14) << shaped.count() / count << std::endl;
+  }
+
+  bool
+  bind_bench::
+  exec() {
+    projection();
+    bool result = delta();
+    result &= columns();
+    transcoding();
+    parallel();
+    querying();
+    choosing();
+    validating();
+    reusing();
+    return allocations() && result;
+  }
+}
+
+int main(int argc, char* argv[]) {
+
+  /// xerces allocates through alloc_stats too, for the whole run
+  static xml::dom::counting_memory_manager manager;
+  try {
+    xercesc::XMLPlatformUtils::Initialize(xercesc::XMLUni::fgXercescDefaultLocale, 0, 0, &manager);
+  }
+  catch(const xercesc::XMLException &toCatch) {
+    std::cout << xercesc::XMLString::transcode(toCatch.getMessage()) << std::endl;
+    return 1;
+  }
+  /// bench_bind [iterations] [most allocations binding a message may take]
+  bool result = true;
+  {
+    test::bind_bench bb(argc > 1 ? atoi(argv[1]) : 200,
+                        argc > 2 ? strtoull(argv[2], 0, 10) : 0);
+    result = bb.exec();
+  }
+  xercesc::XMLPlatformUtils::Terminate();
+  return result ? 0 : 1;
+}
@@ -0,0 +1,455 @@
+/// counts every std:: allocation of the bench, see alloc_stats.hpp
+#define SUPPORT_COUNT_NEW
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <xercesc/util/PlatformUtils.hpp>
+#include <xercesc/util/XMLUni.hpp>
+#include <xercesc/dom/DOM.hpp>
+#include <xercesc/parsers/XercesDOMParser.hpp>
+#include "vmaster.hpp"
+#include "pipeline.hpp"
+#include "batch_reader.hpp"
+#include "bind_cache.hpp"
+
+namespace test {
+
+  /**
+   * Class: Ingest Bench
+   *
+   * Files per second through the staged pipeline against the one thread
+   * read, uncompress, parse, bind loop, over a corpus of compressed
+   * vMaster messages written to ./corpus. Also the batch reader, with
+   * io_uring and with threads, against an ifstream per file, and the
+   * bind cache on a feed that repeats itself. Broken files must come
+   * out of the pipeline with an error code and no result, exec() fails
+   * otherwise.
+   */
+  class ingest_bench {
+  public:
+
+    ingest_bench(size_t files, size_t rounds);
+    bool exec();
+
+  private:
+
+    typedef std::chrono::steady_clock clock;
+
+    bool corpus();
+    double serial();
+    double staged(const ingest::settings& s, bool report);
+    double streamed(bool decode);
+    double batched(ingest::batch_reader& reader, bool decode);
+    void reading();
+    void caching();
+    bool malformed();
+
+    std::vector<std::string>  paths_;
+    size_t                    files_;
+    size_t                    rounds_;
+  };
+
+  ingest_bench::
+  ingest_bench(size_t files,
+               size_t rounds) :
+    files_(files),
+    rounds_(rounds)
+  {}
+
+  bool
+  ingest_bench::
+  corpus() {
+
+    std::ifstream ifs("./p.xml");
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    std::string tmpl = oss.str();
+    if (tmpl.empty()) {
+      std::cout << "Failed to read ./p.xml" << std::endl;
+      return false;
+    }
+    ::mkdir("./corpus", 0755);
+    for (size_t i = 0; i < files_; ++i) {
+
+      std::string doc = tmpl;
+      doc.replace(doc.find("95280"), 5, std::to_string(90000 + i));
+      support::error_code err;
+      mangle::bytes out;
+      if (! mangle::zlib_adapter::compress(err, out, doc)) {
+        std::cout << "Failed: " << err << std::endl;
+        return false;
+      }
+      std::ostringstream name;
+      name << "./corpus/vmaster_" << i << ".xml.z";
+      std::ofstream ofs(name.str().c_str(), std::ios::binary);
+      ofs.write((const char*) &out[0], out.size());
+      paths_.push_back(name.str());
+    }
+    return true;
+  }
+
+  double
+  ingest_bench::
+  serial() {
+
+    xml::dom::parser par;
+    size_t count = 0;
+    clock::time_point start = clock::now();
+    for (size_t r = 0; r < rounds_; ++r) {
+      for (size_t i = 0; i < paths_.size(); ++i) {
+
+        support::error_code err;
+        mangle::bytes raw;
+        std::string text;
+        vmaster_message vm;
+        bool result = ingest::pipeline<vmaster_message>::read(err, paths_[i], raw)
+                   && mangle::zlib_adapter::uncompress(err, text, raw)
+                   && par.parse(err, text)
+                   && vm.bind(err, par.root());
+        count += result;
+      }
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    return count / elapsed.count();
+  }
+
+  double
+  ingest_bench::
+  staged(const ingest::settings& s,
+         bool report) {
+
+    std::atomic<size_t> delivered(0);
+    std::atomic<size_t> failed(0);
+    ingest::pipeline<vmaster_message> p(s,
+      [&](const support::error_code& err,
+          const std::string& source,
+          std::shared_ptr<const vmaster_message> vm) {
+        if (vm) {
+          ++delivered;
+        }
+        else {
+          ++failed;
+        }
+      });
+
+    ingest::file_replay replay(paths_, rounds_);
+    clock::time_point start = clock::now();
+    p.start();
+    replay.drive(p);
+    p.finish();
+    std::chrono::duration<double> elapsed = clock::now() - start;
+
+    if (failed) {
+      std::cout << "  " << failed << " messages failed" << std::endl;
+    }
+    if (report) {
+      std::vector<ingest::stage_stats> stats = p.stats();
+      std::cout << std::setw(12) << "stage"
+                << std::setw(9) << "workers"
+                << std::setw(9) << "items"
+                << std::setw(12) << "busy ms"
+                << std::setw(12) << "starved ms"
+                << std::setw(12) << "blocked ms"
+                << std::setw(12) << "allocs/item"
+                << std::setw(12) << "peak KB" << std::endl;
+      for (size_t i = 0; i < stats.size(); ++i) {
+        std::cout << std::setw(12) << stats[i].name
+                  << std::setw(9) << stats[i].workers
+                  << std::setw(9) << stats[i].items
+                  << std::setw(12) << stats[i].busy_ns / 1000000
+                  << std::setw(12) << stats[i].starved_ns / 1000000
+                  << std::setw(12) << stats[i].blocked_ns / 1000000
+                  << std::setw(12) << (stats[i].items ? stats[i].allocs.allocations / stats[i].items : 0)
+                  << std::setw(12) << stats[i].allocs.peak / 1024 << std::endl;
+      }
+    }
+    return delivered / elapsed.count();
+  }
+
+  double
+  ingest_bench::
+  streamed(bool decode) {
+
+    xml::dom::parser par;
+    size_t count = 0;
+    clock::time_point start = clock::now();
+    for (size_t r = 0; r < rounds_; ++r) {
+      for (size_t i = 0; i < paths_.size(); ++i) {
+
+        std::ifstream ifs(paths_[i].c_str(), std::ios::binary);
+        std::ostringstream oss;
+        oss << ifs.rdbuf();
+        std::string raw = oss.str();
+        if (! decode) {
+          count += ! raw.empty();
+          continue;
+        }
+        support::error_code err;
+        std::string text;
+        count += mangle::zlib_adapter::uncompress(err, text,
+                   (const unsigned char*) raw.data(), raw.size())
+              && par.parse(err, text);
+      }
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    return count / elapsed.count();
+  }
+
+  double
+  ingest_bench::
+  batched(ingest::batch_reader& reader,
+          bool decode) {
+
+    xml::dom::parser par;
+    std::string text;
+    size_t count = 0;
+    clock::time_point start = clock::now();
+    for (size_t r = 0; r < rounds_; ++r) {
+      reader.read(paths_,
+        [&](const support::error_code& e,
+            const std::string& path,
+            const ingest::read_buffer& b) {
+          if (e.code()) {
+            return;
+          }
+          if (! decode) {
+            ++count;
+            return;
+          }
+          /// straight out of the pooled buffer
+          support::error_code err;
+          text.clear();
+          count += mangle::zlib_adapter::uncompress(err, text, b.data(), b.size())
+                && par.parse(err, text.data(), text.size());
+        });
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    return count / elapsed.count();
+  }
+
+  void
+  ingest_bench::
+  reading() {
+
+    ingest::batch_reader threads(64, 4, false);
+    ingest::batch_reader ring(64, 4, true);
+    std::cout << "batch reader" << (ring.uring() ? "" : ", no io_uring here")
+              << std::endl;
+    std::cout << std::setw(34) << "files/sec"
+              << std::setw(14) << "read"
+              << std::setw(18) << "+inflate+parse" << std::endl;
+    std::cout << std::setw(34) << "ifstream per file"
+              << std::setw(14) << streamed(false)
+              << std::setw(18) << streamed(true) << std::endl;
+    std::cout << std::setw(34) << "batch reader, 4 threads"
+              << std::setw(14) << batched(threads, false)
+              << std::setw(18) << batched(threads, true) << std::endl;
+    if (ring.uring()) {
+      std::cout << std::setw(34) << "batch reader, io_uring"
+                << std::setw(14) << batched(ring, false)
+                << std::setw(18) << batched(ring, true) << std::endl;
+    }
+  }
+
+  void
+  ingest_bench::
+  caching() {
+
+    /// every round replays the same payloads, as retries would
+    std::vector<std::string> texts;
+    for (size_t i = 0; i < paths_.size(); ++i) {
+      support::error_code err;
+      mangle::bytes raw;
+      std::string text;
+      if (ingest::pipeline<vmaster_message>::read(err, paths_[i], raw)
+       && mangle::zlib_adapter::uncompress(err, text, raw)) {
+        texts.push_back(text);
+      }
+    }
+    if (texts.empty()) {
+      return;
+    }
+    std::cout << "bind cache, " << texts.size() << " messages x " << rounds_
+              << " rounds" << std::endl;
+    std::cout << std::setw(34) << "cap"
+              << std::setw(14) << "msgs/sec"
+              << std::setw(10) << "hits"
+              << std::setw(10) << "misses"
+              << std::setw(10) << "evicted"
+              << std::setw(12) << "bytes" << std::endl;
+
+    xml::dom::parser par;
+    clock::time_point start = clock::now();
+    for (size_t r = 0; r < rounds_; ++r) {
+      for (size_t i = 0; i < texts.size(); ++i) {
+        support::error_code err;
+        vmaster_message vm;
+        par.parse(err, texts[i]) && vm.bind(err, par.root());
+      }
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    std::cout << std::setw(34) << "none"
+              << std::setw(14) << texts.size() * rounds_ / elapsed.count() << std::endl;
+
+    /// all of it, then room for about half the messages, the shards
+    /// fill unevenly so half as much again
+    vmaster_message probe;
+    support::error_code err;
+    par.parse(err, texts[0]) && probe.bind(err, par.root());
+    size_t all = 0;
+    for (size_t i = 0; i < texts.size(); ++i) {
+      all += (texts[i].size() + sizeof(vmaster_message) + probe.footprint() + 256) * 3 / 2;
+    }
+    size_t caps[] = { all, all / 2 };
+    for (size_t c = 0; c < sizeof(caps) / sizeof(caps[0]); ++c) {
+      ingest::bind_cache<vmaster_message> cache(caps[c], 4);
+      start = clock::now();
+      for (size_t r = 0; r < rounds_; ++r) {
+        for (size_t i = 0; i < texts.size(); ++i) {
+          support::error_code err;
+          cache.bind(err, par, texts[i]);
+        }
+      }
+      elapsed = clock::now() - start;
+      ingest::bind_cache<vmaster_message>::counters k = cache.stats();
+      std::ostringstream name;
+      name << caps[c] / 1024 << "K";
+      std::cout << std::setw(34) << name.str()
+                << std::setw(14) << texts.size() * rounds_ / elapsed.count()
+                << std::setw(10) << k.hits
+                << std::setw(10) << k.misses
+                << std::setw(10) << k.evictions
+                << std::setw(12) << k.bytes << std::endl;
+    }
+  }
+
+  bool
+  ingest_bench::
+  malformed() {
+
+    /// truncated, not xml at all, not compressed, and one good file
+    std::ifstream ifs("./p.xml");
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    std::string good = oss.str();
+    const std::string docs[] = {
+      good.substr(0, good.size() / 2),
+      "this is not xml",
+      "",
+      good
+    };
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+      support::error_code err;
+      mangle::bytes out;
+      mangle::zlib_adapter::compress(err, out, docs[i]);
+      if (i == 2) {
+        out.assign(good.begin(), good.end());
+      }
+      std::ostringstream name;
+      name << "./corpus/malformed_" << i << ".xml.z";
+      std::ofstream ofs(name.str().c_str(), std::ios::binary);
+      ofs.write((const char*) out.data(), out.size());
+      paths.push_back(name.str());
+    }
+    paths.push_back("./corpus/missing.xml.z");
+
+    std::atomic<size_t> errors(0);
+    std::atomic<size_t> bound(0);
+    std::atomic<size_t> wrong(0);
+    ingest::pipeline<vmaster_message> p(ingest::settings(),
+      [&](const support::error_code& err,
+          const std::string& source,
+          std::shared_ptr<const vmaster_message> vm) {
+        if (err.code() && ! vm) {
+          ++errors;
+        }
+        else if (! err.code() && vm) {
+          ++bound;
+        }
+        else {
+          ++wrong;
+        }
+      });
+    p.start();
+    for (size_t i = 0; i < paths.size(); ++i) {
+      p.submit(paths[i]);
+    }
+    p.finish();
+
+    bool result = errors == paths.size() - 1 && bound == 1 && wrong == 0;
+    std::cout << "malformed input, " << errors << " of " << paths.size() - 1
+              << " failed with a code, " << bound << " of 1 bound";
+    std::cout << (result ? "" : ", FAILED") << std::endl;
+    return result;
+  }
+
+  bool
+  ingest_bench::
+  exec() {
+
+    if (! corpus()) {
+      return false;
+    }
+    std::cout << "ingest of " << files_ << " compressed files x " << rounds_
+              << " rounds, " << std::thread::hardware_concurrency() << " cpus" << std::endl;
+    std::cout << std::setw(34) << "configuration"
+              << std::setw(14) << "files/sec" << std::endl;
+    std::cout << std::setw(34) << "serial"
+              << std::setw(14) << serial() << std::endl;
+
+    /// read, inflate, parse, bind workers
+    unsigned configs[][4] = {
+      { 1, 1, 1, 1 },
+      { 1, 1, 2, 1 },
+      { 1, 2, 4, 2 },
+      { 2, 2, 8, 4 }
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i) {
+      ingest::settings s;
+      s.readers = configs[i][0];
+      s.inflaters = configs[i][1];
+      s.parsers = configs[i][2];
+      s.binders = configs[i][3];
+      std::ostringstream name;
+      name << "staged " << s.readers << "/" << s.inflaters
+           << "/" << s.parsers << "/" << s.binders;
+      std::cout << std::setw(34) << name.str()
+                << std::setw(14) << staged(s, false) << std::endl;
+    }
+
+    ingest::settings s;
+    std::cout << "per stage, default settings" << std::endl;
+    staged(s, true);
+
+    reading();
+    caching();
+    return malformed();
+  }
+}
+
+int main(int argc, char* argv[]) {
+
+  /// xerces allocates through alloc_stats too, for the whole run
+  static xml::dom::counting_memory_manager manager;
+  try {
+    xercesc::XMLPlatformUtils::Initialize(xercesc::XMLUni::fgXercescDefaultLocale, 0, 0, &manager);
+  }
+  catch(const xercesc::XMLException &toCatch) {
+    std::cout << xercesc::XMLString::transcode(toCatch.getMessage()) << std::endl;
+    return 1;
+  }
+  bool result = true;
+  {
+    test::ingest_bench ib(argc > 1 ? atoi(argv[1]) : 200,
+                          argc > 2 ? atoi(argv[2]) : 10);
+    result = ib.exec();
+  }
+  xercesc::XMLPlatformUtils::Terminate();
+  return result ? 0 : 1;
+}
@@ -0,0 +1,393 @@
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include "zlib_adapter.hpp"
+#include "zlib_index.hpp"
+#include "zlib_batch.hpp"
+#include "zlib_adaptive.hpp"
+#include "zlib_frame.hpp"
+#include "hash.hpp"
+
+namespace test {
+
+  /**
+   * Class: Zlib Bench
+   *
+   * Inflate timings for one large archive of vMaster messages, and
+   * batched against per message compression of p.xml sized messages,
+   * adaptive level selection against fixed levels, and what checking
+   * a frame costs next to inflating it.
+   */
+  class zlib_bench {
+  public:
+
+    zlib_bench(size_t megabytes);
+    void exec();
+
+  private:
+
+    typedef std::chrono::steady_clock clock;
+
+    std::string archive() const;
+    std::vector<std::string> messages(size_t count) const;
+    void parallel();
+    void batching();
+    void adaptive();
+    void checksums();
+
+    std::string  template_;
+    size_t       megabytes_;
+  };
+
+  zlib_bench::
+  zlib_bench(size_t megabytes) : megabytes_(megabytes) {
+
+    std::ifstream ifs("./p.xml");
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    template_ = oss.str();
+  }
+
+  std::vector<std::string>
+  zlib_bench::
+  messages(size_t count) const {
+
+    /// messages that differ the way a real feed does, ids and desks
+    const char* desks[] = { "SWAPSLON", "RATESNY", "CREDITLON", "FXTKY" };
+    std::vector<std::string> all;
+    for (size_t i = 0; i < count; ++i) {
+      std::string doc = template_;
+      doc.replace(doc.find("SWAPSLON"), 8, desks[i % 4]);
+      doc.replace(doc.find("95280"), 5, std::to_string(i));
+      all.push_back(doc);
+    }
+    return all;
+  }
+
+  std::string
+  zlib_bench::
+  archive() const {
+
+    std::vector<std::string> all = messages((megabytes_ << 20) / template_.size() + 1);
+    std::string joined;
+    joined.reserve(megabytes_ << 20);
+    for (size_t i = 0; i < all.size(); ++i) {
+      joined += all[i];
+    }
+    return joined;
+  }
+
+  void
+  zlib_bench::
+  parallel() {
+
+    std::string plain = archive();
+    support::error_code err;
+    mangle::bytes z;
+    mangle::zlib_adapter::compress(err, z, plain);
+
+    std::cout << "inflate of one " << plain.size() / (1 << 20) << "MB stream ("
+              << z.size() / 1024 << "KB compressed), "
+              << std::thread::hardware_concurrency() << " cpus" << std::endl;
+    std::cout << std::setw(26) << "mode"
+              << std::setw(12) << "ms"
+              << std::setw(12) << "MB/s"
+              << std::setw(10) << "same" << std::endl;
+
+    std::string out;
+    clock::time_point start = clock::now();
+    mangle::zlib_adapter::uncompress(err, out, z);
+    std::chrono::duration<double, std::milli> serial = clock::now() - start;
+    std::cout << std::setw(26) << "zlib_adapter"
+              << std::setw(12) << serial.count()
+              << std::setw(12) << plain.size() / serial.count() / 1000
+              << std::setw(10) << (out == plain) << std::endl;
+
+    mangle::inflate_index index;
+    out.clear();
+    start = clock::now();
+    index.build(err, out, &z[0], z.size());
+    std::chrono::duration<double, std::milli> first = clock::now() - start;
+    std::cout << std::setw(26) << "first read, index build"
+              << std::setw(12) << first.count()
+              << std::setw(12) << plain.size() / first.count() / 1000
+              << std::setw(10) << (out == plain) << std::endl;
+
+    /// as a later run would, from the saved index
+    std::string saved;
+    index.save(err, saved);
+    mangle::inflate_index loaded;
+    loaded.load(err, (const unsigned char*) saved.data(), saved.size());
+
+    unsigned threads[] = { 1, 2, 4, 8, 16 };
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+      out.clear();
+      start = clock::now();
+      bool result = loaded.inflate(err, out, &z[0], z.size(), threads[i]);
+      std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+      std::ostringstream name;
+      name << "indexed, " << threads[i] << " threads";
+      std::cout << std::setw(26) << name.str()
+                << std::setw(12) << elapsed.count()
+                << std::setw(12) << plain.size() / elapsed.count() / 1000
+                << std::setw(10) << (result && out == plain) << std::endl;
+    }
+    std::cout << "index: " << loaded.points() << " points, "
+              << saved.size() / 1024 << "KB saved" << std::endl;
+  }
+
+  void
+  zlib_bench::
+  batching() {
+
+    const size_t count = 4096;
+    std::vector<std::string> msgs = messages(count);
+    size_t plain = 0;
+    for (size_t i = 0; i < count; ++i) {
+      plain += msgs[i].size();
+    }
+    std::cout << "compression of " << count << " messages of ~"
+              << plain / count << " bytes" << std::endl;
+    std::cout << std::setw(26) << "mode"
+              << std::setw(12) << "MB/s"
+              << std::setw(12) << "ratio"
+              << std::setw(16) << "extract us/msg" << std::endl;
+
+    /// one level for both, so only the framing differs
+    const int level = Z_DEFAULT_COMPRESSION;
+    mangle::compress_settings cs;
+    cs.level = level;
+
+    support::error_code err;
+    size_t compressed = 0;
+    std::vector<mangle::bytes> each(count);
+    clock::time_point start = clock::now();
+    for (size_t i = 0; i < count; ++i) {
+      mangle::zlib_adapter::compress(err, each[i], msgs[i], cs);
+      compressed += each[i].size();
+    }
+    std::chrono::duration<double, std::micro> elapsed = clock::now() - start;
+    std::string out;
+    start = clock::now();
+    for (size_t i = 0; i < count; ++i) {
+      out.clear();
+      mangle::zlib_adapter::uncompress(err, out, each[i]);
+    }
+    std::chrono::duration<double, std::micro> extract = clock::now() - start;
+    std::cout << std::setw(26) << "per message"
+              << std::setw(12) << plain / elapsed.count()
+              << std::setw(12) << double(plain) / compressed
+              << std::setw(16) << extract.count() / count << std::endl;
+
+    uint32_t restarts[] = { 1, 16, 64, 1024 };
+    for (size_t r = 0; r < sizeof(restarts) / sizeof(restarts[0]); ++r) {
+
+      mangle::batch_writer writer(level, restarts[r]);
+      mangle::bytes batch;
+      start = clock::now();
+      for (size_t i = 0; i < count; ++i) {
+        writer.add(err, msgs[i]);
+      }
+      writer.finish(err, batch);
+      elapsed = clock::now() - start;
+
+      /// random access, every message once in a scattered order
+      mangle::batch_view view;
+      view.open(err, &batch[0], batch.size());
+      bool same = true;
+      start = clock::now();
+      for (size_t i = 0; i < count; ++i) {
+        size_t n = (i * 2654435761u) % count;
+        view.extract(err, n, out);
+        same = same && out == msgs[n];
+      }
+      extract = clock::now() - start;
+
+      std::ostringstream name;
+      name << "batch, restart " << restarts[r];
+      std::cout << std::setw(26) << name.str()
+                << std::setw(12) << plain / elapsed.count()
+                << std::setw(12) << double(plain) / batch.size()
+                << std::setw(16) << extract.count() / count
+                << (same ? "" : "  MISMATCH") << std::endl;
+    }
+  }
+
+  void
+  zlib_bench::
+  adaptive() {
+
+    const size_t count = 8192;
+    std::vector<std::string> msgs = messages(count);
+    size_t plain = 0;
+    for (size_t i = 0; i < count; ++i) {
+      plain += msgs[i].size();
+    }
+    std::cout << "adaptive compression of " << count << " messages" << std::endl;
+    std::cout << std::setw(26) << "mode"
+              << std::setw(10) << "MB/s"
+              << std::setw(10) << "us/msg"
+              << std::setw(9) << "ratio"
+              << std::setw(8) << "level"
+              << std::setw(10) << "strategy"
+              << std::setw(8) << "raised"
+              << std::setw(9) << "lowered" << std::endl;
+
+    support::error_code err;
+    mangle::bytes out;
+    int levels[] = { 1, 6, 9 };
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+      mangle::compress_settings cs;
+      cs.level = levels[l];
+      size_t compressed = 0;
+      clock::time_point start = clock::now();
+      for (size_t i = 0; i < count; ++i) {
+        out.clear();
+        mangle::zlib_adapter::compress(err, out, msgs[i], cs);
+        compressed += out.size();
+      }
+      std::chrono::duration<double, std::micro> elapsed = clock::now() - start;
+      std::ostringstream name;
+      name << "fixed, level " << levels[l];
+      std::cout << std::setw(26) << name.str()
+                << std::setw(10) << plain / elapsed.count()
+                << std::setw(10) << elapsed.count() / count
+                << std::setw(9) << double(plain) / compressed
+                << std::setw(8) << levels[l] << std::endl;
+    }
+
+    struct budget {
+      mangle::adaptive_compressor::target  t;
+      double                               value;
+      const char*                          name;
+    };
+    budget budgets[] = {
+      { mangle::adaptive_compressor::throughput, 50, "target 50 MB/s" },
+      { mangle::adaptive_compressor::throughput, 150, "target 150 MB/s" },
+      { mangle::adaptive_compressor::latency, 20, "target 20 us/msg" },
+      { mangle::adaptive_compressor::latency, 5, "target 5 us/msg" }
+    };
+    const char* strategies[] = { "default", "filtered", "huffman", "rle", "fixed" };
+    for (size_t b = 0; b < sizeof(budgets) / sizeof(budgets[0]); ++b) {
+      mangle::adaptive_compressor ac(budgets[b].t, budgets[b].value);
+      clock::time_point start = clock::now();
+      for (size_t i = 0; i < count; ++i) {
+        ac.compress(err, out, msgs[i]);
+      }
+      std::chrono::duration<double, std::micro> elapsed = clock::now() - start;
+      const mangle::adaptive_compressor::counters& c = ac.stats();
+      std::cout << std::setw(26) << budgets[b].name
+                << std::setw(10) << plain / elapsed.count()
+                << std::setw(10) << elapsed.count() / count
+                << std::setw(9) << double(c.bytes_in) / c.bytes_out
+                << std::setw(8) << ac.settings().level
+                << std::setw(10) << strategies[ac.settings().strategy]
+                << std::setw(8) << c.raised
+                << std::setw(9) << c.lowered << std::endl;
+    }
+
+    /// a payload deflate can do little with
+    std::string noise(64 * 1024, 0);
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < noise.size(); ++i) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      noise[i] = (char) x;
+    }
+    mangle::adaptive_compressor ac(mangle::adaptive_compressor::throughput, 50);
+    ac.compress(err, out, noise);
+    std::cout << "random payload picks " << strategies[ac.settings().strategy]
+              << ", ratio " << double(noise.size()) / out.size() << std::endl;
+  }
+
+  void
+  zlib_bench::
+  checksums() {
+
+    std::string plain = archive();
+    support::error_code err;
+    std::cout << "checksums over " << plain.size() / (1 << 20) << "MB, crc32c "
+              << (support::crc32c::hardware() ? "sse4.2" : "tables") << std::endl;
+    std::cout << std::setw(26) << "check"
+              << std::setw(12) << "ms"
+              << std::setw(12) << "MB/s" << std::endl;
+
+    const unsigned char* data = (const unsigned char*) plain.data();
+    uint64_t sink = 0;
+    struct timed {
+      const char*  name;
+      int          which;
+    };
+    timed checks[] = {
+      { "crc32c", 0 },
+      { "crc32c tables", 1 },
+      { "zlib crc32", 2 },
+      { "zlib adler32", 3 },
+      { "hash64", 4 }
+    };
+    for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); ++c) {
+      clock::time_point start = clock::now();
+      switch (checks[c].which) {
+        case 0: sink += support::crc32c::compute(0, data, plain.size()); break;
+        case 1: sink += support::crc32c::portable(0, data, plain.size()); break;
+        case 2: sink += crc32(0, data, plain.size()); break;
+        case 3: sink += adler32(1, data, plain.size()); break;
+        case 4: sink += support::hash64(data, plain.size()); break;
+      }
+      std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+      std::cout << std::setw(26) << checks[c].name
+                << std::setw(12) << elapsed.count()
+                << std::setw(12) << plain.size() / elapsed.count() / 1000 << std::endl;
+    }
+
+    /// the same content as a frame: check it cold, or inflate it
+    mangle::compress_settings cs;
+    cs.level = 6;
+    mangle::bytes f;
+    mangle::frame::compress(err, f, plain, cs);
+    clock::time_point start = clock::now();
+    bool ok = mangle::frame::verify(err, &f[0], f.size());
+    std::chrono::duration<double, std::milli> verify = clock::now() - start;
+    std::string out;
+    start = clock::now();
+    ok = mangle::frame::uncompress(err, out, &f[0], f.size()) && ok;
+    std::chrono::duration<double, std::milli> inflate = clock::now() - start;
+    mangle::bytes z;
+    mangle::zlib_adapter::compress(err, z, plain, cs);
+    std::string zout;
+    start = clock::now();
+    mangle::zlib_adapter::uncompress(err, zout, z);
+    std::chrono::duration<double, std::milli> adapter = clock::now() - start;
+
+    std::cout << std::setw(26) << "frame verify"
+              << std::setw(12) << verify.count()
+              << std::setw(12) << plain.size() / verify.count() / 1000 << std::endl;
+    std::cout << std::setw(26) << "frame inflate + checks"
+              << std::setw(12) << inflate.count()
+              << std::setw(12) << plain.size() / inflate.count() / 1000
+              << (ok && out == plain ? "" : "  FAILED") << std::endl;
+    std::cout << std::setw(26) << "zlib_adapter inflate"
+              << std::setw(12) << adapter.count()
+              << std::setw(12) << plain.size() / adapter.count() / 1000
+              << (sink ? "" : " ") << std::endl;
+  }
+
+  void
+  zlib_bench::
+  exec() {
+    parallel();
+    batching();
+    adaptive();
+    checksums();
+  }
+}
+
+int main(int argc, char* argv[]) {
+
+  test::zlib_bench zb(argc > 1 ? atoi(argv[1]) : 64);
+  zb.exec();
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <error_code.hpp>
+#include "hash.hpp"
+#include "xmldom.hpp"
+
+namespace ingest {
+
+  /**
+   * Class: Bind Cache
+   *
+   * Bound messages keyed by the text they were bound from, so a payload
+   * seen again, a retry or the same message fanned in from two feeds,
+   * skips parse and bind and shares the object bound the first time.
+   * Objects are handed out const, nobody may change a shared one.
+   *
+   * The key is hash64 of the text, the text itself is kept alongside
+   * and compared on a hit so a collision can never return the wrong
+   * message. Entries live in shards, each a mutex, an LRU list and a
+   * hash map, picked by the top bits of the hash. Each shard gets an
+   * equal part of the memory cap and evicts from its cold end to stay
+   * within it. An entry is charged for its key text, the bound object
+   * and whatever heap the object owns as its footprint() reports: for a
+   * binding its mapping trees, list items and string values. Types
+   * that are not bindings provide a footprint() of their own.
+   */
+  template <class T>
+  class bind_cache {
+  public:
+
+    typedef std::shared_ptr<const T> value;
+
+    struct counters {
+      uint64_t  hits;
+      uint64_t  misses;
+      uint64_t  evictions;
+      uint64_t  collisions;
+      uint64_t  entries;
+      uint64_t  bytes;
+    };
+
+    explicit bind_cache(size_t capacity, unsigned shards = 16);
+
+    /// null on a miss
+    value find(uint64_t hash, const char* data, size_t size);
+
+    void insert(uint64_t hash, const char* data, size_t size, const value& v);
+
+    /// the cached object, or parses and binds and caches it
+    value bind(support::error_code& err,
+               xml::dom::parser& par,
+               const std::string& text);
+
+    counters stats() const;
+    void clear();
+
+  private:
+
+    bind_cache(const bind_cache&);
+    bind_cache& operator=(const bind_cache&);
+
+    struct entry {
+      uint64_t     hash;
+      std::string  text;
+      value        bound;
+      size_t       cost;
+    };
+
+    typedef std::list<entry> lru_t;
+
+    struct shard {
+      shard() : bytes(0) {}
+      std::mutex                                              lock;
+      lru_t                                                   lru;
+      std::unordered_map<uint64_t, typename lru_t::iterator>  index;
+      size_t                                                  bytes;
+    };
+
+    shard& pick(uint64_t hash);
+    void evict(shard& s);
+
+    std::vector<std::unique_ptr<shard> >  shards_;
+    size_t                                shard_capacity_;
+    std::atomic<uint64_t>                 hits_;
+    std::atomic<uint64_t>                 misses_;
+    std::atomic<uint64_t>                 evictions_;
+    std::atomic<uint64_t>                 collisions_;
+  };
+
+  template <class T>
+  inline
+  bind_cache<T>::
+  bind_cache(size_t capacity,
+             unsigned shards) :
+    hits_(0),
+    misses_(0),
+    evictions_(0),
+    collisions_(0) {
+
+    /// a power of two, the top bits of the hash pick one
+    unsigned count = 1;
+    while (count < shards && count < 1024) {
+      count <<= 1;
+    }
+    for (unsigned i = 0; i < count; ++i) {
+      shards_.emplace_back(new shard);
+    }
+    shard_capacity_ = capacity / count;
+  }
+
+  template <class T>
+  inline typename bind_cache<T>::shard&
+  bind_cache<T>::
+  pick(uint64_t hash) {
+    /// the low bits feed the map buckets, shard on the high ones
+    return *shards_[(hash >> 40) & (shards_.size() - 1)];
+  }
+
+  template <class T>
+  inline void
+  bind_cache<T>::
+  evict(shard& s) {
+    while (s.bytes > shard_capacity_ && ! s.lru.empty()) {
+      entry& e = s.lru.back();
+      s.bytes -= e.cost;
+      s.index.erase(e.hash);
+      s.lru.pop_back();
+      ++evictions_;
+    }
+  }
+
+  template <class T>
+  inline typename bind_cache<T>::value
+  bind_cache<T>::
+  find(uint64_t hash,
+       const char* data,
+       size_t size) {
+
+    shard& s = pick(hash);
+    std::lock_guard<std::mutex> guard(s.lock);
+    typename std::unordered_map<uint64_t, typename lru_t::iterator>::iterator p =
+      s.index.find(hash);
+    if (p == s.index.end()) {
+      ++misses_;
+      return value();
+    }
+    const entry& e = *p->second;
+    if (e.text.size() != size || ::memcmp(e.text.data(), data, size) != 0) {
+      ++collisions_;
+      ++misses_;
+      return value();
+    }
+    /// most recently used to the front
+    s.lru.splice(s.lru.begin(), s.lru, p->second);
+    ++hits_;
+    return e.bound;
+  }
+
+  template <class T>
+  inline void
+  bind_cache<T>::
+  insert(uint64_t hash,
+         const char* data,
+         size_t size,
+         const value& v) {
+
+    if (! v) {
+      return;
+    }
+    /// the object shares its block with the shared_ptr counts
+    size_t cost = sizeof(entry) + size + 1 + sizeof(T) + 2 * sizeof(long) + v->footprint();
+    if (cost > shard_capacity_) {
+      return;
+    }
+    shard& s = pick(hash);
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    /// another thread got there first, or a colliding text, the newer wins
+    typename std::unordered_map<uint64_t, typename lru_t::iterator>::iterator p =
+      s.index.find(hash);
+    if (p != s.index.end()) {
+      s.bytes -= p->second->cost;
+      s.lru.erase(p->second);
+      s.index.erase(p);
+    }
+    s.lru.push_front(entry());
+    entry& e = s.lru.front();
+    e.hash = hash;
+    e.text.assign(data, size);
+    e.bound = v;
+    e.cost = cost;
+    s.index[hash] = s.lru.begin();
+    s.bytes += cost;
+    evict(s);
+  }
+
+  template <class T>
+  inline typename bind_cache<T>::value
+  bind_cache<T>::
+  bind(support::error_code& err,
+       xml::dom::parser& par,
+       const std::string& text) {
+
+    uint64_t hash = support::hash64(text.data(), text.size());
+    value v = find(hash, text.data(), text.size());
+    if (v) {
+      return v;
+    }
+    std::shared_ptr<T> bound = std::make_shared<T>();
+    if (! par.parse(err, text) || ! bound->bind(err, par.root())) {
+      return value();
+    }
+    insert(hash, text.data(), text.size(), bound);
+    return bound;
+  }
+
+  template <class T>
+  inline typename bind_cache<T>::counters
+  bind_cache<T>::
+  stats() const {
+
+    counters c;
+    c.hits = hits_;
+    c.misses = misses_;
+    c.evictions = evictions_;
+    c.collisions = collisions_;
+    c.entries = 0;
+    c.bytes = 0;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      shard& s = *shards_[i];
+      std::lock_guard<std::mutex> guard(s.lock);
+      c.entries += s.index.size();
+      c.bytes += s.bytes;
+    }
+    return c;
+  }
+
+  template <class T>
+  inline void
+  bind_cache<T>::
+  clear() {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      shard& s = *shards_[i];
+      std::lock_guard<std::mutex> guard(s.lock);
+      s.index.clear();
+      s.lru.clear();
+      s.bytes = 0;
+    }
+  }
+
+}  /// namespace ingest
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace support {
+
+  /**
+   * Class: Bounded Queue
+   *
+   * Lock-free multi producer, multi consumer ring of fixed capacity
+   * (rounded up to a power of two). Every cell carries a sequence
+   * number telling producers and consumers whose turn it is, so the
+   * only shared writes are the two cursors. A full queue is the
+   * backpressure: push waits until a consumer frees a cell.
+   *
+   * close() tells consumers no more items are coming, pop returns
+   * false once the queue is closed and drained.
+   */
+  template <class T>
+  class bounded_queue {
+  public:
+
+    explicit bounded_queue(size_t capacity);
+
+    bool try_push(const T& value);
+    bool try_pop(T& value);
+
+    /// block with a spin, yield, sleep backoff
+    void push(const T& value);
+    bool pop(T& value);
+
+    void close();
+    bool closed() const;
+    size_t capacity() const;
+
+  private:
+
+    bounded_queue(const bounded_queue&);
+    bounded_queue& operator=(const bounded_queue&);
+
+    static void backoff(unsigned& spins);
+
+    struct cell {
+      std::atomic<size_t>  sequence;
+      T                    value;
+    };
+
+    /// keep the cursors on their own cache lines
+    std::vector<cell>     cells_;
+    size_t                mask_;
+    char                  pad0_[64];
+    std::atomic<size_t>   head_;
+    char                  pad1_[64];
+    std::atomic<size_t>   tail_;
+    char                  pad2_[64];
+    std::atomic<bool>     closed_;
+  };
+
+  template <class T>
+  inline
+  bounded_queue<T>::
+  bounded_queue(size_t capacity) :
+    head_(0),
+    tail_(0),
+    closed_(false) {
+
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    std::vector<cell> cells(size);
+    cells_.swap(cells);
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mask_ = size - 1;
+  }
+
+  template <class T>
+  inline size_t
+  bounded_queue<T>::
+  capacity() const {
+    return mask_ + 1;
+  }
+
+  template <class T>
+  inline bool
+  bounded_queue<T>::
+  try_push(const T& value) {
+
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell& c = cells_[pos & mask_];
+      size_t seq = c.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          c.value = value;
+          c.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0) {
+        /// full
+        return false;
+      }
+      else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  template <class T>
+  inline bool
+  bounded_queue<T>::
+  try_pop(T& value) {
+
+    size_t pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell& c = cells_[pos & mask_];
+      size_t seq = c.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          value = c.value;
+          c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0) {
+        /// empty
+        return false;
+      }
+      else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  template <class T>
+  inline void
+  bounded_queue<T>::
+  backoff(unsigned& spins) {
+    if (++spins < 64) {
+      return;
+    }
+    if (spins < 128) {
+      std::this_thread::yield();
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+
+  template <class T>
+  inline void
+  bounded_queue<T>::
+  push(const T& value) {
+    unsigned spins = 0;
+    while (! try_push(value)) {
+      backoff(spins);
+    }
+  }
+
+  template <class T>
+  inline bool
+  bounded_queue<T>::
+  pop(T& value) {
+
+    unsigned spins = 0;
+    for (;;) {
+      if (try_pop(value)) {
+        return true;
+      }
+      /// closed, but a late push may still be in flight, look once more
+      if (closed_.load(std::memory_order_acquire)) {
+        return try_pop(value);
+      }
+      backoff(spins);
+    }
+  }
+
+  template <class T>
+  inline void
+  bounded_queue<T>::
+  close() {
+    closed_.store(true, std::memory_order_release);
+  }
+
+  template <class T>
+  inline bool
+  bounded_queue<T>::
+  closed() const {
+    return closed_.load(std::memory_order_acquire);
+  }
+
+}  /// namespace support
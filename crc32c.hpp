@@ -0,0 +1,264 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace support {
+
+  /**
+   * CRC-32C (Castagnoli), the check iSCSI, ext4 and friends use.
+   *
+   * On x86-64 with SSE4.2, picked at run time, the crc32 instruction
+   * runs over three independent lanes to hide its latency, the lanes
+   * are then folded together with precomputed shift tables. Elsewhere
+   * slicing by eight tables. Both give the same value, pass the
+   * previous result as 'crc' to continue over more data.
+   */
+  class crc32c {
+  public:
+
+    static uint32_t compute(uint32_t crc, const void* data, size_t size);
+
+    /// the table version, whatever the cpu
+    static uint32_t portable(uint32_t crc, const void* data, size_t size);
+
+    static bool hardware();
+
+  private:
+
+    static const uint32_t poly = 0x82f63b78;
+
+    /// lane lengths of the hardware loop
+    static const size_t long_lane = 8192;
+    static const size_t short_lane = 256;
+
+    struct tables {
+      tables();
+      uint32_t  slice[8][256];
+      uint32_t  long_shift[4][256];
+      uint32_t  short_shift[4][256];
+    };
+
+    static const tables& get();
+
+    static uint32_t times(const uint32_t* mat, uint32_t vec);
+    static void square(uint32_t* square, const uint32_t* mat);
+    static void zeros(uint32_t shift[][256], size_t length);
+    static uint32_t shift(const uint32_t table[][256], uint32_t crc);
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    static uint32_t sse42(uint32_t crc, const void* data, size_t size);
+#endif
+  };
+
+  inline uint32_t
+  crc32c::
+  times(const uint32_t* mat,
+        uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, ++mat) {
+      if (vec & 1) {
+        sum ^= *mat;
+      }
+    }
+    return sum;
+  }
+
+  inline void
+  crc32c::
+  square(uint32_t* square,
+         const uint32_t* mat) {
+    for (int n = 0; n < 32; ++n) {
+      square[n] = times(mat, mat[n]);
+    }
+  }
+
+  inline void
+  crc32c::
+  zeros(uint32_t shift[][256],
+        size_t length) {
+
+    /// the operator for one zero bit, squared up to 'length' zero
+    /// bytes, 'length' a power of two
+    uint32_t odd[32];
+    uint32_t even[32];
+    odd[0] = poly;
+    for (int n = 1; n < 32; ++n) {
+      odd[n] = uint32_t(1) << (n - 1);
+    }
+    square(even, odd);
+    square(odd, even);
+    const uint32_t* op = 0;
+    for (;;) {
+      square(even, odd);
+      length >>= 1;
+      if (! length) {
+        op = even;
+        break;
+      }
+      square(odd, even);
+      length >>= 1;
+      if (! length) {
+        op = odd;
+        break;
+      }
+    }
+    for (uint32_t n = 0; n < 256; ++n) {
+      shift[0][n] = times(op, n);
+      shift[1][n] = times(op, n << 8);
+      shift[2][n] = times(op, n << 16);
+      shift[3][n] = times(op, n << 24);
+    }
+  }
+
+  inline uint32_t
+  crc32c::
+  shift(const uint32_t table[][256],
+        uint32_t crc) {
+    return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+           table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+  }
+
+  inline
+  crc32c::tables::
+  tables() {
+
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t crc = n;
+      for (int k = 0; k < 8; ++k) {
+        crc = crc & 1 ? (crc >> 1) ^ poly : crc >> 1;
+      }
+      slice[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t crc = slice[0][n];
+      for (int k = 1; k < 8; ++k) {
+        crc = slice[0][crc & 0xff] ^ (crc >> 8);
+        slice[k][n] = crc;
+      }
+    }
+    zeros(long_shift, long_lane);
+    zeros(short_shift, short_lane);
+  }
+
+  inline const crc32c::tables&
+  crc32c::
+  get() {
+    static const tables t;
+    return t;
+  }
+
+  inline bool
+  crc32c::
+  hardware() {
+#if defined(__x86_64__)
+    static const bool sse = __builtin_cpu_supports("sse4.2");
+    return sse;
+#else
+    return false;
+#endif
+  }
+
+  inline uint32_t
+  crc32c::
+  compute(uint32_t crc,
+          const void* data,
+          size_t size) {
+#if defined(__x86_64__)
+    if (hardware()) {
+      return sse42(crc, data, size);
+    }
+#endif
+    return portable(crc, data, size);
+  }
+
+  inline uint32_t
+  crc32c::
+  portable(uint32_t crc,
+           const void* data,
+           size_t size) {
+
+    const tables& t = get();
+    const unsigned char* p = (const unsigned char*) data;
+    uint32_t c = ~crc;
+    for (; size && ((uintptr_t) p & 7); --size) {
+      c = t.slice[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+    }
+    for (; size >= 8; size -= 8, p += 8) {
+      uint64_t w;
+      ::memcpy(&w, p, 8);
+      w ^= c;
+      c = t.slice[7][w & 0xff] ^
+          t.slice[6][(w >> 8) & 0xff] ^
+          t.slice[5][(w >> 16) & 0xff] ^
+          t.slice[4][(w >> 24) & 0xff] ^
+          t.slice[3][(w >> 32) & 0xff] ^
+          t.slice[2][(w >> 40) & 0xff] ^
+          t.slice[1][(w >> 48) & 0xff] ^
+          t.slice[0][w >> 56];
+    }
+    for (; size; --size) {
+      c = t.slice[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+    }
+    return ~c;
+  }
+
+#if defined(__x86_64__)
+  __attribute__((target("sse4.2")))
+  inline uint32_t
+  crc32c::
+  sse42(uint32_t crc,
+        const void* data,
+        size_t size) {
+
+    const tables& t = get();
+    const unsigned char* p = (const unsigned char*) data;
+    uint64_t c0 = ~crc;
+    for (; size && ((uintptr_t) p & 7); --size) {
+      c0 = _mm_crc32_u8(c0, *p++);
+    }
+
+    /// three lanes at a time, lanes 1 and 2 shifted into lane 0 after
+    size_t lanes[] = { long_lane, short_lane };
+    const uint32_t (*shifts[])[256] = { t.long_shift, t.short_shift };
+    for (int l = 0; l < 2; ++l) {
+      size_t lane = lanes[l];
+      while (size >= 3 * lane) {
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        const unsigned char* end = p + lane;
+        do {
+          uint64_t w0, w1, w2;
+          ::memcpy(&w0, p, 8);
+          ::memcpy(&w1, p + lane, 8);
+          ::memcpy(&w2, p + 2 * lane, 8);
+          c0 = _mm_crc32_u64(c0, w0);
+          c1 = _mm_crc32_u64(c1, w1);
+          c2 = _mm_crc32_u64(c2, w2);
+          p += 8;
+        }
+        while (p < end);
+        c0 = shift(shifts[l], (uint32_t) c0) ^ c1;
+        c0 = shift(shifts[l], (uint32_t) c0) ^ c2;
+        p += 2 * lane;
+        size -= 3 * lane;
+      }
+    }
+    for (; size >= 8; size -= 8, p += 8) {
+      uint64_t w;
+      ::memcpy(&w, p, 8);
+      c0 = _mm_crc32_u64(c0, w);
+    }
+    for (; size; --size) {
+      c0 = _mm_crc32_u8(c0, *p++);
+    }
+    return ~(uint32_t) c0;
+  }
+#endif
+
+}  /// namespace support
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+namespace support {
+
+  /**
+   * Fast non-cryptographic 64 bit hash.
+   *
+   * Consumes eight bytes per step with a multiply/rotate mix in the
+   * spirit of xxhash, good enough to tell chunks of a message apart.
+   * Not stable across endianness, never persist it.
+   */
+  inline uint64_t
+  hash64(const void* data,
+         size_t size,
+         uint64_t seed = 0) {
+
+    const uint64_t p1 = 0x9e3779b185ebca87ULL;
+    const uint64_t p2 = 0xc2b2ae3d27d4eb4fULL;
+    const uint64_t p3 = 0x165667b19e3779f9ULL;
+
+    const unsigned char* p = (const unsigned char*) data;
+    const unsigned char* end = p + size;
+    uint64_t h = seed + p3 + size;
+
+    for (; p + 8 <= end; p += 8) {
+      uint64_t k;
+      ::memcpy(&k, p, 8);
+      k *= p2;
+      k = (k << 31) | (k >> 33);
+      k *= p1;
+      h ^= k;
+      h = ((h << 27) | (h >> 37)) * p1 + p3;
+    }
+    for (; p < end; ++p) {
+      h ^= (*p) * p3;
+      h = ((h << 11) | (h >> 53)) * p1;
+    }
+    /// final avalanche
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+  }
+
+}  /// namespace support
@@ -0,0 +1,532 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <functional>
+#include <error_code.hpp>
+#include "bounded_queue.hpp"
+#include "alloc_stats.hpp"
+#include "zlib_adapter.hpp"
+#include "xmldom.hpp"
+#include "xmlgrammar.hpp"
+#include "bind_cache.hpp"
+
+namespace ingest {
+
+  /**
+   * Class: Settings
+   *
+   * Workers per stage and the depth of the queues between them. The
+   * depth bounds the messages in flight, once a queue is full the stage
+   * feeding it waits, all the way back to submit().
+   */
+  struct settings {
+
+    settings() :
+      readers(1),
+      inflaters(1),
+      parsers(1),
+      binders(1),
+      deliverers(1),
+      depth(64),
+      compressed(true)
+    {}
+
+    unsigned  readers;
+    unsigned  inflaters;
+    unsigned  parsers;
+    unsigned  binders;
+
+    /// one deliverer calls back in order of completion, never concurrently
+    unsigned  deliverers;
+    size_t    depth;
+
+    /// false for plain xml files, the inflate stage just passes them on
+    bool      compressed;
+  };
+
+  /**
+   * Class: Stage Stats
+   *
+   * What a stage did: busy is time spent on the work itself, starved
+   * time waiting for input, blocked time waiting for room downstream.
+   * A stage blocked a lot wants fewer workers, or more downstream.
+   */
+  struct stage_stats {
+
+    std::string  name;
+    unsigned     workers;
+    uint64_t     items;
+    uint64_t     failed;
+    uint64_t     busy_ns;
+    uint64_t     starved_ns;
+    uint64_t     blocked_ns;
+
+    /// what the stage's work allocated since start(), as far as
+    /// alloc_stats sees it
+    support::alloc_counts  allocs;
+  };
+
+  /**
+   * Class: Pipeline
+   *
+   * read -> inflate -> parse -> bind -> deliver, each stage with its own
+   * workers, bounded lock-free queues in between. Xerces must be
+   * initialized by the caller. Failed messages carry their error down
+   * the line and are delivered with it, a non zero code and no result,
+   * nothing is dropped.
+   *
+   * submit() may be called from any number of threads, finish() once
+   * after the last submit.
+   *
+   * With a bind_cache set, a message whose text is already cached skips
+   * parse and bind and is delivered the cached object, which is why
+   * results are const.
+   */
+  template <class T>
+  class pipeline {
+  public:
+
+    typedef std::shared_ptr<const T> result;
+    typedef std::function<void (const support::error_code& err,
+                                const std::string& source,
+                                result r)> delivery;
+
+    pipeline(const settings& s, const delivery& d);
+    ~pipeline();
+
+    /// before start(), the cache must outlive the pipeline
+    void cache(bind_cache<T>* c);
+
+    /// before start(), every message is validated against the locked
+    /// pool, which must outlive the pipeline
+    void validate(const xml::dom::grammar_pool* grammars);
+
+    void start();
+
+    /// blocks while the pipeline is full
+    void submit(const std::string& path);
+
+    /// drains everything submitted and stops the workers
+    void finish();
+
+    std::vector<stage_stats> stats() const;
+
+    /// the whole file into out
+    static bool read(support::error_code& err,
+                     const std::string& path,
+                     mangle::bytes& out);
+
+  private:
+
+    pipeline(const pipeline&);
+    pipeline& operator=(const pipeline&);
+
+    typedef std::chrono::steady_clock clock;
+
+    struct job {
+      job() : parser(0), hash(0), failed(false) {}
+      std::string               source;
+      mangle::bytes             raw;
+      std::string               text;
+      xml::dom::parser*         parser;
+      uint64_t                  hash;
+      result                    bound;
+      support::error_code       err;
+
+      /// set by the first stage to fail, the later ones pass it on
+      bool                      failed;
+    };
+
+    typedef support::bounded_queue<job*> queue;
+
+    struct stage {
+      stage(const char* n, unsigned w) :
+        name(n), workers(w ? w : 1), live(0),
+        items(0), failed(0), busy_ns(0), starved_ns(0), blocked_ns(0),
+        allocs(support::alloc_stats::of(std::string("pipeline/") + n))
+      {}
+      const char*            name;
+      unsigned               workers;
+      std::atomic<unsigned>  live;
+      std::atomic<uint64_t>  items;
+      std::atomic<uint64_t>  failed;
+      std::atomic<uint64_t>  busy_ns;
+      std::atomic<uint64_t>  starved_ns;
+      std::atomic<uint64_t>  blocked_ns;
+
+      /// shared by the pipelines of a process, it outlives them all
+      support::alloc_counter& allocs;
+    };
+
+    enum { reading, inflating, parsing, binding, delivering, stage_count };
+
+    void work(unsigned index);
+    void process(unsigned index, job* j);
+    xml::dom::parser* acquire();
+    void recycle(xml::dom::parser* p);
+
+    static uint64_t since(clock::time_point start);
+
+    settings                        settings_;
+    delivery                        delivery_;
+    std::vector<std::unique_ptr<stage> > stages_;
+
+    /// queues_[i] feeds stage i
+    std::vector<std::unique_ptr<queue> > queues_;
+
+    /// parsers go back to the parse stage once bound, the dom they
+    /// hold is released on their next parse
+    support::bounded_queue<xml::dom::parser*> parsers_;
+    std::vector<std::thread>        threads_;
+    bind_cache<T>*                  cache_;
+    const xml::dom::grammar_pool*   grammars_;
+    bool                            started_;
+  };
+
+  /**
+   * Class: File Replay
+   *
+   * Submits a fixed set of files a number of times over, a stand in for
+   * the feed when measuring the pipeline.
+   */
+  class file_replay {
+  public:
+
+    file_replay(const std::vector<std::string>& paths, size_t rounds);
+
+    /// returns the number of messages submitted
+    template <class T>
+    size_t drive(pipeline<T>& p) const;
+
+  private:
+    std::vector<std::string>  paths_;
+    size_t                    rounds_;
+  };
+
+  template <class T>
+  inline
+  pipeline<T>::
+  pipeline(const settings& s,
+           const delivery& d) :
+    settings_(s),
+    delivery_(d),
+    parsers_(s.depth + s.parsers + s.binders),
+    cache_(0),
+    grammars_(0),
+    started_(false) {
+
+    stages_.emplace_back(new stage("read", s.readers));
+    stages_.emplace_back(new stage("inflate", s.inflaters));
+    stages_.emplace_back(new stage("parse", s.parsers));
+    stages_.emplace_back(new stage("bind", s.binders));
+    stages_.emplace_back(new stage("deliver", s.deliverers));
+    for (unsigned i = 0; i < stage_count; ++i) {
+      queues_.emplace_back(new queue(s.depth));
+    }
+  }
+
+  template <class T>
+  inline
+  pipeline<T>::
+  ~pipeline() {
+
+    if (started_) {
+      finish();
+    }
+    xml::dom::parser* p = 0;
+    while (parsers_.try_pop(p)) {
+      delete p;
+    }
+  }
+
+  template <class T>
+  inline void
+  pipeline<T>::
+  cache(bind_cache<T>* c) {
+    cache_ = c;
+  }
+
+  template <class T>
+  inline void
+  pipeline<T>::
+  validate(const xml::dom::grammar_pool* grammars) {
+    grammars_ = grammars;
+  }
+
+  template <class T>
+  inline void
+  pipeline<T>::
+  start() {
+
+    if (started_) {
+      return;
+    }
+    started_ = true;
+    for (unsigned i = 0; i < stage_count; ++i) {
+      stages_[i]->allocs.reset();
+      stages_[i]->live = stages_[i]->workers;
+      for (unsigned w = 0; w < stages_[i]->workers; ++w) {
+        threads_.push_back(std::thread(&pipeline::work, this, i));
+      }
+    }
+  }
+
+  template <class T>
+  inline void
+  pipeline<T>::
+  submit(const std::string& path) {
+
+    job* j = new job;
+    j->source = path;
+    queues_[reading]->push(j);
+  }
+
+  template <class T>
+  inline void
+  pipeline<T>::
+  finish() {
+
+    if (! started_) {
+      return;
+    }
+    /// each stage closes the next one as its last worker leaves
+    queues_[reading]->close();
+    for (size_t i = 0; i < threads_.size(); ++i) {
+      threads_[i].join();
+    }
+    threads_.clear();
+    started_ = false;
+  }
+
+  template <class T>
+  inline std::vector<stage_stats>
+  pipeline<T>::
+  stats() const {
+
+    std::vector<stage_stats> all;
+    for (unsigned i = 0; i < stage_count; ++i) {
+      const stage& s = *stages_[i];
+      stage_stats st;
+      st.name = s.name;
+      st.workers = s.workers;
+      st.items = s.items;
+      st.failed = s.failed;
+      st.busy_ns = s.busy_ns;
+      st.starved_ns = s.starved_ns;
+      st.blocked_ns = s.blocked_ns;
+      st.allocs = s.allocs.counts();
+      all.push_back(st);
+    }
+    return all;
+  }
+
+  template <class T>
+  inline uint64_t
+  pipeline<T>::
+  since(clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+  }
+
+  template <class T>
+  inline void
+  pipeline<T>::
+  work(unsigned index) {
+
+    stage& s = *stages_[index];
+    queue& in = *queues_[index];
+    queue* out = index + 1 < stage_count ? queues_[index + 1].get() : 0;
+
+    job* j = 0;
+    for (;;) {
+
+      clock::time_point start = clock::now();
+      if (! in.pop(j)) {
+        break;
+      }
+      s.starved_ns += since(start);
+
+      start = clock::now();
+      {
+        support::alloc_scope scope(s.allocs);
+        process(index, j);
+      }
+      s.busy_ns += since(start);
+      ++s.items;
+
+      if (out) {
+        start = clock::now();
+        out->push(j);
+        s.blocked_ns += since(start);
+      }
+    }
+    /// last one out lets the next stage drain and stop
+    if (--s.live == 0 && out) {
+      out->close();
+    }
+  }
+
+  template <class T>
+  inline void
+  pipeline<T>::
+  process(unsigned index,
+          job* j) {
+
+    stage& s = *stages_[index];
+    bool result = true;
+    switch (index) {
+
+      case reading:
+        if (settings_.compressed) {
+          result = read(j->err, j->source, j->raw);
+        }
+        else {
+          mangle::bytes raw;
+          result = read(j->err, j->source, raw);
+          j->text.assign(raw.begin(), raw.end());
+        }
+        break;
+
+      case inflating:
+        if (settings_.compressed && ! j->failed) {
+          result = mangle::zlib_adapter::uncompress(j->err, j->text, j->raw);
+          mangle::bytes().swap(j->raw);
+        }
+        break;
+
+      case parsing:
+        if (! j->failed && cache_) {
+          j->hash = support::hash64(j->text.data(), j->text.size());
+          j->bound = cache_->find(j->hash, j->text.data(), j->text.size());
+        }
+        if (! j->failed && ! j->bound) {
+          j->parser = acquire();
+          result = j->parser->parse(j->err, j->text);
+
+          /// the cache keeps the text as its key, hold on to it till then
+          if (! cache_) {
+            std::string().swap(j->text);
+          }
+        }
+        break;
+
+      case binding:
+        if (! j->failed && ! j->bound) {
+          std::shared_ptr<T> bound = std::make_shared<T>();
+          result = bound->bind(j->err, j->parser->root());
+          if (result) {
+            j->bound = bound;
+            if (cache_) {
+              cache_->insert(j->hash, j->text.data(), j->text.size(), j->bound);
+            }
+          }
+        }
+        std::string().swap(j->text);
+        if (j->parser) {
+          recycle(j->parser);
+          j->parser = 0;
+        }
+        break;
+
+      case delivering:
+        delivery_(j->err, j->source, j->bound);
+        delete j;
+        break;
+    }
+    if (! result) {
+      ++s.failed;
+
+      /// parse and bind only attach their errors, the one delivered
+      /// gets a code with what they attached underneath
+      j->failed = true;
+      if (! j->err.code()) {
+        support::error_code top(-1, std::string("Failed to ") + s.name + " " + j->source);
+        const support::error_code::error_codes& attached = j->err.chain();
+        for (size_t i = 0; i < attached.size(); ++i) {
+          top.attach(attached[i]);
+        }
+        j->err = top;
+      }
+    }
+  }
+
+  template <class T>
+  inline xml::dom::parser*
+  pipeline<T>::
+  acquire() {
+    xml::dom::parser* p = 0;
+    if (parsers_.try_pop(p)) {
+      return p;
+    }
+    return grammars_ ? new xml::dom::parser(*grammars_) : new xml::dom::parser;
+  }
+
+  template <class T>
+  inline void
+  pipeline<T>::
+  recycle(xml::dom::parser* p) {
+    if (! parsers_.try_push(p)) {
+      delete p;
+    }
+  }
+
+  template <class T>
+  inline bool
+  pipeline<T>::
+  read(support::error_code& err,
+       const std::string& path,
+       mangle::bytes& out) {
+
+    FILE* f = ::fopen(path.c_str(), "rb");
+    if (! f) {
+      std::ostringstream oss;
+      oss << "Failed to open " << path;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      return false;
+    }
+    out.clear();
+    unsigned char buffer[16 * 1024];
+    size_t count = 0;
+    while ((count = ::fread(buffer, 1, sizeof(buffer), f)) > 0) {
+      out.insert(out.end(), buffer, buffer + count);
+    }
+    bool result = ! ::ferror(f);
+    ::fclose(f);
+    if (! result) {
+      std::ostringstream oss;
+      oss << "Failed to read " << path;
+      support::error_code::attach_or_create(err, -1, oss.str());
+    }
+    return result;
+  }
+
+  inline
+  file_replay::
+  file_replay(const std::vector<std::string>& paths,
+              size_t rounds) :
+    paths_(paths),
+    rounds_(rounds)
+  {}
+
+  template <class T>
+  inline size_t
+  file_replay::
+  drive(pipeline<T>& p) const {
+
+    size_t count = 0;
+    for (size_t r = 0; r < rounds_; ++r) {
+      for (size_t i = 0; i < paths_.size(); ++i, ++count) {
+        p.submit(paths_[i]);
+      }
+    }
+    return count;
+  }
+
+}  /// namespace ingest
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "xmldom.hpp"
+#include "xmlconverter.hpp"
+#include "xmlbinding.hpp"
+
+enum class vmaster_instrument : uint8_t {
+  swap,
+  swaption,
+  cap_floor,
+  fra,
+  basis_swap,
+  cross_currency_swap,
+  other
+};
+
+enum class vmaster_trade_status : uint8_t {
+  pending_unapproved,
+  pending_approved,
+  approved,
+  amended,
+  cancelled,
+  matured,
+  other
+};
+
+enum class vmaster_swap_clear_flag : uint8_t {
+  not_cleared,
+  cleared,
+  pending_clearing,
+  other
+};
+
+namespace xml {
+namespace binding {
+
+  /// only SWAP, PENDING_UNAPPROVED and "Not Cleared" have been seen in a
+  /// message, the rest of each vocabulary is what the desks use and may
+  /// not be all of it, anything else binds as other
+  template <>
+  struct enum_names<vmaster_instrument> {
+    static constexpr const char* name(size_t i) {
+      const char* const names[] = {
+        "SWAP", "SWAPTION", "CAP_FLOOR", "FRA", "BASIS_SWAP", "CROSS_CURRENCY_SWAP", 0
+      };
+      return names[i];
+    }
+    static constexpr vmaster_instrument other() { return vmaster_instrument::other; }
+  };
+
+  template <>
+  struct enum_names<vmaster_trade_status> {
+    static constexpr const char* name(size_t i) {
+      const char* const names[] = {
+        "PENDING_UNAPPROVED", "PENDING_APPROVED", "APPROVED", "AMENDED", "CANCELLED", "MATURED", 0
+      };
+      return names[i];
+    }
+    static constexpr vmaster_trade_status other() { return vmaster_trade_status::other; }
+  };
+
+  template <>
+  struct enum_names<vmaster_swap_clear_flag> {
+    static constexpr const char* name(size_t i) {
+      const char* const names[] = { "Not Cleared", "Cleared", "Pending Clearing", 0 };
+      return names[i];
+    }
+    static constexpr vmaster_swap_clear_flag other() { return vmaster_swap_clear_flag::other; }
+  };
+
+}}
+
+struct vmaster_diary_entry : xml::binding::composite {
+
+  vmaster_diary_entry() {
+    insert("diaryText", text);
+  }
+  xml::binding::element_string  text;
+};
+
+struct vmaster_diary : xml::binding::composite {
+
+  vmaster_diary() {
+    insert("vMasterDiaryEntry", entries);
+  }
+  xml::binding::nodelist<vmaster_diary_entry> entries;
+};
+
+struct vmaster_header : xml::binding::composite {
+
+  vmaster_header() {
+    insert("type",                  type);
+    insert("vMasterInstrument",     instrument);
+    insert("vMasterTradeStatus",    trade_status);
+    insert("vMasterTradeDate",      trade_date);
+    insert("vMasterStartDate",      start_date);
+    insert("RTLCReferenceCode",     rtlc_reference_code);
+    insert("vMasterEndDate",        end_date);
+    insert("vMasterTradeOrigin",    trade_origin);
+    insert("vMasterTradeOriginID",  trade_origin_id);
+    insert("vMasterTrader",         trader);
+    insert("vMasterCoverage",       coverage);
+    insert("vMasterLocation",       location);
+    insert("vMasterBook",           book);
+    insert("vMasterUserLogin",      user_login);
+    insert("vMasterBookLocation",   book_location);
+    insert("vMasterBookDomicile",   book_domicile);
+    insert("vMasterEntity",         entity);
+    insert("vMasterEntityCoperID",  entity_coper_id);
+    insert("vMasterMLDPGuarantee",  mldp_guarantee);
+    insert("vMasterSwapClearFlag",  swap_clear_flag);
+    insert("vMasterCreditCode",     credit_code);
+    insert("vMasterDesk",           desk);
+    insert("vMasterRevisionDate",   revision_date);
+    insert("vMasterCreationDate",   creation_date);
+    insert("vMasterDiary",          diary);
+  }
+
+  xml::binding::attribute_string                       type;
+  xml::binding::element_enum<vmaster_instrument>       instrument;
+  xml::binding::element_enum<vmaster_trade_status>     trade_status;
+  xml::binding::element_string                         trade_date;
+  xml::binding::element_string                         start_date;
+  xml::binding::element_string                         rtlc_reference_code;
+  xml::binding::element_string                         end_date;
+  xml::binding::element_string                         trade_origin;
+  xml::binding::element_string                         trade_origin_id;
+  xml::binding::element_string                         trader;
+  xml::binding::element_string                         coverage;
+  xml::binding::element_interned                       location;
+  xml::binding::element_string                         book;
+  xml::binding::element_string                         user_login;
+  xml::binding::element_interned                       book_location;
+  xml::binding::element_string                         book_domicile;
+  xml::binding::element_interned                       entity;
+  xml::binding::element_int                            entity_coper_id;
+  xml::binding::element_string                         mldp_guarantee;
+  xml::binding::element_enum<vmaster_swap_clear_flag>  swap_clear_flag;
+  xml::binding::element_string                         credit_code;
+  xml::binding::element_interned                       desk;
+  xml::binding::element_string                         revision_date;
+  xml::binding::element_string                         creation_date;
+  vmaster_diary                                        diary;
+};
+
+struct vmaster_message : xml::binding::composite {
+
+  static constexpr const char* key() { return "vMasterMessage"; }
+
+  vmaster_message() {
+    insert("vMasterHeader", vm_header);
+  }
+
+  vmaster_header vm_header;
+};
+
+struct vmaster_cancel : xml::binding::composite {
+
+  static constexpr const char* key() { return "vMasterCancel"; }
+
+  vmaster_cancel() {
+    insert("vMasterTradeOriginID",  trade_origin_id);
+    insert("vMasterReason",         reason);
+  }
+
+  xml::binding::element_string  trade_origin_id;
+  xml::binding::element_string  reason;
+};
+
+/// whatever the feed sends, picked by the document element
+typedef xml::binding::choice<vmaster_message, vmaster_cancel> vmaster_feed;
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace support {
+
+  /**
+   * Class: Work Pool
+   *
+   * Fork/join over a fixed set of threads. run() spreads its tasks over
+   * the workers' queues, each worker takes from the back of its own and
+   * steals from the front of the others once it runs dry, so uneven
+   * tasks even out. The caller does not sleep while it waits, it steals
+   * too, which also makes a run() from inside a task safe: nested work
+   * is helped along rather than waited on.
+   */
+  class work_pool {
+  public:
+
+    typedef std::function<void ()> task;
+
+    explicit work_pool(unsigned threads = std::thread::hardware_concurrency());
+    ~work_pool();
+
+    /// returns once every task has run
+    void run(std::vector<task>& tasks);
+
+    unsigned size() const;
+
+  private:
+
+    work_pool(const work_pool&);
+    work_pool& operator=(const work_pool&);
+
+    struct item {
+      task*                 work;
+      std::atomic<size_t>*  remaining;
+    };
+
+    struct queue {
+      std::mutex        lock;
+      std::deque<item>  items;
+    };
+
+    void work(unsigned index);
+    bool take(unsigned index, item& i);
+    bool steal(unsigned from, item& i);
+    void execute(const item& i);
+
+    std::vector<std::unique_ptr<queue> >  queues_;
+    std::vector<std::thread>              threads_;
+    std::mutex                            sleep_;
+    std::condition_variable               wake_;
+    std::atomic<size_t>                   queued_;
+    bool                                  stop_;
+  };
+
+  inline
+  work_pool::
+  work_pool(unsigned threads) :
+    queued_(0),
+    stop_(false) {
+
+    unsigned count = threads ? threads : 1;
+    for (unsigned i = 0; i < count; ++i) {
+      queues_.emplace_back(new queue);
+    }
+    for (unsigned i = 0; i < count; ++i) {
+      threads_.push_back(std::thread(&work_pool::work, this, i));
+    }
+  }
+
+  inline
+  work_pool::
+  ~work_pool() {
+    {
+      std::lock_guard<std::mutex> guard(sleep_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i) {
+      threads_[i].join();
+    }
+  }
+
+  inline unsigned
+  work_pool::
+  size() const {
+    return threads_.size();
+  }
+
+  inline bool
+  work_pool::
+  take(unsigned index,
+       item& i) {
+
+    queue& q = *queues_[index];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.items.empty()) {
+      return false;
+    }
+    i = q.items.back();
+    q.items.pop_back();
+    --queued_;
+    return true;
+  }
+
+  inline bool
+  work_pool::
+  steal(unsigned from,
+        item& i) {
+
+    /// everyone else's queue, oldest and so likely largest first
+    for (size_t n = 1; n <= queues_.size(); ++n) {
+      queue& q = *queues_[(from + n) % queues_.size()];
+      std::lock_guard<std::mutex> guard(q.lock);
+      if (! q.items.empty()) {
+        i = q.items.front();
+        q.items.pop_front();
+        --queued_;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline void
+  work_pool::
+  execute(const item& i) {
+    (*i.work)();
+    i.remaining->fetch_sub(1, std::memory_order_release);
+  }
+
+  inline void
+  work_pool::
+  work(unsigned index) {
+
+    item i;
+    for (;;) {
+      if (take(index, i) || steal(index, i)) {
+        execute(i);
+        continue;
+      }
+      std::unique_lock<std::mutex> guard(sleep_);
+      wake_.wait(guard, [this]() { return stop_ || queued_ > 0; });
+      if (stop_ && queued_ == 0) {
+        return;
+      }
+    }
+  }
+
+  inline void
+  work_pool::
+  run(std::vector<task>& tasks) {
+
+    if (tasks.empty()) {
+      return;
+    }
+    std::atomic<size_t> remaining(tasks.size());
+
+    /// dealt out round robin, stealing evens out the rest
+    for (size_t t = 0; t < tasks.size(); ++t) {
+      queue& q = *queues_[t % queues_.size()];
+      item i = { &tasks[t], &remaining };
+      std::lock_guard<std::mutex> guard(q.lock);
+      q.items.push_back(i);
+      ++queued_;
+    }
+    {
+      std::lock_guard<std::mutex> guard(sleep_);
+    }
+    wake_.notify_all();
+
+    /// help rather than block, tasks of other runs included
+    item i;
+    unsigned spins = 0;
+    while (remaining.load(std::memory_order_acquire) > 0) {
+      if (steal(0, i)) {
+        execute(i);
+        spins = 0;
+      }
+      else if (++spins > 64) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+}  /// namespace support
@@ -1,19 +1,109 @@
 #pragma once
 
+#include <string.h>
+#include <strings.h>
 #include <map>
+#include <new>
 #include <string>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+#include "hash.hpp"
+#include "work_pool.hpp"
 // #include "xmldom.hpp"
 // #include "xmlconverter.hpp"
 
 namespace xml {
 namespace binding {
 
+  /// an element's bytes in a source buffer, see 'delta'
+  struct fragment {
+    const char*  begin;
+    const char*  tag_end;     /// one past the start tag
+    const char*  end;
+    uint64_t     hash;
+  };
+  typedef std::vector<fragment> fragments;
+
+  class delta;
+  class composite;
+  class shape_plan;
+
+  /**
+   * Class: Visitor
+   *
+   * Walks a bound tree. Composites and lists are entered and left,
+   * leaves are reported with their converted value, widened to long,
+   * double or string. Names are the mapping names, in mapping order,
+   * members that were not bound are skipped.
+   */
+  class visitor {
+  public:
+    virtual ~visitor();
+    virtual void enter(const std::string& name, const composite& c);
+    virtual void leave(const std::string& name, const composite& c);
+    virtual void enter_list(const std::string& name, size_t size);
+    virtual void leave_list(const std::string& name);
+    virtual void leaf(const std::string& name, long value);
+    virtual void leaf(const std::string& name, double value);
+    virtual void leaf(const std::string& name, const std::string& value);
+  };
+
   class node_base {
    public:
-    virtual bool bind(support::error_code& err, dom::node::ptr np) = 0;
+
+    /// binds to the element behind an adapter node, e.g. parser::root()
+    bool bind(support::error_code& err, dom::node::ptr np);
+
+    /// binds straight from the xerces element or attribute
+    virtual bool bind(support::error_code& err, xercesc::DOMNode* xnode) = 0;
+
+    /// nodes that want all occurrences of their element at once say
+    /// so, composite::bind then gathers them for bind_batch, which by
+    /// default binds them one by one
+    virtual bool batched() const;
+    virtual bool bind_batch(support::error_code& err,
+                            const std::vector<xercesc::DOMNode*>& xnodes);
+
+    /// brings the node up to date with the occurrences of its element
+    /// in an updated buffer, 'before' being the ones it was bound from
+    virtual bool rebind(support::error_code& err,
+                        delta& d,
+                        const fragments& before,
+                        const fragments& after,
+                        const std::string& path);
+
+    /// forgets whatever was bound
+    virtual void reset() = 0;
+
+    virtual void accept(visitor& v, const std::string& name) const = 0;
+
+    /// describes what this node binds to the parser, leaves keep
+    /// their whole element
+    virtual void project(dom::projection& p) const;
+
+    /// binds a leaf from raw utf-8 text, see shape_binder
+    virtual bool bind_text(support::error_code& err, const char* text, size_t size);
+
+    /// reports the leaves bound from the element, after a bind from
+    /// it, leaves report themselves
+    virtual void plan(shape_plan& p, xercesc::DOMNode* xnode);
+
+    /// heap owned on top of sizeof, what a cache holding it pays for
+    virtual size_t footprint() const;
+
+    node_base();
     virtual ~node_base();
+
+  private:
+
+    friend class composite;
+
+    /// the bit standing for this node in its composite's presence map
+    static const uint32_t no_slot = uint32_t(-1);
+    uint32_t slot_;
   };
 
   template <class T>  /// where T is the converter type
@@ -35,23 +125,17 @@ namespace binding {
     value_type& operator()()
     { return converter_.access(); }
 
-    typedef node<T> this_type;
-    typedef void (this_type::*bool_hack)() const;
-    void bool_workaround() const
-    {}
-
-    operator bool_hack() const {
-      bool result = converter_;
-      return result ? &this_type::bool_workaround : 0;
-    }
-
-    const std::string& name() const;
+    /// the bound text, string converters only
     const std::string& value() const;
-
     std::string& value();
 
     typedef std::shared_ptr<node> ptr;
-    virtual bool bind(support::error_code& err, dom::node::ptr np);
+    using node_base::bind;
+    virtual bool bind(support::error_code& err, xercesc::DOMNode* xnode);
+    virtual bool bind_text(support::error_code& err, const char* text, size_t size);
+    virtual void reset();
+    virtual void accept(visitor& v, const std::string& name) const;
+    virtual size_t footprint() const;
 
   protected:
     converter_type converter_;
@@ -74,33 +158,101 @@ namespace binding {
 
     composite();
 
+    /// copies keep their own members in the mappings
+    composite(const composite& other);
+    composite& operator=(const composite& other);
+
     /// get children of node
     /// iterate over each child
     /// look for an entry in mappings
     /// if found invoke bind on the node pointer *with* the child node
     /// currently being handled
     ///
-    virtual bool bind(support::error_code& err, dom::node::ptr np);
+    using node_base::bind;
+    virtual bool bind(support::error_code& err, xercesc::DOMNode* xnode);
+
+    /// adds a child projection for every mapped name
+    virtual void project(dom::projection& p) const;
+
+    /// descends into the element when it occurs once on both sides
+    virtual bool rebind(support::error_code& err,
+                        delta& d,
+                        const fragments& before,
+                        const fragments& after,
+                        const std::string& path);
+    virtual void reset();
+    virtual void accept(visitor& v, const std::string& name) const;
+    virtual void plan(shape_plan& p, xercesc::DOMNode* xnode);
+
+    /// the mapping nodes and their names, and the members' own heap
+    virtual size_t footprint() const;
+
+    /// whether the member was bound, one bit test
+    bool has(const node_base& member) const;
 
   protected:
 
-    /// inserts an entry into mappings based on name and node ptr
+    friend class delta;
+
+    /// inserts an entry into mappings based on name and node
     /// this must be done by the child composite in its constructor
     /// the mappings will be used in 'bind' to propagate through
+    /// a copy maps its own member at the same offset
     void insert(const std::string& name, node_base* np);
     void insert(const std::string& name, node_base& n);
+
+    /// maps a node that lives outside the composite and outlives it,
+    /// copies map the same node and it is not part of the footprint
+    void insert_shared(const std::string& name, node_base& n);
     bool process_attributes(support::error_code& err, xercesc::DOMNode* xnode);
+    void mark(const node_base& member, bool present);
 
     typedef std::map<std::string, node_base*> mappings;
     mappings mappings_;
 
+    /// a bit per member, in insert order, the first 64 inline
+    uint32_t               slots_;
+    uint64_t               present_;
+    std::vector<uint64_t>  overflow_;
+
+  private:
+
+    /// nodes from insert_shared, not moved in copies, usually none
+    std::vector<const node_base*>  shared_;
   };
 
   template <class T>
   class nodelist : public node<string_converter> {
   public:
 
-    virtual bool bind(support::error_code& err, dom::node::ptr dnp);
+    nodelist();
+
+    /// opt in to binding long runs of items on a pool, at least
+    /// 'threshold' items, 'grain' items to a task. items are bound
+    /// into slots in document order, failed ones dropped as before
+    void parallelize(support::work_pool& pool,
+                     size_t threshold = 1024,
+                     size_t grain = 256);
+
+    using node_base::bind;
+    virtual bool bind(support::error_code& err, xercesc::DOMNode* xnode);
+    virtual bool batched() const;
+    virtual bool bind_batch(support::error_code& err,
+                            const std::vector<xercesc::DOMNode*>& xnodes);
+    virtual void project(dom::projection& p) const;
+
+    /// only binds the new items when entries were appended
+    virtual bool rebind(support::error_code& err,
+                        delta& d,
+                        const fragments& before,
+                        const fragments& after,
+                        const std::string& path);
+    virtual void reset();
+    virtual void accept(visitor& v, const std::string& name) const;
+
+    /// each occurrence is the next item along
+    virtual void plan(shape_plan& p, xercesc::DOMNode* xnode);
+    virtual size_t footprint() const;
 
     typedef std::vector<T> chain_t;
     const chain_t& chain() const;
@@ -113,7 +265,257 @@ namespace binding {
     T& operator[](size_t i);
 
   protected:
-    chain_t chain_;
+    chain_t              chain_;
+    support::work_pool*  pool_;
+    size_t               threshold_;
+    size_t               grain_;
+  };
+
+  /// the keys of a choice's alternatives, for its enum_table
+  template <class... Alts>
+  struct choice_keys {
+    static constexpr const char* name(size_t i) {
+      const char* const keys[] = { Alts::key()..., 0 };
+      return keys[i];
+    }
+  };
+
+  /**
+   * Class: Choice
+   *
+   * One of several bindings, picked while binding by the element name,
+   * or by the value of one of its attributes. Each alternative names
+   * its key with a static constexpr key():
+   *
+   *   struct vmaster_cancel : composite {
+   *     static constexpr const char* key() { return "vMasterCancel"; }
+   *
+   * The keys compile into the perfect hash the enum converters use and
+   * the position found indexes a table of constructors, picking costs
+   * a hash and one compare, no second parse. The bound alternative
+   * lives inside the choice, nothing is allocated. To choose between
+   * sibling elements map each name to the same choice, only the name
+   * of the bound alternative is visited. Under any other name, or as
+   * the root, the bound alternative is visited under that name.
+   */
+  template <class... Alts>
+  class choice : public node_base {
+  public:
+
+    static const size_t npos = size_t(-1);
+
+    /// keyed on the element name
+    choice();
+
+    /// keyed on the value of the named attribute
+    explicit choice(const std::string& attribute);
+
+    choice(const choice& other);
+    choice& operator=(const choice& other);
+    ~choice();
+
+    /// position of the bound alternative, npos if none
+    size_t index() const;
+
+    template <class A> bool is() const;
+    template <class A> const A* get() const;
+    template <class A> A* get();
+
+    using node_base::bind;
+    virtual bool bind(support::error_code& err, xercesc::DOMNode* xnode);
+    virtual void reset();
+    virtual void accept(visitor& v, const std::string& name) const;
+
+    /// every alternative's projection, any may turn up
+    virtual void project(dom::projection& p) const;
+
+    /// the bound alternative's leaves, from its own element only
+    virtual void plan(shape_plan& p, xercesc::DOMNode* xnode);
+    virtual size_t footprint() const;
+
+  private:
+
+    typedef node_base* (*create_fn)(void* at, const node_base* from);
+
+    template <class A>
+    static node_base* create(void* at, const node_base* from);
+
+    template <class A>
+    static void project_as(dom::projection& p);
+
+    template <class A>
+    static constexpr size_t position();
+
+    void assign(size_t i, const node_base* from);
+    const XMLCh* key_of(xercesc::DOMNode* xnode) const;
+
+    static constexpr enum_table<choice_keys<Alts...> > table_ =
+      enum_table<choice_keys<Alts...> >::build();
+
+    typename std::aligned_storage<std::max({ sizeof(Alts)... }),
+                                  std::max({ alignof(Alts)... })>::type storage_;
+    node_base*   active_;
+    size_t       index_;
+    std::string  attribute_;
+  };
+
+  /**
+   * Class: Delta
+   *
+   * Incremental re-binding. Given a composite bound from one buffer and
+   * an updated buffer, only the elements whose bytes hash differently
+   * are parsed and bound again. Unchanged subtrees are never handed to
+   * xerces, changed ones are collected and parsed in a single pass.
+   */
+  class delta {
+  public:
+
+    typedef std::vector<std::string> changes;
+
+    /// 'target' must have been bound from 'before'
+    bool rebind(support::error_code& err,
+                composite& target,
+                const std::string& before,
+                const std::string& after);
+
+    /// paths of the fields that changed in the last rebind,
+    /// e.g. "vMasterHeader/vMasterTradeStatus"
+    const changes& changed() const;
+
+    /// used by the binding nodes while walking the two buffers
+    bool descend(support::error_code& err,
+                 composite& c,
+                 const fragment& before,
+                 const fragment& after,
+                 const std::string& path);
+    void schedule(node_base* target, const fragment& f);
+    void record(const std::string& path);
+    static bool same(const fragments& before, const fragments& after);
+
+  private:
+
+    typedef std::map<std::string, fragments> children_t;
+
+    bool root(support::error_code& err, const std::string& buffer, fragment& f);
+    bool children(support::error_code& err, const fragment& f, children_t& out);
+    bool attributes(support::error_code& err,
+                    composite& c,
+                    const fragment& before,
+                    const fragment& after,
+                    const std::string& path,
+                    const children_t& elements);
+    bool flush(support::error_code& err);
+
+    /// a changed element, or attribute, waiting to be parsed and bound
+    struct pending {
+      node_base*   target;
+      const char*  begin;
+      const char*  end;
+      bool         attribute;
+    };
+
+    std::vector<pending>  pending_;
+    changes               changed_;
+    std::string           document_;
+    dom::parser           parser_;
+  };
+
+  /**
+   * Class: Shape Plan
+   *
+   * Where each leaf of a bound tree took its text from, by the position
+   * of the element in document order. Built by walking the tree and the
+   * document it was just bound from, side by side.
+   */
+  class shape_plan {
+  public:
+
+    struct step {
+      node_base*  leaf;
+      uint32_t    element;   /// start tags before it in the document
+    };
+    typedef std::vector<step> steps;
+
+    /// 'root' must have been bound from 'xroot' without a failure
+    void build(node_base& root, xercesc::DOMNode* xroot);
+    void clear();
+
+    const steps& get() const;
+
+    /// used by the binding nodes while walking
+    void leaf(node_base* n, xercesc::DOMNode* xnode);
+    size_t item(const node_base* list);
+
+  private:
+
+    void number(xercesc::DOMNode* xnode, uint32_t& next);
+
+    std::unordered_map<const xercesc::DOMNode*, uint32_t>  elements_;
+    std::unordered_map<const node_base*, size_t>           items_;
+    steps                                                  steps_;
+  };
+
+  /**
+   * Class: Shape Binder
+   *
+   * Binds a stream of messages that mostly share a shape, the markup
+   * without the character data: element names, nesting and order,
+   * attribute names and values, the prolog. The first message of a
+   * shape is parsed and bound as usual and the plan of where each leaf
+   * took its text from is kept. Next time the shape is the same, one
+   * scan of the buffer, the text is assigned to the same leaves in
+   * place and xerces is not involved at all. Lists keep their items
+   * and choices their alternative, attribute values being part of the
+   * shape. Text the raw bytes don't stand for, entity references, CDATA
+   * or carriage returns, goes the long way.
+   *
+   *   shape_binder<vmaster_message> binder;
+   *   while (next(buffer)) {
+   *     if (binder.bind(err, buffer)) {
+   *       publish(binder.get());
+   */
+  template <class T>
+  class shape_binder {
+  public:
+
+    shape_binder();
+
+    bool bind(support::error_code& err, const std::string& content);
+    bool bind(support::error_code& err, const char* content, size_t size);
+
+    /// the bound message, bound over by the next bind
+    const T& get() const;
+    T& get();
+
+    /// whether the last bind took the fast path, the parser's document
+    /// is then that of an earlier message
+    bool reused() const;
+
+  private:
+
+    shape_binder(const shape_binder&);
+    shape_binder& operator=(const shape_binder&);
+
+    /// the shape into key_ and each element's first text into texts_,
+    /// false if the markup can't be told from the scan
+    bool scan(const char* content, size_t size);
+    static bool utf8(const char* begin, const char* end);
+
+    struct text_ref {
+      const char*  begin;
+      size_t       size;
+    };
+
+    T                      target_;
+    dom::parser            parser_;
+    shape_plan             plan_;
+    std::string            shape_;     /// of the message the plan is for
+    std::string            key_;       /// of the message being bound
+    std::vector<text_ref>  texts_;
+    std::vector<uint32_t>  open_;
+    bool                   planned_;
+    bool                   clean_;     /// no text needs xerces to decode
+    bool                   reused_;
   };
 
 }}
@@ -1,16 +1,194 @@
 namespace xml {
 namespace binding {
 
+  inline
+  visitor::
+  ~visitor()
+  {}
+
+  inline void
+  visitor::
+  enter(const std::string& name,
+        const composite& c)
+  {}
+
+  inline void
+  visitor::
+  leave(const std::string& name,
+        const composite& c)
+  {}
+
+  inline void
+  visitor::
+  enter_list(const std::string& name,
+             size_t size)
+  {}
+
+  inline void
+  visitor::
+  leave_list(const std::string& name)
+  {}
+
+  inline void
+  visitor::
+  leaf(const std::string& name,
+       long value)
+  {}
+
+  inline void
+  visitor::
+  leaf(const std::string& name,
+       double value)
+  {}
+
+  inline void
+  visitor::
+  leaf(const std::string& name,
+       const std::string& value)
+  {}
+
+  /// widen converted values to what the visitor understands
+  inline void
+  accept_value(visitor& v, const std::string& name, short value)
+  { v.leaf(name, (long) value); }
+
+  inline void
+  accept_value(visitor& v, const std::string& name, int value)
+  { v.leaf(name, (long) value); }
+
+  inline void
+  accept_value(visitor& v, const std::string& name, long value)
+  { v.leaf(name, value); }
+
+  inline void
+  accept_value(visitor& v, const std::string& name, float value)
+  { v.leaf(name, (double) value); }
+
+  inline void
+  accept_value(visitor& v, const std::string& name, double value)
+  { v.leaf(name, value); }
+
+  inline void
+  accept_value(visitor& v, const std::string& name, const std::string& value)
+  { v.leaf(name, value); }
+
+  inline void
+  accept_value(visitor& v, const std::string& name, const interned_string& value)
+  { v.leaf(name, value.str()); }
+
+  /// the heap behind a converted value, only strings have any
+  template <class V>
+  inline size_t
+  heap_of(const V& value)
+  { return 0; }
+
+  inline size_t
+  heap_of(const std::string& value) {
+    /// short strings live inside the object
+    const char* p = value.data();
+    bool inside = p >= (const char*) &value && p < (const char*) (&value + 1);
+    return inside ? 0 : value.capacity() + 1;
+  }
+
+  template <class E>
+  inline typename std::enable_if<std::is_enum<E>::value>::type
+  accept_value(visitor& v, const std::string& name, E value)
+  { v.leaf(name, std::string(enum_name(value))); }
+
+  inline
+  node_base::
+  node_base() :
+    slot_(no_slot)
+  {}
+
   inline
   node_base::
   ~node_base()
   {}
 
-  template <class T>
-  inline const std::string&
-  node<T>::
-  name() const {
-    return converter_.name();
+  inline bool
+  node_base::
+  bind(support::error_code& err,
+       dom::node::ptr np) {
+
+    if (! np) {
+      std::string s = "Warning: bind supplied null dom::node ptr.";
+      err.attach(support::error_code(-1, s));
+      return false;
+    }
+    /// the adapter is only a way in, bind from the xerces node
+    xercesc::DOMNode* xnode = np->xerces_node();
+    if (! xnode) {
+      std::string s = "Warning: bind supplied null xerces::node ptr.";
+      err.attach(support::error_code(-1, s));
+      return false;
+    }
+    return bind(err, xnode);
+  }
+
+  inline bool
+  node_base::
+  batched() const {
+    return false;
+  }
+
+  inline bool
+  node_base::
+  bind_batch(support::error_code& err,
+             const std::vector<xercesc::DOMNode*>& xnodes) {
+    bool result = true;
+    for (size_t i = 0; i < xnodes.size(); ++i) {
+      result &= bind(err, xnodes[i]);
+    }
+    return result;
+  }
+
+  inline void
+  node_base::
+  project(dom::projection& p) const {
+    p.keep_all();
+  }
+
+  inline bool
+  node_base::
+  bind_text(support::error_code& err,
+            const char* text,
+            size_t size) {
+    support::error_code::attach_or_create(err, -1, "Only leaves bind from text");
+    return false;
+  }
+
+  inline void
+  node_base::
+  plan(shape_plan& p,
+       xercesc::DOMNode* xnode) {
+    p.leaf(this, xnode);
+  }
+
+  inline size_t
+  node_base::
+  footprint() const {
+    return 0;
+  }
+
+  inline bool
+  node_base::
+  rebind(support::error_code& err,
+         delta& d,
+         const fragments& before,
+         const fragments& after,
+         const std::string& path) {
+
+    if (delta::same(before, after)) {
+      return true;
+    }
+    /// a leaf is cheap, bind it again from its new bytes
+    d.record(path);
+    reset();
+    for (size_t i = 0; i < after.size(); ++i) {
+      d.schedule(this, after[i]);
+    }
+    return true;
   }
 
   template <class T>
@@ -31,40 +209,159 @@ namespace binding {
   inline bool
   node<T>::
   bind(support::error_code& err,
-       dom::node::ptr np) {
-    return this->converter_.bind(err, np);
+       xercesc::DOMNode* xnode) {
+    return this->converter_.bind(err, xnode);
+  }
+
+  template <class T>
+  inline bool
+  node<T>::
+  bind_text(support::error_code& err,
+            const char* text,
+            size_t size) {
+    return this->converter_.assign_utf8(err, text, size);
+  }
+
+  template <class T>
+  inline size_t
+  node<T>::
+  footprint() const {
+    return heap_of(converter_.access());
+  }
+
+  template <class T>
+  inline void
+  node<T>::
+  reset() {
+    this->converter_.reset();
+  }
+
+  template <class T>
+  inline void
+  node<T>::
+  accept(visitor& v,
+         const std::string& name) const {
+
+    accept_value(v, name, converter_.access());
   }
 
   inline
   composite::
-  composite() {}
+  composite() :
+    slots_(0),
+    present_(0)
+  {}
+
+  inline
+  composite::
+  composite(const composite& other) :
+    node<string_converter>(other),
+    mappings_(other.mappings_),
+    slots_(other.slots_),
+    present_(other.present_),
+    overflow_(other.overflow_),
+    shared_(other.shared_) {
+
+    /// the mapped members sit at the same offsets in the copy, shared
+    /// nodes stay where they are
+    mappings::iterator i = mappings_.begin();
+    for (; i != mappings_.end(); ++i) {
+      if (std::find(shared_.begin(), shared_.end(), i->second) != shared_.end()) {
+        continue;
+      }
+      const char* member = (const char*) i->second;
+      i->second = (node_base*) ((char*) this + (member - (const char*) &other));
+    }
+  }
+
+  inline composite&
+  composite::
+  operator=(const composite& other) {
+
+    /// same shape, our mappings already point at our own members
+    node<string_converter>::operator=(other);
+    present_ = other.present_;
+    overflow_ = other.overflow_;
+    return *this;
+  }
 
   inline void
   composite::
   insert(const std::string& name,
          node_base* np) {
+
+    /// a member mapped under several names, a choice, keeps one slot
     mappings_[name] = np;
+    if (np->slot_ == node_base::no_slot) {
+      np->slot_ = slots_++;
+    }
   }
 
   inline void
   composite::
   insert(const std::string& name,
          node_base& n) {
-    mappings_[name] = &n;
+    insert(name, &n);
+  }
+
+  inline void
+  composite::
+  insert_shared(const std::string& name,
+                node_base& n) {
+
+    if (std::find(shared_.begin(), shared_.end(), &n) == shared_.end()) {
+      shared_.push_back(&n);
+    }
+    insert(name, &n);
   }
 
   inline bool
   composite::
-  bind(support::error_code& err,
-       dom::node::ptr np) {
+  has(const node_base& member) const {
 
-    if (! np) {
-      std::string s = "Warning: composite::bind supplied null dom::node ptr.";
-      err.attach(support::error_code(-1, s));
+    uint32_t s = member.slot_;
+    if (s < 64) {
+      return (present_ >> s) & 1;
+    }
+    if (s == node_base::no_slot) {
       return false;
     }
+    s -= 64;
+    return s / 64 < overflow_.size() && (overflow_[s / 64] >> (s % 64)) & 1;
+  }
+
+  inline void
+  composite::
+  mark(const node_base& member,
+       bool present) {
+
+    uint32_t s = member.slot_;
+    uint64_t* word = &present_;
+    if (s >= 64) {
+      s -= 64;
+      if (overflow_.size() <= s / 64) {
+        if (! present) {
+          return;
+        }
+        overflow_.resize(s / 64 + 1);
+      }
+      word = &overflow_[s / 64];
+      s %= 64;
+    }
+    if (present) {
+      *word |= uint64_t(1) << s;
+    }
+    else {
+      *word &= ~(uint64_t(1) << s);
+    }
+  }
+
+  inline bool
+  composite::
+  bind(support::error_code& err,
+       xercesc::DOMNode* xnode) {
+
     /// we need the underlying xerces node to iterate
-    xercesc::DOMNode* xnode = np->xerces_node();
     if (! xnode) {
       std::string s = "Warning: composite::bind supplied null xerces::node ptr.";
       err.attach(support::error_code(-1, s));
@@ -77,8 +374,11 @@ namespace binding {
       err.attach(support::error_code(-1, s));
       return false;
     }
-    /// iterate through all links as siblings
+    /// iterate through all links as siblings, names are transcoded
+    /// into one buffer whose capacity is reused
     bool result = true;
+    std::string name;
+    std::vector<std::pair<node_base*, std::vector<xercesc::DOMNode*> > > batches;
     link = xnode->getFirstChild();
     for ( ; link != 0; link = link->getNextSibling() ) {
 
@@ -89,9 +389,7 @@ namespace binding {
         result = false;
         continue;
       }
-      char* s = xercesc::XMLString::transcode(link->getNodeName());
-      std::string name = s;
-      xercesc::XMLString::release(&s);
+      dom::transcode(link->getNodeName(), name);
       // std::cout << "Processing link: " << name << std::endl;
 
       /// for instance "vMasterInstrument" -> an element node..
@@ -101,26 +399,135 @@ namespace binding {
         /// we're not interested, continue
         continue;
       }
-      /// create the adapter dom node using the factory
-      dom::node::ptr dnp = dom::node_factory::create(err, link);
-      if (!dnp) {
-
-        /// some unhandled node type...must be careful
-        std::string s = "Warning: could not create adapter node from link.";
-        err.attach(support::error_code(-1, s));
-        result = false;
+      /// ready to bind, pass in the current xerces node
+      /// the binding node extracts/converts the value from it
+      binding::node_base* bnp = p->second;
+      if (bnp->batched()) {
+        size_t b = 0;
+        while (b < batches.size() && batches[b].first != bnp) {
+          ++b;
+        }
+        if (b == batches.size()) {
+          batches.push_back(std::make_pair(bnp, std::vector<xercesc::DOMNode*>()));
+        }
+        batches[b].second.push_back(link);
         continue;
       }
-      /// ready to bind, pass in the current dom node ptr
-      /// the binding node will adopt and it extract/convert the value
-      binding::node_base* bnp = p->second;
-      result &= bnp->bind(err, dnp);
+      /// a member that failed to convert reads as absent
+      bool bound = bnp->bind(err, link);
+      result &= bound;
+      mark(*bnp, bound);
+    }
+    /// the gathered runs, in order of first occurrence
+    for (size_t b = 0; b < batches.size(); ++b) {
+      bool bound = batches[b].first->bind_batch(err, batches[b].second);
+      result &= bound;
+      mark(*batches[b].first, bound);
     }
     /// this node may have child attributes
     result &= process_attributes(err, xnode);
     return result;
   }
 
+  inline void
+  composite::
+  project(dom::projection& p) const {
+
+    /// attribute names end up here too, they never match an element
+    mappings::const_iterator i = mappings_.begin();
+    for (; i != mappings_.end(); ++i) {
+      i->second->project(p.insert(i->first));
+    }
+  }
+
+  inline bool
+  composite::
+  rebind(support::error_code& err,
+         delta& d,
+         const fragments& before,
+         const fragments& after,
+         const std::string& path) {
+
+    if (before.size() == 1 && after.size() == 1) {
+      return d.descend(err, *this, before[0], after[0], path);
+    }
+    return node_base::rebind(err, d, before, after, path);
+  }
+
+  inline void
+  composite::
+  accept(visitor& v,
+         const std::string& name) const {
+
+    v.enter(name, *this);
+    mappings::const_iterator i = mappings_.begin();
+    for (; i != mappings_.end(); ++i) {
+      if (has(*i->second)) {
+        i->second->accept(v, i->first);
+      }
+    }
+    v.leave(name, *this);
+  }
+
+  inline void
+  composite::
+  plan(shape_plan& p,
+       xercesc::DOMNode* xnode) {
+
+    /// the walk bind took, attributes are part of the shape
+    std::string name;
+    xercesc::DOMNode* link = xnode->getFirstChild();
+    for (; link != 0; link = link->getNextSibling()) {
+      if (link->getNodeType() != xercesc::DOMNode::ELEMENT_NODE) {
+        continue;
+      }
+      dom::transcode(link->getNodeName(), name);
+      mappings::iterator i = mappings_.find(name);
+      if (i != mappings_.end()) {
+        i->second->plan(p, link);
+      }
+    }
+  }
+
+  inline size_t
+  composite::
+  footprint() const {
+
+    /// a tree node is the entry plus three links and a colour
+    const size_t node_size = sizeof(mappings::value_type) + 4 * sizeof(void*);
+    size_t bytes = node<string_converter>::footprint() + overflow_.capacity() * sizeof(uint64_t);
+    bytes += shared_.capacity() * sizeof(const node_base*);
+
+    /// fewer slots than names, some node, a choice, has several names
+    bool aliased = slots_ < mappings_.size();
+    mappings::const_iterator i = mappings_.begin();
+    for (; i != mappings_.end(); ++i) {
+      bytes += node_size + heap_of(i->first);
+
+      /// each node once, under its first name
+      bool first = true;
+      for (mappings::const_iterator j = mappings_.begin(); aliased && first && j != i; ++j) {
+        first = j->second != i->second;
+      }
+      /// shared nodes are paid for by whoever owns them
+      if (first && std::find(shared_.begin(), shared_.end(), i->second) == shared_.end()) {
+        bytes += i->second->footprint();
+      }
+    }
+    return bytes;
+  }
+
+  inline void
+  composite::
+  reset() {
+    mappings::iterator i = mappings_.begin();
+    for (; i != mappings_.end(); ++i) {
+      i->second->reset();
+    }
+    present_ = 0;
+    overflow_.clear();
+  }
+
   inline bool
   composite::
   process_attributes(support::error_code& err,
@@ -137,6 +544,7 @@ namespace binding {
       return true;
     }
     /// search for each attr in this nodes mappings
+    std::string attr_name;
     for (XMLSize_t i = 0; i < attrs->getLength(); ++i) {
 
       xercesc::DOMNode* dap = attrs->item(i);
@@ -145,10 +553,8 @@ namespace binding {
         continue;
       }
       /// get the attribute name out of the item
-      char* s = xercesc::XMLString::transcode(dap->getNodeName());
-      std::string attr_name = s;
+      dom::transcode(dap->getNodeName(), attr_name);
       // std::cout << "attr name: " << attr_name << std::endl;
-      xercesc::XMLString::release(&s);
 
       /// skip if we're not interested in this attribute under this node
       mappings::iterator p = mappings_.find(attr_name);
@@ -157,15 +563,94 @@ namespace binding {
       }
       binding::node_base* bnp = p->second;
 
-      /// ask the factory to create the node
-      dom::node::ptr anp = dom::node_factory::create(err, dap);
-      if (! anp) {
-        /// hmm
+      /// and bind to it, present only if it converted
+      bool bound = bnp->bind(err, dap);
+      result &= bound;
+      mark(*bnp, bound);
+    }
+    return result;
+  }
+
+  template <class T>
+  inline
+  nodelist<T>::
+  nodelist() :
+    pool_(0),
+    threshold_(0),
+    grain_(1)
+  {}
+
+  template <class T>
+  inline void
+  nodelist<T>::
+  parallelize(support::work_pool& pool,
+              size_t threshold,
+              size_t grain) {
+    pool_ = &pool;
+    threshold_ = threshold;
+    grain_ = grain ? grain : 1;
+  }
+
+  template <class T>
+  inline bool
+  nodelist<T>::
+  batched() const {
+    return pool_ != 0;
+  }
+
+  template <class T>
+  inline bool
+  nodelist<T>::
+  bind_batch(support::error_code& err,
+             const std::vector<xercesc::DOMNode*>& xnodes) {
+
+    if (! pool_ || xnodes.size() < threshold_) {
+      return node_base::bind_batch(err, xnodes);
+    }
+    /// a slot per item, each task binds its own range of slots and
+    /// collects its own errors, binding only reads the document
+    size_t base = chain_.size();
+    size_t count = xnodes.size();
+    chain_.resize(base + count);
+    std::vector<char> bound(count, 0);
+    size_t tasks = (count + grain_ - 1) / grain_;
+    std::vector<support::error_code> errors(tasks);
+    std::vector<support::work_pool::task> work;
+    work.reserve(tasks);
+    for (size_t t = 0; t < tasks; ++t) {
+      size_t first = t * grain_;
+      size_t last = first + grain_ < count ? first + grain_ : count;
+      work.push_back([this, &xnodes, &bound, &errors, base, t, first, last]() {
+        for (size_t i = first; i < last; ++i) {
+          bound[i] = chain_[base + i].bind(errors[t], xnodes[i]);
+        }
+      });
+    }
+    pool_->run(work);
+
+    /// errors in document order, as a serial bind leaves them
+    for (size_t t = 0; t < tasks; ++t) {
+      const support::error_code::error_codes& chain = errors[t].chain();
+      for (size_t c = 0; c < chain.size(); ++c) {
+        err.attach(chain[c]);
+      }
+      if (errors[t].code()) {
+        support::error_code::attach_or_create(err, errors[t].code(), errors[t].text());
+      }
+    }
+    /// close up the slots of items that failed
+    size_t kept = base;
+    for (size_t i = 0; i < count; ++i) {
+      if (! bound[i]) {
         continue;
       }
-      /// and bind to it
-      result &= bnp->bind(err, anp);
+      if (kept != base + i) {
+        chain_[kept] = chain_[base + i];
+      }
+      ++kept;
     }
+    bool result = kept == base + count;
+    chain_.resize(kept);
     return result;
   }
 
@@ -173,35 +658,121 @@ namespace binding {
   inline bool
   nodelist<T>::
   bind(support::error_code& err,
-       dom::node::ptr dnp) {
+       xercesc::DOMNode* xnode) {
 
-    /// construct an instance of 'T' - default constructor??
-    T item;
+    /// construct the item in place - default constructor??
+    chain_.push_back(T());
 
-    /// now bind it to the supplied node ptr
-    bool result = item.bind(err, dnp);
+    /// now bind it to the supplied node
+    bool result = chain_.back().bind(err, xnode);
 
     /// could the binding fail, possibly
-    if (result) {
+    if (! result) {
 
-      /// binding was ok, add to the list items
-      chain_.push_back(item);
+      /// binding failed, drop it from the list items
+      chain_.pop_back();
     }
     return result;
   }
 
   template <class T>
-  inline const typename nodelist<T>::chain_t&
+  inline void
   nodelist<T>::
-  chain() const {
-    return chain_;
-  }
+  project(dom::projection& p) const {
 
-  template <class T>
-  inline typename nodelist<T>::chain_t&
-  nodelist<T>::
-  chain() {
-    return chain_;
+    /// every item has the same shape, a prototype describes them all
+    T item;
+    item.project(p);
+  }
+
+  template <class T>
+  inline size_t
+  nodelist<T>::
+  footprint() const {
+
+    size_t bytes = node<string_converter>::footprint() + chain_.capacity() * sizeof(T);
+    for (size_t i = 0; i < chain_.size(); ++i) {
+      bytes += chain_[i].footprint();
+    }
+    return bytes;
+  }
+
+  template <class T>
+  inline void
+  nodelist<T>::
+  plan(shape_plan& p,
+       xercesc::DOMNode* xnode) {
+
+    size_t i = p.item(this);
+    if (i < chain_.size()) {
+      chain_[i].plan(p, xnode);
+    }
+  }
+
+  template <class T>
+  inline bool
+  nodelist<T>::
+  rebind(support::error_code& err,
+         delta& d,
+         const fragments& before,
+         const fragments& after,
+         const std::string& path) {
+
+    if (delta::same(before, after)) {
+      return true;
+    }
+    d.record(path);
+
+    /// entries appended to an otherwise unchanged list, the usual case
+    /// for a diary, only need the new ones bound. the chain must line
+    /// up with the old entries, bind drops items that failed
+    size_t common = 0;
+    while (common < before.size() && common < after.size() &&
+           before[common].hash == after[common].hash) {
+      ++common;
+    }
+    if (common != before.size() || chain_.size() != before.size()) {
+      reset();
+      common = 0;
+    }
+    for (size_t i = common; i < after.size(); ++i) {
+      d.schedule(this, after[i]);
+    }
+    return true;
+  }
+
+  template <class T>
+  inline void
+  nodelist<T>::
+  reset() {
+    chain_.clear();
+  }
+
+  template <class T>
+  inline void
+  nodelist<T>::
+  accept(visitor& v,
+         const std::string& name) const {
+
+    v.enter_list(name, chain_.size());
+    for (size_t i = 0; i < chain_.size(); ++i) {
+      chain_[i].accept(v, name);
+    }
+    v.leave_list(name);
+  }
+
+  template <class T>
+  inline const typename nodelist<T>::chain_t&
+  nodelist<T>::
+  chain() const {
+    return chain_;
+  }
+
+  template <class T>
+  inline typename nodelist<T>::chain_t&
+  nodelist<T>::
+  chain() {
+    return chain_;
   }
 
   template <class T>
@@ -232,18 +803,788 @@ namespace binding {
     return chain_[i];
   }
 
-  typedef element<int_converter>       element_int;
-  typedef element<short_converter>     element_short;
-  typedef element<long_converter>      element_long;
-  typedef element<float_converter>     element_float;
-  typedef element<double_converter>    element_double;
-  typedef element<string_converter>    element_string;
+  inline bool
+  delta::
+  same(const fragments& before,
+       const fragments& after) {
+
+    if (before.size() != after.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < before.size(); ++i) {
+      if (before[i].hash != after[i].hash) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  inline const delta::changes&
+  delta::
+  changed() const {
+    return changed_;
+  }
+
+  inline void
+  delta::
+  record(const std::string& path) {
+    changed_.push_back(path);
+  }
+
+  inline void
+  delta::
+  schedule(node_base* target,
+           const fragment& f) {
+    pending item = { target, f.begin, f.end, false };
+    pending_.push_back(item);
+  }
+
+  inline bool
+  delta::
+  rebind(support::error_code& err,
+         composite& target,
+         const std::string& before,
+         const std::string& after) {
+
+    changed_.clear();
+    pending_.clear();
+
+    fragment b, a;
+    if (! root(err, before, b) || ! root(err, after, a)) {
+      return false;
+    }
+    /// a different document altogether, nothing to reuse
+    dom::scanner::token bt, at;
+    dom::scanner(b.begin, b.tag_end).next(bt);
+    dom::scanner(a.begin, a.tag_end).next(at);
+    if (bt.name_size != at.name_size ||
+        ::memcmp(bt.name, at.name, at.name_size) != 0) {
+
+      target.reset();
+      record("");
+      if (! parser_.parse(err, after)) {
+        return false;
+      }
+      return target.bind(err, parser_.root());
+    }
+    bool result = descend(err, target, b, a, "");
+    result &= flush(err);
+    return result;
+  }
+
+  inline bool
+  delta::
+  root(support::error_code& err,
+       const std::string& buffer,
+       fragment& f) {
+
+    dom::scanner sc(buffer.data(), buffer.data() + buffer.size());
+    dom::scanner::token t;
+    while (sc.next(t)) {
+      if (t.type == dom::scanner::start_tag ||
+          t.type == dom::scanner::empty_tag) {
+
+        f.begin = t.begin;
+        f.tag_end = t.end;
+        if (t.type == dom::scanner::start_tag && ! sc.skip_subtree()) {
+          break;
+        }
+        f.end = sc.position();
+        f.hash = support::hash64(f.begin, f.end - f.begin);
+        return true;
+      }
+    }
+    std::string s = "Delta: could not find a complete document element.";
+    err.attach(support::error_code(-1, s));
+    return false;
+  }
+
+  inline bool
+  delta::
+  children(support::error_code& err,
+           const fragment& f,
+           children_t& out) {
+
+    dom::scanner sc(f.tag_end, f.end);
+    dom::scanner::token t;
+    std::string name;
+    while (sc.next(t)) {
+
+      if (t.type != dom::scanner::start_tag &&
+          t.type != dom::scanner::empty_tag) {
+        continue;
+      }
+      fragment child;
+      child.begin = t.begin;
+      child.tag_end = t.end;
+      if (t.type == dom::scanner::start_tag && ! sc.skip_subtree()) {
+        std::string s = "Delta: unterminated element.";
+        err.attach(support::error_code(-1, s));
+        return false;
+      }
+      child.end = sc.position();
+      child.hash = support::hash64(child.begin, child.end - child.begin);
+      name.assign(t.name, t.name_size);
+      out[name].push_back(child);
+    }
+    return true;
+  }
+
+  inline bool
+  delta::
+  descend(support::error_code& err,
+          composite& c,
+          const fragment& before,
+          const fragment& after,
+          const std::string& path) {
+
+    if (before.hash == after.hash) {
+      return true;
+    }
+    children_t b, a;
+    if (! children(err, before, b) || ! children(err, after, a)) {
+      return false;
+    }
+    bool result = true;
+
+    /// attributes live in the start tag, only look when it changed
+    if (before.tag_end - before.begin != after.tag_end - after.begin ||
+        ::memcmp(before.begin, after.begin, before.tag_end - before.begin) != 0) {
+      result &= attributes(err, c, before, after, path, a);
+    }
+    /// a node mapped under several names, a choice, is present when
+    /// any of them is in the new bytes, marked once all are seen
+    std::map<node_base*, bool> present;
+    const fragments none;
+    composite::mappings::iterator i = c.mappings_.begin();
+    for (; i != c.mappings_.end(); ++i) {
+
+      children_t::const_iterator pb = b.find(i->first);
+      children_t::const_iterator pa = a.find(i->first);
+      const fragments& fb = pb == b.end() ? none : pb->second;
+      const fragments& fa = pa == a.end() ? none : pa->second;
+      if (fb.empty() && fa.empty()) {
+        continue;
+      }
+      std::string child = path.empty() ? i->first : path + "/" + i->first;
+      result &= i->second->rebind(err, *this, fb, fa, child);
+      present[i->second] |= ! fa.empty();
+    }
+    std::map<node_base*, bool>::const_iterator p = present.begin();
+    for (; p != present.end(); ++p) {
+      c.mark(*p->first, p->second);
+    }
+    return result;
+  }
+
+  inline bool
+  delta::
+  attributes(support::error_code& err,
+             composite& c,
+             const fragment& before,
+             const fragment& after,
+             const std::string& path,
+             const children_t& elements) {
+
+    /// raw name -> name="value" for both start tags
+    typedef std::map<std::string, dom::scanner::attribute> attrs_t;
+    attrs_t b, a;
+    const fragment* sides[] = { &before, &after };
+    attrs_t* maps[] = { &b, &a };
+    for (int i = 0; i < 2; ++i) {
+
+      dom::scanner sc(sides[i]->begin, sides[i]->tag_end);
+      dom::scanner::token t;
+      sc.next(t);
+      const char* p = t.name + t.name_size;
+      dom::scanner::attribute attr;
+      while (dom::scanner::next_attribute(p, t, attr)) {
+        (*maps[i])[std::string(attr.name, attr.name_size)] = attr;
+      }
+    }
+    composite::mappings::iterator i = c.mappings_.begin();
+    for (; i != c.mappings_.end(); ++i) {
+
+      /// child elements are handled by the caller
+      if (elements.count(i->first)) {
+        continue;
+      }
+      attrs_t::const_iterator pb = b.find(i->first);
+      attrs_t::const_iterator pa = a.find(i->first);
+      if (pb == b.end() && pa == a.end()) {
+        continue;
+      }
+      if (pb != b.end() && pa != a.end() &&
+          pb->second.value_size == pa->second.value_size &&
+          ::memcmp(pb->second.value, pa->second.value, pa->second.value_size) == 0) {
+        continue;
+      }
+      record(path.empty() ? i->first : path + "/" + i->first);
+      i->second->reset();
+      c.mark(*i->second, pa != a.end());
+      if (pa != a.end()) {
+        pending item = { i->second, pa->second.begin, pa->second.end, true };
+        pending_.push_back(item);
+      }
+    }
+    return true;
+  }
+
+  inline bool
+  delta::
+  flush(support::error_code& err) {
+
+    if (pending_.empty()) {
+      return true;
+    }
+    /// one document holds every changed fragment, parsed in one go
+    document_ = "<delta>";
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      if (pending_[i].attribute) {
+        document_ += "<a ";
+        document_.append(pending_[i].begin, pending_[i].end);
+        document_ += "/>";
+      }
+      else {
+        document_.append(pending_[i].begin, pending_[i].end);
+      }
+    }
+    document_ += "</delta>";
+    if (! parser_.parse(err, document_)) {
+      return false;
+    }
+    dom::node::ptr root = parser_.root();
+    xercesc::DOMNode* link = root->xerces_node()->getFirstChild();
+    bool result = true;
+    for (size_t i = 0; i < pending_.size(); ++i) {
+
+      while (link && link->getNodeType() != xercesc::DOMNode::ELEMENT_NODE) {
+        link = link->getNextSibling();
+      }
+      if (! link) {
+        std::string s = "Delta: fragment document is missing elements.";
+        err.attach(support::error_code(-1, s));
+        return false;
+      }
+      xercesc::DOMNode* xnode = link;
+      if (pending_[i].attribute) {
+        xnode = link->getAttributes()->item(0);
+      }
+      result &= pending_[i].target->bind(err, xnode);
+      link = link->getNextSibling();
+    }
+    pending_.clear();
+    return result;
+  }
+
+  template <class... Alts>
+  constexpr enum_table<choice_keys<Alts...> > choice<Alts...>::table_;
+
+  template <class... Alts>
+  inline
+  choice<Alts...>::
+  choice() :
+    active_(0),
+    index_(npos)
+  {}
+
+  template <class... Alts>
+  inline
+  choice<Alts...>::
+  choice(const std::string& attribute) :
+    active_(0),
+    index_(npos),
+    attribute_(attribute)
+  {}
+
+  template <class... Alts>
+  inline
+  choice<Alts...>::
+  choice(const choice& other) :
+    node_base(other),
+    active_(0),
+    index_(npos),
+    attribute_(other.attribute_) {
+    assign(other.index_, other.active_);
+  }
+
+  template <class... Alts>
+  inline choice<Alts...>&
+  choice<Alts...>::
+  operator=(const choice& other) {
+    if (this != &other) {
+      attribute_ = other.attribute_;
+      assign(other.index_, other.active_);
+    }
+    return *this;
+  }
+
+  template <class... Alts>
+  inline
+  choice<Alts...>::
+  ~choice() {
+    assign(npos, 0);
+  }
+
+  template <class... Alts>
+  template <class A>
+  inline node_base*
+  choice<Alts...>::
+  create(void* at,
+         const node_base* from) {
+    return from ? new (at) A(static_cast<const A&>(*from)) : new (at) A();
+  }
+
+  template <class... Alts>
+  template <class A>
+  inline void
+  choice<Alts...>::
+  project_as(dom::projection& p) {
+    A prototype;
+    prototype.project(p);
+  }
+
+  template <class... Alts>
+  template <class A>
+  inline constexpr size_t
+  choice<Alts...>::
+  position() {
+    const bool same[] = { std::is_same<A, Alts>::value... };
+    for (size_t i = 0; i < sizeof...(Alts); ++i) {
+      if (same[i]) {
+        return i;
+      }
+    }
+    return npos;
+  }
+
+  template <class... Alts>
+  inline void
+  choice<Alts...>::
+  assign(size_t i,
+         const node_base* from) {
+
+    /// the alternative goes, a new one, a copy of 'from' if given,
+    /// takes its place
+    if (active_) {
+      active_->~node_base();
+      active_ = 0;
+      index_ = npos;
+    }
+    if (i == npos) {
+      return;
+    }
+    static const create_fn creators[] = { &choice::create<Alts>... };
+    active_ = creators[i](&storage_, from);
+    index_ = i;
+  }
+
+  template <class... Alts>
+  inline size_t
+  choice<Alts...>::
+  index() const {
+    return index_;
+  }
+
+  template <class... Alts>
+  template <class A>
+  inline bool
+  choice<Alts...>::
+  is() const {
+    static_assert(position<A>() != npos, "not an alternative of this choice");
+    return index_ == position<A>();
+  }
+
+  template <class... Alts>
+  template <class A>
+  inline const A*
+  choice<Alts...>::
+  get() const {
+    return is<A>() ? static_cast<const A*>(active_) : 0;
+  }
+
+  template <class... Alts>
+  template <class A>
+  inline A*
+  choice<Alts...>::
+  get() {
+    return is<A>() ? static_cast<A*>(active_) : 0;
+  }
+
+  template <class... Alts>
+  inline const XMLCh*
+  choice<Alts...>::
+  key_of(xercesc::DOMNode* xnode) const {
+
+    if (attribute_.empty()) {
+      return xnode->getNodeName();
+    }
+    xercesc::DOMNamedNodeMap* attrs = xnode->getAttributes();
+    XMLSize_t length = attrs ? attrs->getLength() : 0;
+    for (XMLSize_t i = 0; i < length; ++i) {
+
+      /// names compared unit by unit, no transcoding
+      xercesc::DOMNode* dap = attrs->item(i);
+      const XMLCh* n = dap ? dap->getNodeName() : 0;
+      size_t k = 0;
+      for (; n && n[k] && k < attribute_.size(); ++k) {
+        if (n[k] != XMLCh((unsigned char) attribute_[k])) {
+          break;
+        }
+      }
+      if (n && k == attribute_.size() && ! n[k]) {
+        return dom::text_of(dap);
+      }
+    }
+    return 0;
+  }
+
+  template <class... Alts>
+  inline bool
+  choice<Alts...>::
+  bind(support::error_code& err,
+       xercesc::DOMNode* xnode) {
+
+    if (! xnode) {
+      std::string s = "Warning: choice::bind supplied null xerces::node ptr.";
+      err.attach(support::error_code(-1, s));
+      return false;
+    }
+    const XMLCh* key = key_of(xnode);
+    if (! key) {
+      std::string s = "Choice: element has no attribute " + attribute_;
+      support::error_code::attach_or_create(err, -1, s);
+      return false;
+    }
+    size_t size = 0;
+    while (key[size]) {
+      ++size;
+    }
+    int i = table_.find(key, size);
+    if (i < 0) {
+      std::string k;
+      dom::transcode(key, k);
+      support::error_code::attach_or_create(err, -1, "Choice: no alternative for " + k);
+      return false;
+    }
+    /// the same alternative again is bound over, like any other node
+    if (index_ != size_t(i)) {
+      assign(i, 0);
+    }
+    return active_->bind(err, xnode);
+  }
+
+  template <class... Alts>
+  inline void
+  choice<Alts...>::
+  reset() {
+    assign(npos, 0);
+  }
+
+  template <class... Alts>
+  inline void
+  choice<Alts...>::
+  accept(visitor& v,
+         const std::string& name) const {
+
+    if (! active_) {
+      return;
+    }
+    /// mapped under every alternative's name, visited under its own,
+    /// under any other name, the root's "" too, it is the only mapping
+    if (attribute_.empty()) {
+      int i = table_.find(name.data(), name.size());
+      if (i >= 0 && size_t(i) != index_) {
+        return;
+      }
+    }
+    active_->accept(v, name);
+  }
+
+  template <class... Alts>
+  inline void
+  choice<Alts...>::
+  project(dom::projection& p) const {
+    int expand[] = { (project_as<Alts>(p), 0)... };
+    (void) expand;
+  }
+
+  template <class... Alts>
+  inline size_t
+  choice<Alts...>::
+  footprint() const {
+    /// the alternative itself lives inside the choice
+    return heap_of(attribute_) + (active_ ? active_->footprint() : 0);
+  }
+
+  template <class... Alts>
+  inline void
+  choice<Alts...>::
+  plan(shape_plan& p,
+       xercesc::DOMNode* xnode) {
+
+    if (! active_) {
+      return;
+    }
+    /// mapped under several names, only its own element bound it
+    const XMLCh* key = key_of(xnode);
+    if (! key) {
+      return;
+    }
+    size_t size = 0;
+    while (key[size]) {
+      ++size;
+    }
+    if (table_.find(key, size) == int(index_)) {
+      active_->plan(p, xnode);
+    }
+  }
+
+  inline void
+  shape_plan::
+  build(node_base& root,
+        xercesc::DOMNode* xroot) {
+
+    clear();
+    uint32_t next = 0;
+    number(xroot, next);
+    root.plan(*this, xroot);
+    elements_.clear();
+    items_.clear();
+  }
+
+  inline void
+  shape_plan::
+  clear() {
+    elements_.clear();
+    items_.clear();
+    steps_.clear();
+  }
+
+  inline const shape_plan::steps&
+  shape_plan::
+  get() const {
+    return steps_;
+  }
+
+  inline void
+  shape_plan::
+  number(xercesc::DOMNode* xnode,
+         uint32_t& next) {
+
+    /// document order, as the scanner meets the start tags
+    elements_[xnode] = next++;
+    xercesc::DOMNode* link = xnode->getFirstChild();
+    for (; link != 0; link = link->getNextSibling()) {
+      if (link->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
+        number(link, next);
+      }
+    }
+  }
+
+  inline void
+  shape_plan::
+  leaf(node_base* n,
+       xercesc::DOMNode* xnode) {
+
+    /// attributes are part of the shape, nothing to replay
+    std::unordered_map<const xercesc::DOMNode*, uint32_t>::const_iterator i = elements_.find(xnode);
+    if (i == elements_.end()) {
+      return;
+    }
+    step s = { n, i->second };
+    steps_.push_back(s);
+  }
+
+  inline size_t
+  shape_plan::
+  item(const node_base* list) {
+    return items_[list]++;
+  }
+
+  template <class T>
+  inline
+  shape_binder<T>::
+  shape_binder() :
+    planned_(false),
+    clean_(false),
+    reused_(false)
+  {}
+
+  template <class T>
+  inline bool
+  shape_binder<T>::
+  bind(support::error_code& err,
+       const std::string& content) {
+    return bind(err, content.data(), content.size());
+  }
+
+  template <class T>
+  inline bool
+  shape_binder<T>::
+  bind(support::error_code& err,
+       const char* content,
+       size_t size) {
+
+    reused_ = false;
+    bool shaped = scan(content, size);
+    if (shaped && clean_ && planned_ && key_ == shape_) {
+
+      /// a value a converter refuses is reported by the full bind
+      support::error_code refused;
+      bool result = true;
+      const shape_plan::steps& steps = plan_.get();
+      for (size_t i = 0; result && i < steps.size(); ++i) {
+        const text_ref& text = texts_[steps[i].element];
+        result = steps[i].leaf->bind_text(refused, text.begin ? text.begin : "", text.size);
+      }
+      if (result) {
+        reused_ = true;
+        return true;
+      }
+    }
+    planned_ = false;
+    if (! parser_.parse(err, content, size)) {
+      return false;
+    }
+    target_.reset();
+    dom::node::ptr root = parser_.root();
+    if (! target_.bind(err, root)) {
+      return false;
+    }
+    if (shaped) {
+      plan_.build(target_, root->xerces_node());
+      shape_.swap(key_);
+      planned_ = true;
+    }
+    return true;
+  }
+
+  template <class T>
+  inline bool
+  shape_binder<T>::
+  scan(const char* content,
+       size_t size) {
+
+    key_.clear();
+    texts_.clear();
+    open_.clear();
+    clean_ = true;
+    dom::scanner sc(content, content + size);
+    dom::scanner::token t;
+    while (sc.next(t)) {
+      switch (t.type) {
+      case dom::scanner::start_tag:
+      case dom::scanner::empty_tag: {
+
+        /// tags as written, with their attributes, text left out
+        key_.append(t.begin, t.end - t.begin);
+        text_ref none = { 0, 0 };
+        texts_.push_back(none);
+        if (t.type == dom::scanner::start_tag) {
+          open_.push_back(uint32_t(texts_.size() - 1));
+        }
+        break;
+      }
+      case dom::scanner::end_tag:
+        if (open_.empty()) {
+          return false;
+        }
+        key_.append(t.begin, t.end - t.begin);
+        open_.pop_back();
+        break;
+      case dom::scanner::text: {
+
+        /// what text_of() finds, the first text child
+        if (open_.empty()) {
+          break;
+        }
+        text_ref& text = texts_[open_.back()];
+        if (text.begin) {
+          break;
+        }
+        text.begin = t.begin;
+        text.size = t.end - t.begin;
+        if (::memchr(text.begin, '&', text.size) || ::memchr(text.begin, '\r', text.size)) {
+          clean_ = false;
+        }
+        break;
+      }
+      case dom::scanner::markup:
+
+        /// the bytes are only the text in the one encoding
+        if (t.end - t.begin > 5 && ::memcmp(t.begin, "<?xml", 5) == 0 && ! utf8(t.begin, t.end)) {
+          return false;
+        }
+        key_.append(t.begin, t.end - t.begin);
+        break;
+      default:
+        return false;
+      }
+    }
+    return t.type == dom::scanner::end_of_input && open_.empty() && ! texts_.empty();
+  }
+
+  template <class T>
+  inline bool
+  shape_binder<T>::
+  utf8(const char* begin,
+       const char* end) {
+
+    static const char attr[] = "encoding";
+    const char* p = std::search(begin, end, attr, attr + sizeof(attr) - 1);
+    if (p == end) {
+      return true;
+    }
+    p += sizeof(attr) - 1;
+    while (p < end && (*p == ' ' || *p == '=' || *p == '\t')) {
+      ++p;
+    }
+    if (end - p < 6 || (*p != '"' && *p != '\'')) {
+      return false;
+    }
+    return ::strncasecmp(p + 1, "utf-8", 5) == 0 && p[6] == *p;
+  }
+
+  template <class T>
+  inline const T&
+  shape_binder<T>::
+  get() const {
+    return target_;
+  }
+
+  template <class T>
+  inline T&
+  shape_binder<T>::
+  get() {
+    return target_;
+  }
+
+  template <class T>
+  inline bool
+  shape_binder<T>::
+  reused() const {
+    return reused_;
+  }
+
+  typedef element<int_converter>                element_int;
+  typedef element<short_converter>              element_short;
+  typedef element<long_converter>               element_long;
+  typedef element<float_converter>              element_float;
+  typedef element<double_converter>             element_double;
+  typedef element<string_converter>             element_string;
+  typedef element<interned_string_converter>    element_interned;
+  template <class E>
+  using element_enum = element<enum_converter<E> >;
 
-  typedef attribute<int_converter>     attribute_int;
-  typedef attribute<short_converter>   attribute_short;
-  typedef attribute<long_converter>    attribute_long;
-  typedef attribute<float_converter>   attribute_float;
-  typedef attribute<double_converter>  attribute_double;
-  typedef attribute<string_converter>  attribute_string;
+  typedef attribute<int_converter>              attribute_int;
+  typedef attribute<short_converter>            attribute_short;
+  typedef attribute<long_converter>             attribute_long;
+  typedef attribute<float_converter>            attribute_float;
+  typedef attribute<double_converter>           attribute_double;
+  typedef attribute<string_converter>           attribute_string;
+  typedef attribute<interned_string_converter>  attribute_interned;
+  template <class E>
+  using attribute_enum = attribute<enum_converter<E> >;
 
 }}
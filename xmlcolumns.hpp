@@ -0,0 +1,554 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <unordered_map>
+// #include "xmlbinding.hpp"
+
+namespace xml {
+namespace binding {
+
+  /**
+   * Class: Column
+   *
+   * One field of a batch, stored contiguously. Integers and reals go
+   * into typed arrays, strings are dictionary encoded until they turn
+   * out not to repeat, then they fall back to offsets into one blob.
+   * Lists hold offsets into the rows of their item columns. Absent
+   * values are zero in the value arrays and clear in the validity bits.
+   */
+  class column {
+  public:
+
+    enum kind {
+      integer,
+      real,
+      string,
+      list
+    };
+
+    /// distinct strings kept in a dictionary before going plain
+    static const size_t dictionary_limit = 4096;
+
+    column(kind k, const std::string& scope);
+
+    kind type() const;
+    const std::string& scope() const;
+    size_t size() const;
+    bool present(size_t row) const;
+
+    /// typed values, one per row
+    const std::vector<int64_t>& integers() const;
+    const std::vector<double>& reals() const;
+
+    /// strings, either codes into the dictionary or offsets into the blob
+    bool dictionary_encoded() const;
+    const std::vector<uint32_t>& codes() const;
+    const std::vector<std::string>& dictionary() const;
+    const std::vector<uint32_t>& offsets() const;
+    const std::string& blob() const;
+
+    /// the code of a value, for comparing codes instead of strings,
+    /// -1 when the value never occurs or the column is plain
+    long code(const std::string& value) const;
+    std::string str(size_t row) const;
+
+    /// list items of a row are rows [offsets[row], offsets[row + 1])
+    /// of the columns under the list
+    const std::vector<uint32_t>& items() const;
+
+    /// memory held by the column
+    size_t bytes() const;
+
+    void pad(size_t rows);
+    void push(int64_t value);
+    void push(double value);
+    void push(const std::string& value);
+    void push_items(uint32_t end);
+
+  private:
+
+    void valid(size_t row);
+    void plain();
+
+    kind                      kind_;
+    std::string               scope_;
+    size_t                    rows_;
+    std::vector<uint64_t>     valid_;
+    std::vector<int64_t>      integers_;
+    std::vector<double>       reals_;
+    bool                      dictionary_;
+    std::vector<uint32_t>     codes_;
+    std::vector<std::string>  dictionary_values_;
+    std::unordered_map<std::string, uint32_t> lookup_;
+    std::vector<uint32_t>     offsets_;
+    std::string               blob_;
+  };
+
+  /**
+   * Class: Columns
+   *
+   * Struct-of-arrays storage for a batch of bound composites. Columns
+   * are keyed by path, e.g. "vMasterHeader/vMasterDesk", and are laid
+   * out by the same mappings the composites register. Each appended
+   * composite is one row, items of a nodelist are rows of their own
+   * scope (the list path). Leaf items sit in a column under the list,
+   * e.g. "tag/tag" for a nodelist of strings mapped as "tag".
+   */
+  class columns : public visitor {
+  public:
+
+    typedef std::map<std::string, column> columns_t;
+
+    /// appends one bound composite as a row
+    bool append(support::error_code& err, const composite& c);
+
+    /// rows in a scope, "" being the appended composites
+    size_t rows(const std::string& scope = "") const;
+    const column* find(const std::string& path) const;
+    const columns_t& all() const;
+    size_t bytes() const;
+
+    virtual void enter(const std::string& name, const composite& c);
+    virtual void leave(const std::string& name, const composite& c);
+    virtual void enter_list(const std::string& name, size_t size);
+    virtual void leave_list(const std::string& name);
+    virtual void leaf(const std::string& name, long value);
+    virtual void leaf(const std::string& name, double value);
+    virtual void leaf(const std::string& name, const std::string& value);
+
+  private:
+
+    struct frame {
+      std::string  path;
+      std::string  scope;
+      size_t       row;
+      bool         list;
+    };
+
+    column& at(const std::string& name, column::kind k);
+
+    columns_t                      columns_;
+    std::map<std::string, size_t>  rows_;
+    std::vector<frame>             frames_;
+  };
+
+  /**
+   * Class: Column Binder
+   *
+   * Binds each message into a scratch T and appends it to the columns.
+   */
+  template <class T>
+  class column_binder {
+  public:
+
+    bool bind(support::error_code& err, dom::node::ptr np);
+    const columns& data() const;
+
+  private:
+    columns columns_;
+  };
+
+  inline
+  column::
+  column(kind k,
+         const std::string& scope) :
+    kind_(k),
+    scope_(scope),
+    rows_(0),
+    dictionary_(true) {
+
+    if (kind_ == list) {
+      offsets_.push_back(0);
+    }
+  }
+
+  inline column::kind
+  column::
+  type() const {
+    return kind_;
+  }
+
+  inline const std::string&
+  column::
+  scope() const {
+    return scope_;
+  }
+
+  inline size_t
+  column::
+  size() const {
+    return rows_;
+  }
+
+  inline bool
+  column::
+  present(size_t row) const {
+    return row < rows_ && (valid_[row / 64] >> (row % 64)) & 1;
+  }
+
+  inline const std::vector<int64_t>&
+  column::
+  integers() const {
+    return integers_;
+  }
+
+  inline const std::vector<double>&
+  column::
+  reals() const {
+    return reals_;
+  }
+
+  inline bool
+  column::
+  dictionary_encoded() const {
+    return dictionary_;
+  }
+
+  inline const std::vector<uint32_t>&
+  column::
+  codes() const {
+    return codes_;
+  }
+
+  inline const std::vector<std::string>&
+  column::
+  dictionary() const {
+    return dictionary_values_;
+  }
+
+  inline const std::vector<uint32_t>&
+  column::
+  offsets() const {
+    return offsets_;
+  }
+
+  inline const std::string&
+  column::
+  blob() const {
+    return blob_;
+  }
+
+  inline const std::vector<uint32_t>&
+  column::
+  items() const {
+    return offsets_;
+  }
+
+  inline long
+  column::
+  code(const std::string& value) const {
+    if (! dictionary_) {
+      return -1;
+    }
+    std::unordered_map<std::string, uint32_t>::const_iterator p = lookup_.find(value);
+    return p == lookup_.end() ? -1 : (long) p->second;
+  }
+
+  inline std::string
+  column::
+  str(size_t row) const {
+
+    if (kind_ != string || ! present(row)) {
+      return std::string();
+    }
+    if (dictionary_) {
+      return dictionary_values_[codes_[row]];
+    }
+    return blob_.substr(offsets_[row], offsets_[row + 1] - offsets_[row]);
+  }
+
+  inline size_t
+  column::
+  bytes() const {
+
+    size_t n = valid_.capacity() * sizeof(uint64_t)
+             + integers_.capacity() * sizeof(int64_t)
+             + reals_.capacity() * sizeof(double)
+             + codes_.capacity() * sizeof(uint32_t)
+             + offsets_.capacity() * sizeof(uint32_t)
+             + blob_.capacity();
+    for (size_t i = 0; i < dictionary_values_.size(); ++i) {
+      n += sizeof(std::string) + dictionary_values_[i].capacity();
+    }
+    return n;
+  }
+
+  inline void
+  column::
+  pad(size_t rows) {
+
+    /// absent rows: zero value, validity bit left clear
+    while (rows_ < rows) {
+      if (valid_.size() * 64 <= rows_) {
+        valid_.push_back(0);
+      }
+      switch (kind_) {
+        case integer:
+          integers_.push_back(0);
+          break;
+        case real:
+          reals_.push_back(0);
+          break;
+        case string:
+          if (dictionary_) {
+            codes_.push_back(0);
+          }
+          else {
+            offsets_.push_back(blob_.size());
+          }
+          break;
+        case list:
+          offsets_.push_back(offsets_.back());
+          break;
+      }
+      ++rows_;
+    }
+  }
+
+  inline void
+  column::
+  valid(size_t row) {
+    if (valid_.size() * 64 <= row) {
+      valid_.push_back(0);
+    }
+    valid_[row / 64] |= uint64_t(1) << (row % 64);
+    rows_ = row + 1;
+  }
+
+  inline void
+  column::
+  push(int64_t value) {
+    integers_.push_back(value);
+    valid(rows_);
+  }
+
+  inline void
+  column::
+  push(double value) {
+    reals_.push_back(value);
+    valid(rows_);
+  }
+
+  inline void
+  column::
+  push(const std::string& value) {
+
+    if (dictionary_) {
+      std::unordered_map<std::string, uint32_t>::iterator p = lookup_.find(value);
+      if (p != lookup_.end()) {
+        codes_.push_back(p->second);
+        valid(rows_);
+        return;
+      }
+      if (dictionary_values_.size() < dictionary_limit) {
+        uint32_t code = dictionary_values_.size();
+        lookup_[value] = code;
+        dictionary_values_.push_back(value);
+        codes_.push_back(code);
+        valid(rows_);
+        return;
+      }
+      /// high cardinality, a dictionary would only cost more
+      plain();
+    }
+    blob_ += value;
+    offsets_.push_back(blob_.size());
+    valid(rows_);
+  }
+
+  inline void
+  column::
+  push_items(uint32_t end) {
+    offsets_.push_back(end);
+    valid(rows_);
+  }
+
+  inline void
+  column::
+  plain() {
+
+    offsets_.assign(1, 0);
+    for (size_t i = 0; i < codes_.size(); ++i) {
+      if (present(i)) {
+        blob_ += dictionary_values_[codes_[i]];
+      }
+      offsets_.push_back(blob_.size());
+    }
+    std::vector<uint32_t>().swap(codes_);
+    std::vector<std::string>().swap(dictionary_values_);
+    std::unordered_map<std::string, uint32_t>().swap(lookup_);
+    dictionary_ = false;
+  }
+
+  inline bool
+  columns::
+  append(support::error_code& err,
+         const composite& c) {
+
+    frames_.clear();
+    c.accept(*this, "");
+    ++rows_[""];
+
+    /// fields absent from this row still take a slot
+    columns_t::iterator i = columns_.begin();
+    for (; i != columns_.end(); ++i) {
+      i->second.pad(rows_[i->second.scope()]);
+    }
+    return true;
+  }
+
+  inline size_t
+  columns::
+  rows(const std::string& scope) const {
+    std::map<std::string, size_t>::const_iterator p = rows_.find(scope);
+    return p == rows_.end() ? 0 : p->second;
+  }
+
+  inline const column*
+  columns::
+  find(const std::string& path) const {
+    columns_t::const_iterator p = columns_.find(path);
+    return p == columns_.end() ? 0 : &p->second;
+  }
+
+  inline const columns::columns_t&
+  columns::
+  all() const {
+    return columns_;
+  }
+
+  inline size_t
+  columns::
+  bytes() const {
+    size_t n = 0;
+    columns_t::const_iterator i = columns_.begin();
+    for (; i != columns_.end(); ++i) {
+      n += i->second.bytes();
+    }
+    return n;
+  }
+
+  inline column&
+  columns::
+  at(const std::string& name,
+     column::kind k) {
+
+    const frame& f = frames_.back();
+    std::string path = f.path.empty() ? name : f.path + "/" + name;
+    std::string scope = f.scope;
+    size_t row = f.row;
+    if (f.list) {
+      /// a leaf item of a list, a new row in the list's scope
+      scope = f.path;
+      row = rows_[scope]++;
+    }
+    columns_t::iterator p = columns_.find(path);
+    if (p == columns_.end()) {
+      p = columns_.insert(columns_t::value_type(path, column(k, scope))).first;
+    }
+    p->second.pad(row);
+    return p->second;
+  }
+
+  inline void
+  columns::
+  enter(const std::string& name,
+        const composite& c) {
+
+    frame f;
+    f.list = false;
+    if (frames_.empty()) {
+      f.row = rows_[""];
+    }
+    else if (frames_.back().list) {
+      /// an item of a list, a new row in the list's scope
+      f.path = frames_.back().path;
+      f.scope = f.path;
+      f.row = rows_[f.scope]++;
+    }
+    else {
+      const frame& parent = frames_.back();
+      f.path = parent.path.empty() ? name : parent.path + "/" + name;
+      f.scope = parent.scope;
+      f.row = parent.row;
+    }
+    frames_.push_back(f);
+  }
+
+  inline void
+  columns::
+  leave(const std::string& name,
+        const composite& c) {
+    frames_.pop_back();
+  }
+
+  inline void
+  columns::
+  enter_list(const std::string& name,
+             size_t size) {
+
+    /// claim the list column now so it sits in the parent's scope
+    at(name, column::list);
+    const frame& parent = frames_.back();
+    frame f;
+    f.path = parent.path.empty() ? name : parent.path + "/" + name;
+    f.scope = parent.scope;
+    f.row = parent.row;
+    f.list = true;
+    frames_.push_back(f);
+  }
+
+  inline void
+  columns::
+  leave_list(const std::string& name) {
+
+    std::string path = frames_.back().path;
+    frames_.pop_back();
+    at(name, column::list).push_items(rows_[path]);
+  }
+
+  inline void
+  columns::
+  leaf(const std::string& name,
+       long value) {
+    at(name, column::integer).push((int64_t) value);
+  }
+
+  inline void
+  columns::
+  leaf(const std::string& name,
+       double value) {
+    at(name, column::real).push(value);
+  }
+
+  inline void
+  columns::
+  leaf(const std::string& name,
+       const std::string& value) {
+    at(name, column::string).push(value);
+  }
+
+  template <class T>
+  inline bool
+  column_binder<T>::
+  bind(support::error_code& err,
+       dom::node::ptr np) {
+
+    T item;
+    if (! item.bind(err, np)) {
+      return false;
+    }
+    return columns_.append(err, item);
+  }
+
+  template <class T>
+  inline const columns&
+  column_binder<T>::
+  data() const {
+    return columns_;
+  }
+
+}}
@@ -1,4 +1,14 @@
+#pragma once
+
 #include <cstdlib>
+#include <stdint.h>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+#include <stdexcept>
+#include <shared_mutex>
+#include <type_traits>
+#include <unordered_map>
 // #include "xmldom.hpp"
 
 namespace xml {
@@ -17,35 +27,32 @@ namespace binding {
     typedef typename T::converter_type converter_type;
     typedef typename T::value_type     value_type;
 
-    bool bind(support::error_code& err, dom::node::ptr np);
+    /// reads the value straight from the xerces element or attribute
+    bool bind(support::error_code& err, xercesc::DOMNode* xnode);
+    void reset();
     const value_type& access() const;
     value_type& access();
 
-    const std::string& name() const;
-    const std::string& value() const;
-    std::string& value();
+    /// transcodes into a scratch buffer and hands over to the crtp
+    /// converter, which may override it to write to its value directly
+    bool assign(support::error_code& err, const XMLCh* text);
 
-    typedef converter<T> this_type;
-    typedef void (this_type::*bool_hack)() const;
-    void bool_workaround() const
-    {}
+    /// the same from utf-8 bytes that never went through xerces, e.g.
+    /// an element's text read straight from the source buffer
+    bool assign_utf8(support::error_code& err, const char* text, size_t size);
 
-    operator bool_hack() const {
-      bool result = node_.get() != nullptr;
-      return result ? &this_type::bool_workaround : 0;
-    }
-
-    operator bool() const
-    { return node_.get() != nullptr; }
-  
   protected:
 
-    converter(converter_type& crtp);
-    bool bind_continued(support::error_code& err);
+    /// whether a value was bound is up to the owning composite, a
+    /// converter holds its value and nothing else
+    converter();
+
+    converter_type& self();
+    const converter_type& self() const;
+
+    bool bind_continued(support::error_code& err, const std::string& text);
 
-    converter_type&  crtp_;
-    value_type       value_;
-    dom::node::ptr   node_;
+    value_type  value_;
   };
 
   class string_converter;
@@ -58,13 +65,18 @@ namespace binding {
     const std::string& access() const;
     std::string& access();
 
-    bool bind_continued(support::error_code& err);
+    const std::string& value() const;
+    std::string& value();
+
+    /// the value is transcoded in place, no intermediate copy
+    bool assign(support::error_code& err, const XMLCh* text);
+    bool assign_utf8(support::error_code& err, const char* text, size_t size);
   };
 
   template <class T>
   class member_converter : public converter<T> {
   public:
-    member_converter(typename T::converter_type& crtp);
+    member_converter();
     const typename T::value_type& access() const;
     typename T::value_type& access();
   };
@@ -72,8 +84,8 @@ namespace binding {
   template <class T>
   class atoi_converter : public member_converter<T> {
   public:
-    atoi_converter(typename T::converter_type& crtp);
-    bool bind_continued(support::error_code& err);
+    atoi_converter();
+    bool bind_continued(support::error_code& err, const std::string& text);
   };
 
   class int_converter;
@@ -103,8 +115,8 @@ namespace binding {
   template <class T>
   class atof_converter : public member_converter<T> {
   public:
-    atof_converter(typename T::converter_type& crtp);
-    bool bind_continued(support::error_code& err);
+    atof_converter();
+    bool bind_continued(support::error_code& err, const std::string& text);
   };
 
   class float_converter;
@@ -123,84 +135,319 @@ namespace binding {
     double_converter();
   };
 
+  /**
+   * Class: String Table
+   *
+   * Process wide intern table for low cardinality values. Interning
+   * takes a shared lock on one shard, and an exclusive one only the
+   * first time a value is seen. Looking an id up takes no lock at all,
+   * strings live in fixed chunks that never move once published.
+   */
+  class string_table {
+  public:
+
+    static const uint32_t chunk_bits = 12;
+    static const uint32_t chunk_size = 1u << chunk_bits;
+    static const uint32_t max_chunks = 4096;
+    static const uint32_t shards     = 16;
+
+    static string_table& instance();
+
+    /// id 0 is the empty string
+    uint32_t intern(const std::string& s);
+    const std::string& lookup(uint32_t id) const;
+    size_t size() const;
+
+    ~string_table();
+
+  private:
+
+    string_table();
+    string_table(const string_table&);
+    string_table& operator=(const string_table&);
+
+    uint32_t insert(const std::string& s);
+
+    struct shard {
+      std::shared_timed_mutex                    mutex;
+      std::unordered_map<std::string, uint32_t>  ids;
+    };
+
+    shard                     shards_[shards];
+    std::mutex                grow_;
+    std::atomic<uint32_t>     size_;
+    std::atomic<std::string*> chunks_[max_chunks];
+  };
+
+  /// a 32 bit handle on a string_table entry, compares as an integer
+  class interned_string {
+  public:
+
+    interned_string();
+    explicit interned_string(uint32_t id);
+    explicit interned_string(const std::string& s);
+
+    uint32_t id() const;
+    const std::string& str() const;
+    operator const std::string&() const;
+
+    bool operator==(const interned_string& other) const;
+    bool operator!=(const interned_string& other) const;
+
+    /// orders by id, not alphabetically
+    bool operator<(const interned_string& other) const;
+
+  private:
+    uint32_t id_;
+  };
+
+  std::ostream& operator<<(std::ostream& os, const interned_string& s);
+
+  class interned_string_converter;
+  typedef converter_traits<interned_string_converter, interned_string> interned_string_converter_traits;
+
+  class interned_string_converter : public member_converter<interned_string_converter_traits> {
+  public:
+    interned_string_converter();
+    bool bind_continued(support::error_code& err, const std::string& text);
+  };
+
+  /**
+   * Enum names, specialized once per enumeration, in enumerator order
+   * and ending in a null:
+   *
+   *   template <>
+   *   struct enum_names<trade_status> {
+   *     static constexpr const char* name(size_t i) {
+   *       const char* const names[] = { "PENDING_UNAPPROVED", "APPROVED", 0 };
+   *       return names[i];
+   *     }
+   *   };
+   *
+   * Enumerators must run from 0 with no gaps, a 1 byte underlying type
+   * keeps the bound value small.
+   *
+   * A value outside the names fails its leaf, unless the names also
+   * give an enumerator for the rest, past the named ones:
+   *
+   *     static constexpr trade_status other() { return trade_status::other; }
+   *
+   * The value then binds to it and only a warning is attached, code
+   * left alone, so a feed adding to a vocabulary does not cost whole
+   * messages.
+   */
+  template <class E>
+  struct enum_names;
+
+  /// whether N gives an enumerator for values outside its names
+  template <class N, class = void>
+  struct enum_has_other : std::false_type {};
+
+  template <class N>
+  struct enum_has_other<N, decltype((void) N::other(), void())> : std::true_type {};
+
+  /// N is a names provider, enum_names<E> or alike
+  template <class N>
+  inline constexpr size_t
+  enum_count() {
+    size_t n = 0;
+    while (N::name(n)) {
+      ++n;
+    }
+    return n;
+  }
+
+  /// the hash table size, at most half full so a seed is found quickly
+  template <class N>
+  inline constexpr size_t
+  enum_slots() {
+    size_t n = 4;
+    while (n < 2 * enum_count<N>()) {
+      n <<= 1;
+    }
+    return n;
+  }
+
+  /**
+   * Class: Enum Table
+   *
+   * A perfect hash of the names N provides, built by the compiler: the
+   * seed is the first for which every name lands in its own slot. A
+   * lookup hashes the xerces text as it stands, no transcoding, and
+   * compares it with the one name in its slot.
+   */
+  template <class N>
+  struct enum_table {
+
+    /// fnv-1a then a murmur finalizer, chars or XMLCh alike
+    template <class C>
+    static constexpr uint32_t hash(const C* s, size_t size, uint32_t seed);
+
+    static constexpr enum_table build();
+
+    /// the position of the name, -1 if it is none of them
+    template <class C>
+    int find(const C* s, size_t size) const;
+
+    uint32_t  seed;
+    uint8_t   index[enum_slots<N>()];   /// position + 1, 0 for empty
+  };
+
+  template <class E>
+  class enum_converter : public member_converter<converter_traits<enum_converter<E>, E> > {
+  public:
+
+    typedef member_converter<converter_traits<enum_converter<E>, E> > base_type;
+
+    enum_converter();
+
+    /// straight from the xerces text, an unknown value is an error or
+    /// the other enumerator, see enum_names
+    bool assign(support::error_code& err, const XMLCh* text);
+    bool assign_utf8(support::error_code& err, const char* text, size_t size);
+    bool bind_continued(support::error_code& err, const std::string& text);
+
+    static bool parse(const char* s, size_t size, E& e);
+    static const char* name(E e);
+
+  private:
+
+    static bool other(E& e, std::true_type);
+    static bool other(E& e, std::false_type);
+
+    static constexpr enum_table<enum_names<E> > table_ = enum_table<enum_names<E> >::build();
+  };
+
+  template <class E>
+  const char* enum_name(E e);
+
   template <class T>
   inline
   converter<T>::
-  converter(converter_type& crtp) : crtp_(crtp) {}
+  converter() :
+    value_()
+  {}
+
+  template <class T>
+  inline typename converter<T>::converter_type&
+  converter<T>::
+  self() {
+    return static_cast<converter_type&>(*this);
+  }
+
+  template <class T>
+  inline const typename converter<T>::converter_type&
+  converter<T>::
+  self() const {
+    return static_cast<const converter_type&>(*this);
+  }
 
   template <class T>
   inline bool
   converter<T>::
   bind(support::error_code& err,
-       dom::node::ptr np) {
-    node_ = np;
-    return crtp_.bind_continued(err);
+       xercesc::DOMNode* xnode) {
+    return self().assign(err, dom::text_of(xnode));
   }
 
   template <class T>
-  inline const typename converter<T>::value_type&
+  inline bool
   converter<T>::
-  access() const {
-    return crtp_.access();
+  assign(support::error_code& err,
+         const XMLCh* text) {
+
+    /// one scratch buffer per thread, its capacity is reused
+    static thread_local std::string scratch;
+    dom::transcode(text, scratch);
+    return self().bind_continued(err, scratch);
   }
 
   template <class T>
-  inline typename converter<T>::value_type&
+  inline bool
   converter<T>::
-  access() {
-    return crtp_.access();
+  assign_utf8(support::error_code& err,
+              const char* text,
+              size_t size) {
+
+    static thread_local std::string scratch;
+    scratch.assign(text, size);
+    return self().bind_continued(err, scratch);
   }
 
   template <class T>
-  inline const std::string&
+  inline void
   converter<T>::
-  name() const {
-    return node_->name();
+  reset() {
+    value_ = value_type();
   }
 
   template <class T>
-  inline const std::string&
+  inline const typename converter<T>::value_type&
   converter<T>::
-  value() const {
-    return node_->value();
+  access() const {
+    return self().access();
   }
 
   template <class T>
-  inline std::string&
+  inline typename converter<T>::value_type&
   converter<T>::
-  value() {
-    return node_->value();
+  access() {
+    return self().access();
   }
 
+
   inline 
   string_converter::
   string_converter() :
-    converter<string_converter_traits>(*this)
+    converter<string_converter_traits>()
   {}
 
   inline const std::string&
   string_converter::
   access() const {
-    return node_->value();
+    return value_;
   }
 
   inline std::string&
   string_converter::
   access() {
-    return node_->value();
+    return value_;
+  }
+
+  inline const std::string&
+  string_converter::
+  value() const {
+    return value_;
+  }
+
+  inline std::string&
+  string_converter::
+  value() {
+    return value_;
+  }
+
+  inline bool
+  string_converter::
+  assign(support::error_code& err,
+         const XMLCh* text) {
+    dom::transcode(text, value_);
+    return true;
   }
 
   inline bool
   string_converter::
-  bind_continued(support::error_code& err) {
+  assign_utf8(support::error_code& err,
+              const char* text,
+              size_t size) {
+    value_.assign(text, size);
     return true;
   }
 
   template <class T>
   inline
   member_converter<T>::
-  member_converter(typename T::converter_type& crtp) :
-    converter<T>(crtp)
+  member_converter() :
+    converter<T>()
   {}
 
   template <class T>
@@ -220,56 +467,387 @@ namespace binding {
   template <class T>
   inline
   atoi_converter<T>::
-  atoi_converter(typename T::converter_type& crtp) :
-    member_converter<T>(crtp)
+  atoi_converter() :
+    member_converter<T>()
   {}
 
   template <class T>
   inline bool
   atoi_converter<T>::
-  bind_continued(support::error_code& err) {
-    this->value_ = ::atoi(this->node_->value().c_str());
+  bind_continued(support::error_code& err,
+                 const std::string& text) {
+    this->value_ = ::atoi(text.c_str());
     return true;
   }
 
   inline
   int_converter::
-  int_converter() : atoi_converter<int_converter_traits>(*this)
+  int_converter() : atoi_converter<int_converter_traits>()
   {}
 
   inline
   short_converter::
-  short_converter() : atoi_converter<short_converter_traits>(*this)
+  short_converter() : atoi_converter<short_converter_traits>()
   {}
 
   inline
   long_converter::
-  long_converter() : atoi_converter<long_converter_traits>(*this)
+  long_converter() : atoi_converter<long_converter_traits>()
   {}
 
   template <class T>
   inline
   atof_converter<T>::
-  atof_converter(typename T::converter_type& crtp) :
-    member_converter<T>(crtp)
+  atof_converter() :
+    member_converter<T>()
   {}
 
   template <class T>
   inline bool
   atof_converter<T>::
-  bind_continued(support::error_code& err) {
-    this->value_ = ::atof(this->node_->value().c_str());
+  bind_continued(support::error_code& err,
+                 const std::string& text) {
+    this->value_ = ::atof(text.c_str());
     return true;
   }
 
   inline
   float_converter::
-  float_converter() : atof_converter<float_converter_traits>(*this)
+  float_converter() : atof_converter<float_converter_traits>()
   {}
 
   inline
   double_converter::
-  double_converter() : atof_converter<double_converter_traits>(*this)
+  double_converter() : atof_converter<double_converter_traits>()
+  {}
+
+  inline string_table&
+  string_table::
+  instance() {
+    static string_table table;
+    return table;
+  }
+
+  inline
+  string_table::
+  string_table() : size_(0) {
+    for (uint32_t i = 0; i < max_chunks; ++i) {
+      chunks_[i].store(0, std::memory_order_relaxed);
+    }
+    insert("");
+  }
+
+  inline
+  string_table::
+  ~string_table() {
+    for (uint32_t i = 0; i < max_chunks; ++i) {
+      delete [] chunks_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  inline size_t
+  string_table::
+  size() const {
+    return size_.load(std::memory_order_acquire);
+  }
+
+  inline const std::string&
+  string_table::
+  lookup(uint32_t id) const {
+    std::string* chunk = chunks_[id >> chunk_bits].load(std::memory_order_acquire);
+    return chunk[id & (chunk_size - 1)];
+  }
+
+  inline uint32_t
+  string_table::
+  insert(const std::string& s) {
+
+    /// ids are handed out in order, a new chunk is needed every
+    /// chunk_size values
+    std::lock_guard<std::mutex> lock(grow_);
+    uint32_t id = size_.load(std::memory_order_relaxed);
+    if (id >= chunk_size * max_chunks) {
+      throw std::length_error("string_table is full");
+    }
+    std::string* chunk = chunks_[id >> chunk_bits].load(std::memory_order_relaxed);
+    if (! chunk) {
+      chunk = new std::string[chunk_size];
+      chunks_[id >> chunk_bits].store(chunk, std::memory_order_release);
+    }
+    chunk[id & (chunk_size - 1)] = s;
+    size_.store(id + 1, std::memory_order_release);
+    return id;
+  }
+
+  inline uint32_t
+  string_table::
+  intern(const std::string& s) {
+
+    shard& sh = shards_[std::hash<std::string>()(s) % shards];
+    {
+      std::shared_lock<std::shared_timed_mutex> lock(sh.mutex);
+      std::unordered_map<std::string, uint32_t>::const_iterator p = sh.ids.find(s);
+      if (p != sh.ids.end()) {
+        return p->second;
+      }
+    }
+    std::unique_lock<std::shared_timed_mutex> lock(sh.mutex);
+    std::unordered_map<std::string, uint32_t>::const_iterator p = sh.ids.find(s);
+    if (p != sh.ids.end()) {
+      return p->second;
+    }
+    uint32_t id = s.empty() ? 0 : insert(s);
+    sh.ids[s] = id;
+    return id;
+  }
+
+  inline
+  interned_string::
+  interned_string() : id_(0)
+  {}
+
+  inline
+  interned_string::
+  interned_string(uint32_t id) : id_(id)
+  {}
+
+  inline
+  interned_string::
+  interned_string(const std::string& s) :
+    id_(string_table::instance().intern(s))
+  {}
+
+  inline uint32_t
+  interned_string::
+  id() const {
+    return id_;
+  }
+
+  inline const std::string&
+  interned_string::
+  str() const {
+    return string_table::instance().lookup(id_);
+  }
+
+  inline
+  interned_string::
+  operator const std::string&() const {
+    return str();
+  }
+
+  inline bool
+  interned_string::
+  operator==(const interned_string& other) const {
+    return id_ == other.id_;
+  }
+
+  inline bool
+  interned_string::
+  operator!=(const interned_string& other) const {
+    return id_ != other.id_;
+  }
+
+  inline bool
+  interned_string::
+  operator<(const interned_string& other) const {
+    return id_ < other.id_;
+  }
+
+  inline std::ostream&
+  operator<<(std::ostream& os,
+             const interned_string& s) {
+    return os << s.str();
+  }
+
+  inline
+  interned_string_converter::
+  interned_string_converter() :
+    member_converter<interned_string_converter_traits>()
+  {}
+
+  inline bool
+  interned_string_converter::
+  bind_continued(support::error_code& err,
+                 const std::string& text) {
+    this->value_ = interned_string(text);
+    return true;
+  }
+
+  template <class N>
+  template <class C>
+  inline constexpr uint32_t
+  enum_table<N>::
+  hash(const C* s,
+       size_t size,
+       uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < size; ++i) {
+      h ^= uint32_t(typename std::make_unsigned<C>::type(s[i]));
+      h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+  }
+
+  template <class N>
+  inline constexpr enum_table<N>
+  enum_table<N>::
+  build() {
+
+    enum_table t = {};
+    if (enum_count<N>() == 0 || enum_count<N>() > 255) {
+      throw "enum_table: no names, or too many for a byte";
+    }
+    for (uint32_t seed = 0; seed < 65536; ++seed) {
+      for (size_t i = 0; i < sizeof(t.index); ++i) {
+        t.index[i] = 0;
+      }
+      bool apart = true;
+      for (size_t i = 0; apart && i < enum_count<N>(); ++i) {
+        const char* n = N::name(i);
+        size_t size = 0;
+        while (n[size]) {
+          ++size;
+        }
+        uint32_t slot = hash(n, size, seed) & (enum_slots<N>() - 1);
+        apart = t.index[slot] == 0;
+        t.index[slot] = uint8_t(i + 1);
+      }
+      if (apart) {
+        t.seed = seed;
+        return t;
+      }
+    }
+    throw "enum_table: names do not hash apart, duplicates?";
+  }
+
+  template <class N>
+  template <class C>
+  inline int
+  enum_table<N>::
+  find(const C* s,
+       size_t size) const {
+
+    uint8_t i = index[hash(s, size, seed) & (enum_slots<N>() - 1)];
+    if (! i) {
+      return -1;
+    }
+    /// the one candidate, compared unit by unit
+    const char* n = N::name(i - 1);
+    size_t k = 0;
+    for (; k < size && n[k]; ++k) {
+      if (uint32_t(typename std::make_unsigned<C>::type(s[k])) != uint32_t((unsigned char) n[k])) {
+        return -1;
+      }
+    }
+    return k == size && ! n[k] ? i - 1 : -1;
+  }
+
+  template <class E>
+  constexpr enum_table<enum_names<E> > enum_converter<E>::table_;
+
+  template <class E>
+  inline
+  enum_converter<E>::
+  enum_converter() :
+    base_type()
   {}
 
+  template <class E>
+  inline bool
+  enum_converter<E>::
+  parse(const char* s,
+        size_t size,
+        E& e) {
+    int i = table_.find(s, size);
+    if (i < 0) {
+      return false;
+    }
+    e = E(i);
+    return true;
+  }
+
+  template <class E>
+  inline const char*
+  enum_converter<E>::
+  name(E e) {
+    return size_t(e) < enum_count<enum_names<E> >() ? enum_names<E>::name(size_t(e)) : "";
+  }
+
+  template <class E>
+  inline bool
+  enum_converter<E>::
+  assign(support::error_code& err,
+         const XMLCh* text) {
+
+    size_t size = 0;
+    while (text[size]) {
+      ++size;
+    }
+    int i = table_.find(text, size);
+    if (i >= 0) {
+      this->value_ = E(i);
+      return true;
+    }
+    std::string s;
+    dom::transcode(text, s);
+    return bind_continued(err, s);
+  }
+
+  template <class E>
+  inline bool
+  enum_converter<E>::
+  assign_utf8(support::error_code& err,
+              const char* text,
+              size_t size) {
+
+    if (parse(text, size, this->value_)) {
+      return true;
+    }
+    return bind_continued(err, std::string(text, size));
+  }
+
+  template <class E>
+  inline bool
+  enum_converter<E>::
+  bind_continued(support::error_code& err,
+                 const std::string& text) {
+    if (parse(text.data(), text.size(), this->value_)) {
+      return true;
+    }
+    if (other(this->value_, enum_has_other<enum_names<E> >())) {
+      err.attach(support::error_code(-1, "Unknown enumeration value, bound as other: " + text));
+      return true;
+    }
+    support::error_code::attach_or_create(err, -1, "Unknown enumeration value: " + text);
+    return false;
+  }
+
+  template <class E>
+  inline bool
+  enum_converter<E>::
+  other(E& e,
+        std::true_type) {
+    e = enum_names<E>::other();
+    return true;
+  }
+
+  template <class E>
+  inline bool
+  enum_converter<E>::
+  other(E& e,
+        std::false_type) {
+    return false;
+  }
+
+  template <class E>
+  inline const char*
+  enum_name(E e) {
+    return enum_converter<E>::name(e);
+  }
+
 }}
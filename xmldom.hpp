@@ -6,13 +6,22 @@
 #include <memory>
 #include <iostream>
 #include <xercesc/util/XMLString.hpp>
+#include <xercesc/util/PlatformUtils.hpp>
 #include <xercesc/dom/DOMNode.hpp>
 #include <xercesc/dom/DOMElement.hpp>
 #include <xercesc/dom/DOMAttr.hpp>
 #include <xercesc/dom/DOMText.hpp>
 #include <xercesc/parsers/XercesDOMParser.hpp>
 #include <xercesc/framework/MemBufInputSource.hpp>
+#include <xercesc/framework/XMLGrammarPool.hpp>
+#include <xercesc/framework/MemoryManager.hpp>
+#include <xercesc/util/OutOfMemoryException.hpp>
+#include <xercesc/sax/ErrorHandler.hpp>
+#include <xercesc/sax/SAXParseException.hpp>
 #include "error_code.hpp"
+#include "alloc_stats.hpp"
+#include "xmlscanner.hpp"
+#include "xmltranscoder.hpp"
 
 namespace xml {
 namespace dom {
@@ -73,18 +82,129 @@ namespace dom {
     static node::ptr create(support::error_code& err, xercesc::DOMNode* xnode);
   };
 
+  /// the value of an attribute, or the first text child of an element,
+  /// never null
+  const XMLCh* text_of(xercesc::DOMNode* xnode);
+
+  /// transcodes into a caller owned buffer, reusing its capacity
+  void transcode(const XMLCh* s, std::string& out);
+
+  /**
+   * Class: Projection
+   *
+   * The set of element names a binding is interested in, as a tree.
+   * Built by the binding layer and handed to the parser so that
+   * subtrees nobody binds are dropped before xerces tokenizes them.
+   */
+  class projection {
+  public:
+
+    typedef std::shared_ptr<projection> ptr;
+
+    projection();
+
+    /// adds (or finds) the child projection for an element name
+    projection& insert(const std::string& name);
+
+    /// everything below this element is kept, leaves are bound whole
+    void keep_all();
+    bool keeps_all() const;
+
+    const projection* find(const std::string& name) const;
+
+    /// copies 'in' to 'out' minus the subtrees not in the projection,
+    /// the root element is always kept and maps to this projection
+    bool prune(support::error_code& err,
+               const std::string& in,
+               std::string& out) const;
+
+  private:
+
+    typedef std::map<std::string, ptr> children;
+    children  children_;
+    bool      keep_all_;
+  };
+
+  class query;
+  class query_results;
+  class grammar_pool;
+
+  /**
+   * Class: Parse Errors
+   *
+   * Keeps the first error xerces reports, with where it was found,
+   * and counts the rest. Warnings are ignored.
+   */
+  class parse_errors : public xercesc::ErrorHandler {
+  public:
+
+    parse_errors();
+
+    size_t count() const;
+    const std::string& first() const;
+
+    virtual void warning(const xercesc::SAXParseException& e);
+    virtual void error(const xercesc::SAXParseException& e);
+    virtual void fatalError(const xercesc::SAXParseException& e);
+    virtual void resetErrors();
+
+  private:
+    size_t       count_;
+    std::string  first_;
+  };
+
+  /**
+   * Class: Counting Memory Manager
+   *
+   * Allocates through support::alloc_stats, so the DOM and whatever
+   * else xerces allocates is charged to the current alloc_scope. It
+   * serves the whole process, install it before anything is parsed and
+   * keep it until after Terminate():
+   *
+   *   xercesc::XMLPlatformUtils::Initialize(
+   *     xercesc::XMLUni::fgXercescDefaultLocale, 0, 0, &manager);
+   */
+  class counting_memory_manager : public xercesc::MemoryManager {
+  public:
+    virtual xercesc::MemoryManager* getExceptionMemoryManager();
+    virtual void* allocate(XMLSize_t size);
+    virtual void deallocate(void* p);
+  };
+
   class parser {
   public:
 
     typedef std::shared_ptr<parser> ptr;
 
+    parser();
+
+    /// validates every document against the schemas in a locked pool,
+    /// which must outlive the parser, see xmlgrammar.hpp
+    explicit parser(const grammar_pool& grammars);
+
     bool parse(support::error_code& err, const std::string& content);
+
+    /// straight from a caller's buffer, e.g. a pooled read buffer
+    bool parse(support::error_code& err, const char* content, size_t size);
+
+    /// parses only what the projection asks for
+    bool parse(support::error_code& err,
+               const std::string& content,
+               const projection& proj);
+
     node::ptr root();
+
+    /// a compiled query over the current document, see xmlquery.hpp
+    bool select(support::error_code& err, const query& q, query_results& out);
+
     ~parser();
 
   private:
     node::ptr          root_;
     xercesc::XercesDOMParser* parser_;
+    std::string        pruned_;
+    xercesc::XMLGrammarPool*  grammars_;
+    parse_errors       errors_;
   };
 
   /// implementations follow
@@ -143,27 +263,8 @@ namespace dom {
       /// ??
       return true;
     }
-    char* tmp = xercesc::XMLString::transcode(node_->getNodeName());
-    if (tmp != (char *) NULL) {
-      name_ = tmp;
-      xercesc::XMLString::release(&tmp);
-    }
-    else {
-      /// ?
-      return false;
-    }
-    xercesc::DOMNode* link = node_->getFirstChild();
-    for (; link != 0; link = link->getNextSibling() ) {
-
-      if (link && link->getNodeType() == xercesc::DOMNode::TEXT_NODE) {
-        tmp = xercesc::XMLString::transcode(link->getNodeValue());
-        if (tmp != (char *) NULL) {
-          value_ = tmp;
-          xercesc::XMLString::release(&tmp);
-        }
-        break;
-      }
-    }
+    transcode(node_->getNodeName(), name_);
+    transcode(text_of(node_), value_);
     return true;
   }
 
@@ -181,19 +282,10 @@ namespace dom {
       /// ??
       return true;
     }
-    char* tmp = xercesc::XMLString::transcode(node_->getNodeName());
-    if (tmp != (char *) NULL) {
-      name_ = tmp;
-      xercesc::XMLString::release(&tmp);
-    }
-    else {
-      /// ?
-      return false;
-    }
+    transcode(node_->getNodeName(), name_);
+
     /// this is an attribute node, get the value
-    char* s = xercesc::XMLString::transcode(node_->getNodeValue());
-    value_ = s;
-    xercesc::XMLString::release(&s);
+    transcode(text_of(node_), value_);
     return true;
   }
 
@@ -251,27 +343,289 @@ namespace dom {
     return np;
   }
 
+  inline
+  projection::
+  projection() : keep_all_(false)
+  {}
+
+  inline projection&
+  projection::
+  insert(const std::string& name) {
+    ptr& child = children_[name];
+    if (! child) {
+      child = std::make_shared<projection>();
+    }
+    return *child;
+  }
+
+  inline void
+  projection::
+  keep_all() {
+    keep_all_ = true;
+  }
+
+  inline bool
+  projection::
+  keeps_all() const {
+    return keep_all_;
+  }
+
+  inline const projection*
+  projection::
+  find(const std::string& name) const {
+    children::const_iterator p = children_.find(name);
+    return p == children_.end() ? 0 : p->second.get();
+  }
+
+  inline bool
+  projection::
+  prune(support::error_code& err,
+        const std::string& in,
+        std::string& out) const {
+
+    out.clear();
+    out.reserve(in.size());
+
+    const char* begin = in.data();
+    scanner sc(begin, begin + in.size());
+    scanner::token t;
+
+    /// projections of the currently open elements, the root is implicit
+    std::vector<const projection*> open;
+    std::string name;
+
+    /// bytes are copied lazily, 'mark' is the start of the pending run
+    const char* mark = begin;
+    while (sc.next(t)) {
+
+      if (t.type == scanner::end_tag) {
+        if (! open.empty()) {
+          open.pop_back();
+        }
+        continue;
+      }
+      if (t.type != scanner::start_tag && t.type != scanner::empty_tag) {
+        continue;
+      }
+      /// the document element is always kept
+      if (open.empty()) {
+        if (t.type == scanner::start_tag) {
+          open.push_back(this);
+        }
+        continue;
+      }
+      name.assign(t.name, t.name_size);
+      const projection* child = open.back()->find(name);
+      if (child) {
+        if (t.type == scanner::empty_tag) {
+          continue;
+        }
+        /// a bound leaf is kept whole, no need to look inside
+        if (child->keeps_all()) {
+          if (! sc.skip_subtree()) {
+            break;
+          }
+          continue;
+        }
+        open.push_back(child);
+        continue;
+      }
+      /// not bound, flush what we have and drop the subtree
+      out.append(mark, t.begin);
+      if (t.type == scanner::start_tag && ! sc.skip_subtree()) {
+        break;
+      }
+      mark = sc.position();
+    }
+    if (t.type != scanner::end_of_input) {
+      std::string s = "Projection failed, malformed markup at offset: ";
+      s += std::to_string(t.begin - begin);
+      err.attach(support::error_code(-1, s));
+      return false;
+    }
+    out.append(mark, begin + in.size());
+    return true;
+  }
+
+  inline
+  parse_errors::
+  parse_errors() :
+    count_(0)
+  {}
+
+  inline size_t
+  parse_errors::
+  count() const {
+    return count_;
+  }
+
+  inline const std::string&
+  parse_errors::
+  first() const {
+    return first_;
+  }
+
+  inline void
+  parse_errors::
+  warning(const xercesc::SAXParseException& e)
+  {}
+
+  inline void
+  parse_errors::
+  error(const xercesc::SAXParseException& e) {
+
+    if (count_++) {
+      return;
+    }
+    char* es = xercesc::XMLString::transcode(e.getMessage());
+    first_ = es;
+    xercesc::XMLString::release(&es);
+    first_ += " at line " + std::to_string(e.getLineNumber())
+            + ", column " + std::to_string(e.getColumnNumber());
+  }
+
+  inline void
+  parse_errors::
+  fatalError(const xercesc::SAXParseException& e) {
+    error(e);
+  }
+
+  inline void
+  parse_errors::
+  resetErrors() {
+    count_ = 0;
+    first_.clear();
+  }
+
+  inline xercesc::MemoryManager*
+  counting_memory_manager::
+  getExceptionMemoryManager() {
+    return this;
+  }
+
+  inline void*
+  counting_memory_manager::
+  allocate(XMLSize_t size) {
+
+    void* p = support::alloc_stats::allocate(size);
+    if (! p) {
+      throw xercesc::OutOfMemoryException();
+    }
+    return p;
+  }
+
+  inline void
+  counting_memory_manager::
+  deallocate(void* p) {
+    support::alloc_stats::deallocate(p);
+  }
+
+  inline
+  parser::
+  parser() : parser_(0), grammars_(0)
+  {}
+
+  inline const XMLCh*
+  text_of(xercesc::DOMNode* xnode) {
+
+    static const XMLCh empty[] = { 0 };
+    if (! xnode) {
+      return empty;
+    }
+    if (xnode->getNodeType() == xercesc::DOMNode::ATTRIBUTE_NODE) {
+      const XMLCh* value = xnode->getNodeValue();
+      return value ? value : empty;
+    }
+    xercesc::DOMNode* link = xnode->getFirstChild();
+    for (; link != 0; link = link->getNextSibling()) {
+      if (link->getNodeType() == xercesc::DOMNode::TEXT_NODE) {
+        const XMLCh* value = link->getNodeValue();
+        return value ? value : empty;
+      }
+    }
+    return empty;
+  }
+
+  inline void
+  transcode(const XMLCh* s,
+            std::string& out) {
+
+    /// utf-8 straight into the buffer, no local code page transcoder
+    transcoder::utf8(s, out);
+  }
+
+  inline bool
+  parser::
+  parse(support::error_code& err,
+        const std::string& content,
+        const projection& proj) {
+
+    /// the pruned copy is kept to reuse its capacity across parses
+    if (! proj.prune(err, content, pruned_)) {
+      return false;
+    }
+    return parse(err, pruned_);
+  }
+
   inline bool
   parser::
   parse(support::error_code& err,
         const std::string& content) {
+    return parse(err, content.data(), content.size());
+  }
+
+  inline bool
+  parser::
+  parse(support::error_code& err,
+        const char* content,
+        size_t size) {
 
     try {
 
-      parser_ = new xercesc::XercesDOMParser();
-      parser_->setValidationScheme(xercesc::XercesDOMParser::Val_Never);
-      parser_->setDoNamespaces(false);
-      parser_->setHandleMultipleImports(false);
-      parser_->setValidationSchemaFullChecking(false);
-      parser_->setCreateEntityReferenceNodes(false);
+      /// one parser for the life of this one, set up once. xerces keeps
+      /// each document it builds until its pool is reset, and a document
+      /// frees its nodes with the heap blocks they were carved from, so
+      /// the previous document goes in one go
+      root_.reset();
+      if (parser_) {
+        parser_->resetDocumentPool();
+      }
+      else {
+        parser_ = new xercesc::XercesDOMParser(0,
+                                               xercesc::XMLPlatformUtils::fgMemoryManager,
+                                               grammars_);
+        parser_->setValidationScheme(xercesc::XercesDOMParser::Val_Never);
+        parser_->setDoNamespaces(false);
+        parser_->setHandleMultipleImports(false);
+        parser_->setValidationSchemaFullChecking(false);
+        parser_->setCreateEntityReferenceNodes(false);
+        if (grammars_) {
+
+          /// schemas come from the pool only, already compiled, never
+          /// loaded from a location a document names
+          parser_->setValidationScheme(xercesc::XercesDOMParser::Val_Always);
+          parser_->setDoNamespaces(true);
+          parser_->setDoSchema(true);
+          parser_->setLoadSchema(false);
+          parser_->useCachedGrammarInParse(true);
+          parser_->cacheGrammarFromParse(false);
+          parser_->setErrorHandler(&errors_);
+        }
+      }
+      errors_.resetErrors();
 
       xercesc::MemBufInputSource memory_buffer(
-        (const XMLByte *) content.c_str(),
-        content.size(),
+        (const XMLByte *) content,
+        size,
         "test",
         false);
 
       parser_->parse(memory_buffer);
+      if (errors_.count()) {
+        std::string s = "Validation failed: " + errors_.first();
+        err.attach(support::error_code(-1, s));
+        return false;
+      }
       xercesc::DOMDocument* doc = parser_->getDocument();
       xercesc::DOMElement* elem = doc->getDocumentElement();
       root_ = std::make_shared<element>(elem);
@@ -293,7 +647,7 @@ namespace dom {
       return false;
     }
     catch (...) {
-      std::string s = "Unknown exception parsing: " + content;
+      std::string s = "Unknown exception parsing: " + std::string(content, size);
       err.attach(support::error_code(-1, s));
       return false;
     }
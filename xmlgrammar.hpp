@@ -0,0 +1,156 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <xercesc/framework/MemBufInputSource.hpp>
+#include <xercesc/framework/XMLGrammarPoolImpl.hpp>
+#include <xercesc/parsers/XercesDOMParser.hpp>
+#include <xercesc/util/OutOfMemoryException.hpp>
+#include <xercesc/util/PlatformUtils.hpp>
+#include <xercesc/validators/common/Grammar.hpp>
+#include "xmldom.hpp"
+
+namespace xml {
+namespace dom {
+
+  /**
+   * Class: Grammar Pool
+   *
+   * XML Schemas compiled once and shared by every validating parser.
+   * Load them at startup, then lock(): a locked xerces pool can't
+   * change, so parsers on any thread look grammars up in it without
+   * taking a lock and a schema is never read or compiled again.
+   *
+   *   xml::dom::grammar_pool grammars;
+   *   grammars.load(err, "vmaster.xsd");
+   *   grammars.lock();
+   *   xml::dom::parser par(grammars);
+   */
+  class grammar_pool {
+  public:
+
+    grammar_pool();
+
+    /// compiles a schema into the pool, only before lock()
+    bool load(support::error_code& err, const std::string& path);
+    bool load(support::error_code& err,
+              const char* schema,
+              size_t size,
+              const std::string& id);
+
+    /// no more loads, the pool is shared read only from here on
+    void lock();
+    bool locked() const;
+
+    xercesc::XMLGrammarPool* get() const;
+
+  private:
+
+    grammar_pool(const grammar_pool&);
+    grammar_pool& operator=(const grammar_pool&);
+
+    template <class Source>
+    bool compile(support::error_code& err, const Source& source, const std::string& id);
+
+    std::unique_ptr<xercesc::XMLGrammarPool>  pool_;
+    bool                                      locked_;
+  };
+
+  inline
+  grammar_pool::
+  grammar_pool() :
+    pool_(new xercesc::XMLGrammarPoolImpl(xercesc::XMLPlatformUtils::fgMemoryManager)),
+    locked_(false)
+  {}
+
+  inline bool
+  grammar_pool::
+  load(support::error_code& err,
+       const std::string& path) {
+    return compile(err, path.c_str(), path);
+  }
+
+  inline bool
+  grammar_pool::
+  load(support::error_code& err,
+       const char* schema,
+       size_t size,
+       const std::string& id) {
+
+    xercesc::MemBufInputSource source((const XMLByte*) schema, size, id.c_str(), false);
+    return compile(err, source, id);
+  }
+
+  template <class Source>
+  inline bool
+  grammar_pool::
+  compile(support::error_code& err,
+          const Source& source,
+          const std::string& id) {
+
+    if (locked_) {
+      support::error_code::attach_or_create(err, -1, "Grammar pool is locked: " + id);
+      return false;
+    }
+    try {
+
+      /// a throwaway parser, the grammar outlives it in the pool
+      parse_errors errors;
+      xercesc::XercesDOMParser loader(0, xercesc::XMLPlatformUtils::fgMemoryManager, pool_.get());
+      loader.setDoNamespaces(true);
+      loader.setDoSchema(true);
+      loader.setValidationSchemaFullChecking(true);
+      loader.setErrorHandler(&errors);
+      xercesc::Grammar* g = loader.loadGrammar(source, xercesc::Grammar::SchemaGrammarType, true);
+      if (! g || errors.count()) {
+        std::string s = "Failed to load schema " + id;
+        if (errors.count()) {
+          s += ": " + errors.first();
+        }
+        support::error_code::attach_or_create(err, -1, s);
+        return false;
+      }
+    }
+    catch (const xercesc::OutOfMemoryException& e) {
+      support::error_code::attach_or_create(err, -1, "Failed to load schema, out of memory: " + id);
+      return false;
+    }
+    catch (const xercesc::XMLException& e) {
+      char* es = xercesc::XMLString::transcode(e.getMessage());
+      std::string s = "Failed to load schema " + id + ": " + es;
+      xercesc::XMLString::release(&es);
+      support::error_code::attach_or_create(err, -1, s);
+      return false;
+    }
+    return true;
+  }
+
+  inline void
+  grammar_pool::
+  lock() {
+    if (! locked_) {
+      pool_->lockPool();
+      locked_ = true;
+    }
+  }
+
+  inline bool
+  grammar_pool::
+  locked() const {
+    return locked_;
+  }
+
+  inline xercesc::XMLGrammarPool*
+  grammar_pool::
+  get() const {
+    return pool_.get();
+  }
+
+  inline
+  parser::
+  parser(const grammar_pool& grammars) :
+    parser_(0),
+    grammars_(grammars.get())
+  {}
+
+}}
@@ -0,0 +1,662 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+#include <xercesc/dom/DOMNode.hpp>
+#include <xercesc/dom/DOMNamedNodeMap.hpp>
+#include "error_code.hpp"
+#include "xmldom.hpp"
+
+namespace xml {
+namespace dom {
+
+  class query;
+
+  /**
+   * Class: Query Results
+   *
+   * Values found by a query, per slot in document order. Reused across
+   * evaluations, keeping its capacity.
+   */
+  class query_results {
+  public:
+
+    query_results();
+
+    size_t count(size_t slot) const;
+    bool found(size_t slot) const;
+
+    /// the bytes as found, in scan mode straight from the buffer with
+    /// entities unexpanded, valid as long as the buffer or the results
+    const char* data(size_t slot, size_t i = 0) const;
+    size_t size(size_t slot, size_t i = 0) const;
+
+    /// the value with entity and character references expanded
+    std::string text(size_t slot, size_t i = 0) const;
+    bool text(support::error_code& err, size_t slot, std::string& v, size_t i = 0) const;
+    bool integer(support::error_code& err, size_t slot, int64_t& v, size_t i = 0) const;
+    bool real(support::error_code& err, size_t slot, double& v, size_t i = 0) const;
+
+  private:
+
+    friend class query;
+
+    struct value {
+      const char*  data;
+      size_t       size;
+      bool         raw;        /// still has entity references
+    };
+
+    void reset(size_t slots);
+    const value* at(support::error_code& err, size_t slot, size_t i) const;
+
+    /// values transcoded from the dom live here, capacity is reused
+    const std::string& keep(const XMLCh* s);
+
+    std::vector<std::vector<value> >  slots_;
+    std::deque<std::string>           store_;
+    size_t                            stored_;
+  };
+
+  /**
+   * Class: Query
+   *
+   * A few values by path without a composite to bind them into. Paths
+   * are relative to the document element, like the names a binding
+   * maps, steps separated by '/', the last one may be '@name' for an
+   * attribute:
+   *
+   *   vMasterHeader/vMasterDesk
+   *   vMasterHeader/@type
+   *   vMasterHeader/vMasterDiary/vMasterDiaryEntry/diaryText
+   *
+   * add() compiles each path into a trie of states, one per element
+   * step, so a set of paths is evaluated in one pass whatever their
+   * number. A subtree no path goes into is skipped without looking
+   * inside it. A path either takes its first match or every match, and
+   * the walk stops as soon as every 'first' path has matched, provided
+   * no 'every' path is still collecting.
+   *
+   * run() walks a parsed document, scan() goes over the raw buffer with
+   * the scanner and never involves xerces. An element's value is its
+   * first text child in both, the same as binding reads it. The query
+   * itself is immutable once compiled and can be shared by threads,
+   * results are per caller.
+   */
+  class query {
+  public:
+
+    enum mode {
+      first,
+      every
+    };
+
+    typedef query_results results;
+
+    query();
+
+    /// compiles 'path' in, 'slot' is where its values will be found
+    bool add(support::error_code& err,
+             const std::string& path,
+             size_t& slot,
+             mode m = first);
+
+    size_t size() const;
+
+    bool run(support::error_code& err, xercesc::DOMNode* root, results& out) const;
+    bool scan(support::error_code& err, const char* data, size_t size, results& out) const;
+    bool scan(support::error_code& err, const std::string& content, results& out) const;
+
+    /// character and the five predefined entity references, false on
+    /// a character reference to no xml character
+    static bool expand(support::error_code& err, const char* data, size_t size, std::string& out);
+
+  private:
+
+    typedef std::pair<std::string, unsigned> transition;
+    typedef std::pair<std::string, size_t>   attribute_slot;
+
+    struct state {
+      std::vector<transition>      children;
+      std::vector<attribute_slot>  attributes;
+      std::vector<size_t>          texts;
+    };
+
+    /// what is still wanted during one evaluation
+    struct progress {
+      size_t  firsts;
+    };
+
+    bool step(unsigned from, const char* name, size_t size, unsigned& to) const;
+    bool record(results& out, progress& p, size_t slot,
+                const char* data, size_t size, bool raw) const;
+    bool done(const progress& p) const;
+    bool walk(xercesc::DOMNode* xnode, unsigned s, results& out,
+              progress& p, std::string& name) const;
+
+    std::vector<state>  states_;
+    std::vector<mode>   modes_;
+    size_t              firsts_;
+    size_t              everys_;
+  };
+
+  inline
+  query_results::
+  query_results() : stored_(0)
+  {}
+
+  inline void
+  query_results::
+  reset(size_t slots) {
+    slots_.resize(slots);
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      slots_[i].clear();
+    }
+    stored_ = 0;
+  }
+
+  inline const std::string&
+  query_results::
+  keep(const XMLCh* s) {
+    if (stored_ == store_.size()) {
+      store_.push_back(std::string());
+    }
+    std::string& out = store_[stored_++];
+    transcode(s, out);
+    return out;
+  }
+
+  inline size_t
+  query_results::
+  count(size_t slot) const {
+    return slot < slots_.size() ? slots_[slot].size() : 0;
+  }
+
+  inline bool
+  query_results::
+  found(size_t slot) const {
+    return count(slot) > 0;
+  }
+
+  inline const query_results::value*
+  query_results::
+  at(support::error_code& err,
+     size_t slot,
+     size_t i) const {
+    if (i >= count(slot)) {
+      std::string s = "Query value not found, slot: " + std::to_string(slot);
+      support::error_code::attach_or_create(err, -1, s);
+      return 0;
+    }
+    return &slots_[slot][i];
+  }
+
+  inline const char*
+  query_results::
+  data(size_t slot,
+       size_t i) const {
+    return i < count(slot) ? slots_[slot][i].data : 0;
+  }
+
+  inline size_t
+  query_results::
+  size(size_t slot,
+       size_t i) const {
+    return i < count(slot) ? slots_[slot][i].size : 0;
+  }
+
+  inline bool
+  query_results::
+  text(support::error_code& err,
+       size_t slot,
+       std::string& v,
+       size_t i) const {
+    const value* p = at(err, slot, i);
+    if (! p) {
+      return false;
+    }
+    if (p->raw) {
+      return query::expand(err, p->data, p->size, v);
+    }
+    v.assign(p->data, p->size);
+    return true;
+  }
+
+  inline std::string
+  query_results::
+  text(size_t slot,
+       size_t i) const {
+    support::error_code err;
+    std::string v;
+    if (! text(err, slot, v, i)) {
+      v.clear();
+    }
+    return v;
+  }
+
+  inline bool
+  query_results::
+  integer(support::error_code& err,
+          size_t slot,
+          int64_t& v,
+          size_t i) const {
+    std::string s;
+    if (! text(err, slot, s, i)) {
+      return false;
+    }
+    char* end = 0;
+    v = ::strtoll(s.c_str(), &end, 10);
+    while (end && (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')) {
+      ++end;
+    }
+    if (s.empty() || end == s.c_str() || *end) {
+      support::error_code::attach_or_create(err, -1, "Query value is not an integer: " + s);
+      return false;
+    }
+    return true;
+  }
+
+  inline bool
+  query_results::
+  real(support::error_code& err,
+       size_t slot,
+       double& v,
+       size_t i) const {
+    std::string s;
+    if (! text(err, slot, s, i)) {
+      return false;
+    }
+    char* end = 0;
+    v = ::strtod(s.c_str(), &end);
+    while (end && (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')) {
+      ++end;
+    }
+    if (s.empty() || end == s.c_str() || *end) {
+      support::error_code::attach_or_create(err, -1, "Query value is not a number: " + s);
+      return false;
+    }
+    return true;
+  }
+
+  inline
+  query::
+  query() :
+    states_(1),
+    firsts_(0),
+    everys_(0)
+  {}
+
+  inline size_t
+  query::
+  size() const {
+    return modes_.size();
+  }
+
+  inline bool
+  query::
+  add(support::error_code& err,
+      const std::string& path,
+      size_t& slot,
+      mode m) {
+
+    /// split into steps, only the last may name an attribute
+    std::vector<std::string> steps;
+    std::string::size_type begin = 0;
+    while (begin <= path.size()) {
+      std::string::size_type end = path.find('/', begin);
+      if (end == std::string::npos) {
+        end = path.size();
+      }
+      steps.push_back(path.substr(begin, end - begin));
+      begin = end + 1;
+    }
+    for (size_t i = 0; i < steps.size(); ++i) {
+      bool attribute = ! steps[i].empty() && steps[i][0] == '@';
+      if (steps[i].size() <= size_t(attribute) || (attribute && i + 1 != steps.size())) {
+        support::error_code::attach_or_create(err, -1, "Bad query path: " + path);
+        return false;
+      }
+    }
+
+    unsigned s = 0;
+    size_t elements = steps.back()[0] == '@' ? steps.size() - 1 : steps.size();
+    for (size_t i = 0; i < elements; ++i) {
+      unsigned next = 0;
+      if (! step(s, steps[i].data(), steps[i].size(), next)) {
+        next = states_.size();
+        states_[s].children.push_back(transition(steps[i], next));
+        states_.push_back(state());
+      }
+      s = next;
+    }
+    slot = modes_.size();
+    modes_.push_back(m);
+    if (elements < steps.size()) {
+      states_[s].attributes.push_back(attribute_slot(steps.back().substr(1), slot));
+    }
+    else {
+      states_[s].texts.push_back(slot);
+    }
+    ++(m == first ? firsts_ : everys_);
+    return true;
+  }
+
+  inline bool
+  query::
+  step(unsigned from,
+       const char* name,
+       size_t size,
+       unsigned& to) const {
+
+    /// a handful of children at most, a compare beats hashing the name
+    const std::vector<transition>& children = states_[from].children;
+    for (size_t i = 0; i < children.size(); ++i) {
+      const std::string& n = children[i].first;
+      if (n.size() == size && ::memcmp(n.data(), name, size) == 0) {
+        to = children[i].second;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline bool
+  query::
+  done(const progress& p) const {
+    return p.firsts == 0 && everys_ == 0;
+  }
+
+  inline bool
+  query::
+  record(results& out,
+         progress& p,
+         size_t slot,
+         const char* data,
+         size_t size,
+         bool raw) const {
+
+    std::vector<query_results::value>& values = out.slots_[slot];
+    if (modes_[slot] == first) {
+      if (! values.empty()) {
+        return ! done(p);
+      }
+      --p.firsts;
+    }
+    query_results::value v = { data, size, raw };
+    values.push_back(v);
+    return ! done(p);
+  }
+
+  inline bool
+  query::
+  scan(support::error_code& err,
+       const std::string& content,
+       results& out) const {
+    return scan(err, content.data(), content.size(), out);
+  }
+
+  inline bool
+  query::
+  scan(support::error_code& err,
+       const char* data,
+       size_t size,
+       results& out) const {
+
+    out.reset(modes_.size());
+    progress p = { firsts_ };
+    if (done(p)) {
+      return true;
+    }
+    scanner sc(data, data + size);
+    scanner::token t;
+
+    /// states of the open elements, and whether one still waits for
+    /// its text
+    std::vector<std::pair<unsigned, bool> > open;
+    bool root = false;
+    bool more = true;
+    bool malformed = false;
+    while (more && sc.next(t)) {
+
+      switch (t.type) {
+
+        case scanner::start_tag:
+        case scanner::empty_tag: {
+          unsigned next = 0;
+          if (open.empty()) {
+            if (root) {
+              break;
+            }
+            root = true;
+          }
+          else if (! step(open.back().first, t.name, t.name_size, next)) {
+            if (t.type == scanner::start_tag && ! sc.skip_subtree()) {
+              malformed = true;
+              more = false;
+            }
+            break;
+          }
+          const state& s = states_[next];
+          if (! s.attributes.empty()) {
+            const char* q = t.name + t.name_size;
+            scanner::attribute a;
+            while (more && scanner::next_attribute(q, t, a)) {
+              for (size_t i = 0; more && i < s.attributes.size(); ++i) {
+                const std::string& n = s.attributes[i].first;
+                if (n.size() == a.name_size && ::memcmp(n.data(), a.name, a.name_size) == 0) {
+                  more = record(out, p, s.attributes[i].second, a.value, a.value_size, true);
+                }
+              }
+            }
+          }
+          if (t.type == scanner::empty_tag) {
+            for (size_t i = 0; more && i < s.texts.size(); ++i) {
+              more = record(out, p, s.texts[i], t.end, 0, false);
+            }
+          }
+          else {
+            open.push_back(std::make_pair(next, ! s.texts.empty()));
+          }
+          break;
+        }
+
+        case scanner::text:
+        case scanner::cdata:
+          if (! open.empty() && open.back().second) {
+            const state& s = states_[open.back().first];
+            bool cdata = t.type == scanner::cdata;
+            const char* b = cdata ? t.begin + 9 : t.begin;
+            const char* e = cdata ? t.end - 3 : t.end;
+            for (size_t i = 0; more && i < s.texts.size(); ++i) {
+              more = record(out, p, s.texts[i], b, e - b, ! cdata);
+            }
+            open.back().second = false;
+          }
+          break;
+
+        case scanner::end_tag:
+          if (! open.empty()) {
+            if (open.back().second) {
+              const state& s = states_[open.back().first];
+              for (size_t i = 0; more && i < s.texts.size(); ++i) {
+                more = record(out, p, s.texts[i], t.begin, 0, false);
+              }
+            }
+            open.pop_back();
+          }
+          break;
+
+        default:
+          break;
+      }
+    }
+    if (malformed || (more && t.type != scanner::end_of_input)) {
+      std::string s = "Query failed, malformed markup at offset: ";
+      s += std::to_string(t.begin - data);
+      support::error_code::attach_or_create(err, -1, s);
+      return false;
+    }
+    return true;
+  }
+
+  inline bool
+  query::
+  run(support::error_code& err,
+      xercesc::DOMNode* root,
+      results& out) const {
+
+    out.reset(modes_.size());
+    progress p = { firsts_ };
+    if (done(p)) {
+      return true;
+    }
+    if (! root) {
+      support::error_code::attach_or_create(err, -1, "Query over an empty document");
+      return false;
+    }
+    std::string name;
+    walk(root, 0, out, p, name);
+    return true;
+  }
+
+  inline bool
+  query::
+  walk(xercesc::DOMNode* xnode,
+       unsigned si,
+       results& out,
+       progress& p,
+       std::string& name) const {
+
+    const state& s = states_[si];
+    if (! s.attributes.empty()) {
+      xercesc::DOMNamedNodeMap* attrs = xnode->getAttributes();
+      size_t length = attrs ? attrs->getLength() : 0;
+      for (size_t i = 0; i < length; ++i) {
+        xercesc::DOMNode* attr = attrs->item(i);
+        transcode(attr->getNodeName(), name);
+        for (size_t a = 0; a < s.attributes.size(); ++a) {
+          if (s.attributes[a].first == name) {
+            const std::string& v = out.keep(text_of(attr));
+            if (! record(out, p, s.attributes[a].second, v.data(), v.size(), false)) {
+              return false;
+            }
+          }
+        }
+      }
+    }
+    if (! s.texts.empty()) {
+      const std::string& v = out.keep(text_of(xnode));
+      for (size_t i = 0; i < s.texts.size(); ++i) {
+        if (! record(out, p, s.texts[i], v.data(), v.size(), false)) {
+          return false;
+        }
+      }
+    }
+    if (s.children.empty()) {
+      return true;
+    }
+    xercesc::DOMNode* link = xnode->getFirstChild();
+    for (; link != 0; link = link->getNextSibling()) {
+      if (link->getNodeType() != xercesc::DOMNode::ELEMENT_NODE) {
+        continue;
+      }
+      transcode(link->getNodeName(), name);
+      unsigned next = 0;
+      if (step(si, name.data(), name.size(), next) && ! walk(link, next, out, p, name)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  inline bool
+  query::
+  expand(support::error_code& err,
+         const char* data,
+         size_t size,
+         std::string& out) {
+
+    out.clear();
+    const char* end = data + size;
+    const char* p = data;
+    while (p < end) {
+      const char* amp = (const char*) ::memchr(p, '&', end - p);
+      if (! amp) {
+        out.append(p, end);
+        return true;
+      }
+      out.append(p, amp);
+      const char* semi = (const char*) ::memchr(amp, ';', end - amp);
+      if (! semi) {
+        out.append(amp, end);
+        return true;
+      }
+      std::string ref(amp + 1, semi);
+      p = semi + 1;
+      if (ref == "lt") { out += '<'; continue; }
+      if (ref == "gt") { out += '>'; continue; }
+      if (ref == "amp") { out += '&'; continue; }
+      if (ref == "quot") { out += '"'; continue; }
+      if (ref == "apos") { out += '\''; continue; }
+      if (ref.size() < 2 || ref[0] != '#') {
+        /// not ours to expand, left as it is
+        out.append(amp, p);
+        continue;
+      }
+      bool hex = ref[1] == 'x';
+      const char* digits = ref.c_str() + 1 + hex;
+      char* last = 0;
+      unsigned long c = ::strtoul(digits, &last, hex ? 16 : 10);
+
+      /// digits only, and a code point xml allows in a document
+      bool valid = *digits && *digits != '-' && *digits != '+' && *last == 0 &&
+                   (c == 0x9 || c == 0xa || c == 0xd ||
+                    (c >= 0x20 && c <= 0xd7ff) ||
+                    (c >= 0xe000 && c <= 0xfffd) ||
+                    (c >= 0x10000 && c <= 0x10ffff));
+      if (! valid) {
+        support::error_code::attach_or_create(err, -1, "Bad character reference: &" + ref + ";");
+        return false;
+      }
+
+      /// the code point as utf-8
+      if (c < 0x80) {
+        out += char(c);
+      }
+      else if (c < 0x800) {
+        out += char(0xc0 | (c >> 6));
+        out += char(0x80 | (c & 0x3f));
+      }
+      else if (c < 0x10000) {
+        out += char(0xe0 | (c >> 12));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+      }
+      else {
+        out += char(0xf0 | (c >> 18));
+        out += char(0x80 | ((c >> 12) & 0x3f));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+      }
+    }
+    return true;
+  }
+
+  inline bool
+  parser::
+  select(support::error_code& err,
+         const query& q,
+         query_results& out) {
+    if (! root_) {
+      support::error_code::attach_or_create(err, -1, "Query before a document was parsed");
+      return false;
+    }
+    return q.run(err, root_->xerces_node(), out);
+  }
+
+}}
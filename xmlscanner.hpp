@@ -0,0 +1,275 @@
+#pragma once
+
+#include <string.h>
+#include <string>
+
+namespace xml {
+namespace dom {
+
+  /**
+   * Class: Scanner
+   *
+   * Byte level tokenizer over a raw xml buffer. It does not build
+   * anything or allocate, it only classifies markup so callers can
+   * decide what to keep before xerces gets to see the document.
+   */
+  class scanner {
+  public:
+
+    enum token_type {
+      start_tag,     /// <name ...>
+      empty_tag,     /// <name .../>
+      end_tag,       /// </name>
+      text,          /// character data up to the next '<'
+      cdata,         /// <![CDATA[ ... ]]>
+      markup,        /// comments, processing instructions, doctype
+      end_of_input,
+      malformed
+    };
+
+    struct token {
+      token_type   type;
+      const char*  begin;       /// first byte of the token
+      const char*  end;         /// one past the last byte
+      const char*  name;        /// tag name, tags only
+      size_t       name_size;
+    };
+
+    struct attribute {
+      const char*  begin;       /// first byte of name="value"
+      const char*  end;         /// one past the closing quote
+      const char*  name;
+      size_t       name_size;
+      const char*  value;       /// raw, entities are not expanded
+      size_t       value_size;
+    };
+
+    scanner(const char* begin, const char* end);
+
+    /// walks the attributes of a start or empty tag, 'p' starts just
+    /// after the tag name and is left past the attribute returned
+    static bool next_attribute(const char*& p, const token& t, attribute& a);
+
+    /// advances by one token, false at end of input or on bad markup
+    bool next(token& t);
+
+    /// to be called straight after a start_tag, moves past the matching
+    /// end tag by counting depth, false if the input runs out first
+    bool skip_subtree();
+
+    const char* position() const;
+
+  private:
+
+    bool tag(token& t);
+    bool special(token& t);
+    const char* find(const char* s) const;
+
+    const char*  pos_;
+    const char*  end_;
+  };
+
+  inline
+  scanner::
+  scanner(const char* begin,
+          const char* end) :
+    pos_(begin),
+    end_(end)
+  {}
+
+  inline const char*
+  scanner::
+  position() const {
+    return pos_;
+  }
+
+  inline const char*
+  scanner::
+  find(const char* s) const {
+
+    /// locate the terminator of a comment, pi or cdata section
+    size_t n = ::strlen(s);
+    for (const char* p = pos_; p + n <= end_; ++p) {
+      p = (const char*) ::memchr(p, s[0], end_ - p);
+      if (! p || p + n > end_) {
+        break;
+      }
+      if (::memcmp(p, s, n) == 0) {
+        return p;
+      }
+    }
+    return 0;
+  }
+
+  inline bool
+  scanner::
+  next(token& t) {
+
+    t.begin = pos_;
+    t.name = 0;
+    t.name_size = 0;
+    if (pos_ >= end_) {
+      t.type = end_of_input;
+      t.end = end_;
+      return false;
+    }
+    /// character data runs up to the next markup
+    if (*pos_ != '<') {
+      const char* p = (const char*) ::memchr(pos_, '<', end_ - pos_);
+      pos_ = p ? p : end_;
+      t.type = text;
+      t.end = pos_;
+      return true;
+    }
+    if (pos_ + 1 < end_ && (pos_[1] == '!' || pos_[1] == '?')) {
+      return special(t);
+    }
+    return tag(t);
+  }
+
+  inline bool
+  scanner::
+  special(token& t) {
+
+    const char* terminator = ">";
+    t.type = markup;
+    if (end_ - pos_ >= 4 && ::memcmp(pos_, "<!--", 4) == 0) {
+      terminator = "-->";
+    }
+    else if (end_ - pos_ >= 9 && ::memcmp(pos_, "<![CDATA[", 9) == 0) {
+      terminator = "]]>";
+      t.type = cdata;
+    }
+    else if (pos_[1] == '?') {
+      terminator = "?>";
+    }
+    const char* p = find(terminator);
+    if (! p) {
+      t.type = malformed;
+      t.end = end_;
+      return false;
+    }
+    pos_ = p + ::strlen(terminator);
+    t.end = pos_;
+    return true;
+  }
+
+  inline bool
+  scanner::
+  tag(token& t) {
+
+    const char* p = pos_ + 1;
+    t.type = start_tag;
+    if (p < end_ && *p == '/') {
+      t.type = end_tag;
+      ++p;
+    }
+    /// the name ends at whitespace, '/' or '>'
+    t.name = p;
+    while (p < end_ &&
+           *p != '>' && *p != '/' &&
+           *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+      ++p;
+    }
+    t.name_size = p - t.name;
+    /// walk to the closing '>', attribute values may contain one
+    char quote = 0;
+    for (; p < end_; ++p) {
+      if (quote) {
+        if (*p == quote) {
+          quote = 0;
+        }
+      }
+      else if (*p == '"' || *p == '\'') {
+        quote = *p;
+      }
+      else if (*p == '>') {
+        break;
+      }
+    }
+    if (p >= end_ || t.name_size == 0) {
+      t.type = malformed;
+      t.end = end_;
+      return false;
+    }
+    if (t.type == start_tag && p[-1] == '/') {
+      t.type = empty_tag;
+    }
+    pos_ = p + 1;
+    t.end = pos_;
+    return true;
+  }
+
+  inline bool
+  scanner::
+  next_attribute(const char*& p,
+                 const token& t,
+                 attribute& a) {
+
+    const char* end = t.end - 1;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+      ++p;
+    }
+    if (p >= end || *p == '/') {
+      return false;
+    }
+    a.begin = p;
+    a.name = p;
+    while (p < end && *p != '=' &&
+           *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+      ++p;
+    }
+    a.name_size = p - a.name;
+    p = (const char*) ::memchr(p, '=', end - p);
+    if (! p) {
+      p = end;
+      return false;
+    }
+    ++p;
+    while (p < end && *p != '"' && *p != '\'') {
+      ++p;
+    }
+    if (p >= end) {
+      return false;
+    }
+    char quote = *p++;
+    a.value = p;
+    p = (const char*) ::memchr(p, quote, end - p);
+    if (! p) {
+      p = end;
+      return false;
+    }
+    a.value_size = p - a.value;
+    a.end = ++p;
+    return true;
+  }
+
+  inline bool
+  scanner::
+  skip_subtree() {
+
+    token t;
+    size_t depth = 1;
+    while (depth) {
+
+      /// the only interesting bytes are tags, jump straight to them
+      const char* p = (const char*) ::memchr(pos_, '<', end_ - pos_);
+      if (! p) {
+        pos_ = end_;
+        return false;
+      }
+      pos_ = p;
+      if (! next(t)) {
+        return false;
+      }
+      if (t.type == start_tag) {
+        ++depth;
+      }
+      else if (t.type == end_tag) {
+        --depth;
+      }
+    }
+    return true;
+  }
+
+}}
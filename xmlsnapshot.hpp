@@ -0,0 +1,709 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "zlib_adapter.hpp"
+// #include "xmlbinding.hpp"
+
+namespace xml {
+namespace binding {
+
+  /**
+   * Class: Snapshot
+   *
+   * Flat, offset based image of a bound composite. Records, lists and
+   * strings are addressed by 32 bit offsets from the start of the
+   * image so it can be mapped from disk and read in place, nothing is
+   * rebuilt on load.
+   *
+   * Layout, native byte order, read in place by hosts of the same
+   * order only. The header flags record which one wrote it:
+   *
+   *   header   magic, version, flags, size, root offset
+   *   record   count, kind, entry[count]     (entries sorted by name)
+   *   list     count, kind, entry[count]     (names unused)
+   *   entry    name offset, kind, payload    (16 bytes)
+   *   string   size, bytes, '\0'
+   *
+   * An entry payload is the value itself for integers and reals, and
+   * an offset for strings, records and lists. Images may be wrapped in
+   * zlib, they are then inflated once on load.
+   */
+  class snapshot {
+  public:
+
+    static const uint32_t magic            = 0x504e5358;   /// "XSNP"
+    static const uint32_t compressed_magic = 0x5a4e5358;   /// "XSNZ"
+    static const uint16_t version          = 2;
+
+    /// header flags, the byte order of the writing host
+    static const uint16_t little_endian    = 1;
+    static const uint16_t big_endian       = 2;
+
+    enum kind {
+      none    = 0,
+      integer = 1,
+      real    = 2,
+      string  = 3,
+      record  = 4,
+      list    = 5
+    };
+
+    struct header {
+      uint32_t  magic;
+      uint16_t  version;
+      uint16_t  flags;
+      uint32_t  size;
+      uint32_t  root;
+    };
+
+    struct entry {
+      uint32_t  name;
+      uint32_t  kind;
+      uint64_t  payload;
+    };
+
+    class records;
+
+    /// a value in the image, or an invalid one when not found
+    class field {
+    public:
+
+      field();
+      field(const char* base, size_t size, const entry* e);
+
+      bool valid() const;
+      snapshot::kind type() const;
+      std::string name() const;
+
+      long as_long() const;
+      double as_double() const;
+
+      /// points into the image, nul terminated
+      const char* c_str() const;
+      size_t length() const;
+      std::string str() const;
+
+      /// for record and list fields
+      records children() const;
+
+    private:
+      const char*   base_;
+      size_t        size_;
+      const entry*  entry_;
+    };
+
+    /// the entries of a record or a list
+    class records {
+    public:
+
+      records();
+      records(const char* base, size_t size, uint64_t offset);
+
+      bool valid() const;
+      size_t size() const;
+      field operator[](size_t i) const;
+
+      /// binary search, record entries are sorted by name
+      field find(const std::string& name) const;
+
+    private:
+      const char*   base_;
+      size_t        size_;
+      const entry*  entries_;
+      uint32_t      count_;
+    };
+
+    /// read access to an image somebody else owns, 8 byte aligned
+    class view {
+    public:
+
+      view();
+      bool open(support::error_code& err, const char* data, size_t size);
+      records root() const;
+
+    private:
+      const char*  data_;
+      size_t       size_;
+    };
+
+    /// an image file mapped into memory, compressed ones are inflated
+    class mapping {
+    public:
+
+      mapping();
+      ~mapping();
+
+      bool map(support::error_code& err, const std::string& path);
+      const view& image() const;
+
+    private:
+
+      mapping(const mapping&);
+      mapping& operator=(const mapping&);
+
+      void* address_;
+      size_t length_;
+      std::string inflated_;
+      view view_;
+    };
+
+    /// writes the image of a bound composite to 'out'
+    static bool save(support::error_code& err,
+                     const composite& c,
+                     std::string& out,
+                     bool compress = false);
+
+    static bool write(support::error_code& err,
+                      const composite& c,
+                      const std::string& path,
+                      bool compress = false);
+
+  private:
+
+    class writer;
+
+    static uint16_t byte_order();
+    static bool swapped(uint32_t m);
+    static const char* string_at(const char* base, size_t size, uint64_t offset, uint32_t& length);
+  };
+
+  /**
+   * The image is written bottom up: a record is emitted when it is
+   * left, by which time all of its children already have offsets.
+   */
+  class snapshot::writer : public visitor {
+  public:
+
+    writer(std::string& out);
+
+    virtual void enter(const std::string& name, const composite& c);
+    virtual void leave(const std::string& name, const composite& c);
+    virtual void enter_list(const std::string& name, size_t size);
+    virtual void leave_list(const std::string& name);
+    virtual void leaf(const std::string& name, long value);
+    virtual void leaf(const std::string& name, double value);
+    virtual void leaf(const std::string& name, const std::string& value);
+
+    uint32_t root() const;
+
+  private:
+
+    void add(const std::string& name, uint32_t kind, uint64_t payload);
+    uint32_t text(const std::string& s);
+    uint32_t close(uint32_t kind);
+
+    typedef std::vector<entry> frame;
+
+    std::string&                      out_;
+    std::vector<frame>                frames_;
+    std::map<std::string, uint32_t>   strings_;
+    uint32_t                          root_;
+  };
+
+  inline
+  snapshot::writer::
+  writer(std::string& out) :
+    out_(out),
+    root_(0) {
+
+    header h = { magic, version, byte_order(), 0, 0 };
+    out_.assign((const char*) &h, sizeof(h));
+  }
+
+  inline uint32_t
+  snapshot::writer::
+  root() const {
+    return root_;
+  }
+
+  inline uint32_t
+  snapshot::writer::
+  text(const std::string& s) {
+
+    /// names repeat for every list item, keep one copy of each
+    std::map<std::string, uint32_t>::iterator p = strings_.find(s);
+    if (p != strings_.end()) {
+      return p->second;
+    }
+    uint32_t offset = out_.size();
+    uint32_t length = s.size();
+    out_.append((const char*) &length, sizeof(length));
+    out_.append(s.c_str(), s.size() + 1);
+    strings_[s] = offset;
+    return offset;
+  }
+
+  inline void
+  snapshot::writer::
+  add(const std::string& name,
+      uint32_t kind,
+      uint64_t payload) {
+    entry e = { text(name), kind, payload };
+    frames_.back().push_back(e);
+  }
+
+  inline uint32_t
+  snapshot::writer::
+  close(uint32_t kind) {
+
+    /// records and lists are 8 byte aligned for the entry payloads,
+    /// offsets wrap past 4GB, save() refuses such images
+    out_.append((8 - out_.size() % 8) % 8, '\0');
+    uint32_t offset = out_.size();
+    uint32_t count[2] = { (uint32_t) frames_.back().size(), kind };
+    out_.append((const char*) count, sizeof(count));
+    if (! frames_.back().empty()) {
+      out_.append((const char*) &frames_.back()[0], frames_.back().size() * sizeof(entry));
+    }
+    frames_.pop_back();
+    return offset;
+  }
+
+  inline void
+  snapshot::writer::
+  enter(const std::string& name,
+        const composite& c) {
+    frames_.push_back(frame());
+  }
+
+  inline void
+  snapshot::writer::
+  leave(const std::string& name,
+        const composite& c) {
+
+    uint32_t offset = close(record);
+    if (frames_.empty()) {
+      root_ = offset;
+    }
+    else {
+      add(name, record, offset);
+    }
+  }
+
+  inline void
+  snapshot::writer::
+  enter_list(const std::string& name,
+             size_t size) {
+    frames_.push_back(frame());
+    frames_.back().reserve(size);
+  }
+
+  inline void
+  snapshot::writer::
+  leave_list(const std::string& name) {
+    uint32_t offset = close(list);
+    add(name, list, offset);
+  }
+
+  inline void
+  snapshot::writer::
+  leaf(const std::string& name,
+       long value) {
+    add(name, integer, (uint64_t) value);
+  }
+
+  inline void
+  snapshot::writer::
+  leaf(const std::string& name,
+       double value) {
+    uint64_t payload;
+    ::memcpy(&payload, &value, sizeof(payload));
+    add(name, real, payload);
+  }
+
+  inline void
+  snapshot::writer::
+  leaf(const std::string& name,
+       const std::string& value) {
+    add(name, string, text(value));
+  }
+
+  inline bool
+  snapshot::
+  save(support::error_code& err,
+       const composite& c,
+       std::string& out,
+       bool compress) {
+
+    std::string image;
+    writer w(image);
+    c.accept(w, "");
+    if (image.size() > UINT32_MAX) {
+      support::error_code::attach_or_create(err, -1, "Snapshot: image larger than 32 bit offsets can address.");
+      return false;
+    }
+
+    header h;
+    ::memcpy(&h, image.data(), sizeof(h));
+    h.size = image.size();
+    h.root = w.root();
+    image.replace(0, sizeof(h), (const char*) &h, sizeof(h));
+    if (! compress) {
+      out.swap(image);
+      return true;
+    }
+    mangle::bytes packed;
+    if (! mangle::zlib_adapter::compress(err, packed, image)) {
+      return false;
+    }
+    uint32_t m = compressed_magic;
+    out.assign((const char*) &m, sizeof(m));
+    out.append((const char*) &packed[0], packed.size());
+    return true;
+  }
+
+  inline bool
+  snapshot::
+  write(support::error_code& err,
+        const composite& c,
+        const std::string& path,
+        bool compress) {
+
+    std::string image;
+    if (! save(err, c, image, compress)) {
+      return false;
+    }
+    std::ofstream ofs(path.c_str(), std::ios::binary | std::ios::trunc);
+    ofs.write(image.data(), image.size());
+    if (! ofs) {
+      support::error_code::attach_or_create(err, -1, "Snapshot: failed to write " + path);
+      return false;
+    }
+    return true;
+  }
+
+  inline uint16_t
+  snapshot::
+  byte_order() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    ::memcpy(&first, &probe, 1);
+    return first ? little_endian : big_endian;
+  }
+
+  inline bool
+  snapshot::
+  swapped(uint32_t m) {
+    uint32_t back = (m >> 24) | ((m >> 8) & 0xff00) | ((m << 8) & 0xff0000) | (m << 24);
+    return back == magic || back == compressed_magic;
+  }
+
+  inline const char*
+  snapshot::
+  string_at(const char* base,
+            size_t size,
+            uint64_t offset,
+            uint32_t& length) {
+
+    /// offsets come from disk, no sum that could wrap
+    if (offset > size || size - offset < sizeof(uint32_t)) {
+      return 0;
+    }
+    ::memcpy(&length, base + offset, sizeof(length));
+    if (size - offset - sizeof(uint32_t) < (uint64_t) length + 1) {
+      return 0;
+    }
+    return base + offset + sizeof(uint32_t);
+  }
+
+  inline
+  snapshot::field::
+  field() :
+    base_(0),
+    size_(0),
+    entry_(0)
+  {}
+
+  inline
+  snapshot::field::
+  field(const char* base,
+        size_t size,
+        const entry* e) :
+    base_(base),
+    size_(size),
+    entry_(e)
+  {}
+
+  inline bool
+  snapshot::field::
+  valid() const {
+    return entry_ != 0;
+  }
+
+  inline snapshot::kind
+  snapshot::field::
+  type() const {
+    return entry_ ? (snapshot::kind) entry_->kind : none;
+  }
+
+  inline std::string
+  snapshot::field::
+  name() const {
+    uint32_t length = 0;
+    const char* s = entry_ ? string_at(base_, size_, entry_->name, length) : 0;
+    return s ? std::string(s, length) : std::string();
+  }
+
+  inline long
+  snapshot::field::
+  as_long() const {
+    if (type() == real) {
+      return (long) as_double();
+    }
+    return type() == integer ? (long) entry_->payload : 0;
+  }
+
+  inline double
+  snapshot::field::
+  as_double() const {
+    if (type() == integer) {
+      return (double) (long) entry_->payload;
+    }
+    double value = 0;
+    if (type() == real) {
+      ::memcpy(&value, &entry_->payload, sizeof(value));
+    }
+    return value;
+  }
+
+  inline const char*
+  snapshot::field::
+  c_str() const {
+    uint32_t length = 0;
+    const char* s = type() == string ? string_at(base_, size_, entry_->payload, length) : 0;
+    return s ? s : "";
+  }
+
+  inline size_t
+  snapshot::field::
+  length() const {
+    uint32_t length = 0;
+    const char* s = type() == string ? string_at(base_, size_, entry_->payload, length) : 0;
+    return s ? length : 0;
+  }
+
+  inline std::string
+  snapshot::field::
+  str() const {
+    return std::string(c_str(), length());
+  }
+
+  inline snapshot::records
+  snapshot::field::
+  children() const {
+    if (type() != record && type() != list) {
+      return records();
+    }
+    return records(base_, size_, entry_->payload);
+  }
+
+  inline
+  snapshot::records::
+  records() :
+    base_(0),
+    size_(0),
+    entries_(0),
+    count_(0)
+  {}
+
+  inline
+  snapshot::records::
+  records(const char* base,
+          size_t size,
+          uint64_t offset) :
+    base_(base),
+    size_(size),
+    entries_(0),
+    count_(0) {
+
+    /// offsets come from disk, check the whole 64 bits before trusting them
+    if (offset % 8 || offset > size || size - offset < 2 * sizeof(uint32_t)) {
+      return;
+    }
+    uint32_t count;
+    ::memcpy(&count, base + offset, sizeof(count));
+    if ((size - offset - 2 * sizeof(uint32_t)) / sizeof(entry) < count) {
+      return;
+    }
+    entries_ = (const entry*) (base + offset + 2 * sizeof(uint32_t));
+    count_ = count;
+  }
+
+  inline bool
+  snapshot::records::
+  valid() const {
+    return entries_ != 0;
+  }
+
+  inline size_t
+  snapshot::records::
+  size() const {
+    return count_;
+  }
+
+  inline snapshot::field
+  snapshot::records::
+  operator[](size_t i) const {
+    return i < count_ ? field(base_, size_, &entries_[i]) : field();
+  }
+
+  inline snapshot::field
+  snapshot::records::
+  find(const std::string& name) const {
+
+    size_t low = 0;
+    size_t high = count_;
+    while (low < high) {
+
+      size_t mid = (low + high) / 2;
+      uint32_t length = 0;
+      const char* s = string_at(base_, size_, entries_[mid].name, length);
+      if (! s) {
+        return field();
+      }
+      int c = ::memcmp(s, name.data(), std::min<size_t>(length, name.size()));
+      if (c == 0) {
+        c = length < name.size() ? -1 : (length > name.size() ? 1 : 0);
+      }
+      if (c == 0) {
+        return field(base_, size_, &entries_[mid]);
+      }
+      if (c < 0) {
+        low = mid + 1;
+      }
+      else {
+        high = mid;
+      }
+    }
+    return field();
+  }
+
+  inline
+  snapshot::view::
+  view() :
+    data_(0),
+    size_(0)
+  {}
+
+  inline bool
+  snapshot::view::
+  open(support::error_code& err,
+       const char* data,
+       size_t size) {
+
+    header h;
+    if (size < sizeof(h)) {
+      support::error_code::attach_or_create(err, -1, "Snapshot: image too small.");
+      return false;
+    }
+    ::memcpy(&h, data, sizeof(h));
+    if (swapped(h.magic)) {
+      support::error_code::attach_or_create(err, -1, "Snapshot: image written in the other byte order.");
+      return false;
+    }
+    if (h.magic != magic || h.version != version || h.flags != byte_order() || h.size != size) {
+      std::ostringstream oss;
+      oss << "Snapshot: bad header, magic " << h.magic
+          << ", version " << h.version
+          << ", flags " << h.flags
+          << ", size " << h.size << " of " << size;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      return false;
+    }
+    data_ = data;
+    size_ = size;
+    if (! root().valid()) {
+      data_ = 0;
+      size_ = 0;
+      support::error_code::attach_or_create(err, -1, "Snapshot: bad root record.");
+      return false;
+    }
+    return true;
+  }
+
+  inline snapshot::records
+  snapshot::view::
+  root() const {
+    if (! data_) {
+      return records();
+    }
+    header h;
+    ::memcpy(&h, data_, sizeof(h));
+    return records(data_, size_, h.root);
+  }
+
+  inline
+  snapshot::mapping::
+  mapping() :
+    address_(MAP_FAILED),
+    length_(0)
+  {}
+
+  inline
+  snapshot::mapping::
+  ~mapping() {
+    if (address_ != MAP_FAILED) {
+      ::munmap(address_, length_);
+    }
+  }
+
+  inline bool
+  snapshot::mapping::
+  map(support::error_code& err,
+      const std::string& path) {
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      support::error_code::attach_or_create(err, -1, "Snapshot: cannot open " + path);
+      return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(uint32_t)) {
+      ::close(fd);
+      support::error_code::attach_or_create(err, -1, "Snapshot: cannot size " + path);
+      return false;
+    }
+    length_ = st.st_size;
+    address_ = ::mmap(0, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (address_ == MAP_FAILED) {
+      support::error_code::attach_or_create(err, -1, "Snapshot: cannot map " + path);
+      return false;
+    }
+    uint32_t m;
+    ::memcpy(&m, address_, sizeof(m));
+    if (swapped(m)) {
+      support::error_code::attach_or_create(err, -1, "Snapshot: " + path + " written in the other byte order.");
+      return false;
+    }
+    if (m != compressed_magic) {
+      return view_.open(err, (const char*) address_, length_);
+    }
+    /// compressed images are inflated once, the mapping is then dropped
+    const unsigned char* p = (const unsigned char*) address_;
+    mangle::bytes packed(p + sizeof(m), p + length_);
+    ::munmap(address_, length_);
+    address_ = MAP_FAILED;
+    if (! mangle::zlib_adapter::uncompress(err, inflated_, packed)) {
+      return false;
+    }
+    return view_.open(err, inflated_.data(), inflated_.size());
+  }
+
+  inline const snapshot::view&
+  snapshot::mapping::
+  image() const {
+    return view_;
+  }
+
+}}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <xercesc/util/XercesDefs.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace xml {
+namespace dom {
+
+  /**
+   * Class: Transcoder
+   *
+   * UTF-16 (XMLCh) to UTF-8 into caller owned buffers. Runs of ASCII,
+   * which is nearly all of our feeds, are narrowed eight code units at
+   * a time with SSE2. Anything else drops to a scalar encoder, lone
+   * surrogates become U+FFFD. Unlike XMLString::transcode the output is
+   * always UTF-8 whatever the locale, and nothing is allocated once the
+   * buffer has grown to fit.
+   */
+  class transcoder {
+  public:
+
+    /// code units before the terminating zero
+    static size_t length(const XMLCh* s);
+
+    /// replaces the contents of 'out'
+    static void utf8(const XMLCh* s, std::string& out);
+    static void utf8(const XMLCh* s, size_t n, std::string& out);
+
+  private:
+
+    /// narrows the leading ASCII of s[0, n) into out, returns how many
+    /// code units were done
+    static size_t ascii(const uint16_t* s, size_t n, char* out);
+
+    /// encodes s[0, n) into out, which must hold 3 * n bytes
+    static size_t scalar(const uint16_t* s, size_t n, char* out);
+  };
+
+  inline size_t
+  transcoder::
+  length(const XMLCh* s) {
+
+    const uint16_t* p = (const uint16_t*) s;
+#if defined(__SSE2__)
+    /// aligned loads never cross into an unmapped page
+    while (((uintptr_t) p & 15) != 0) {
+      if (! *p) {
+        return p - (const uint16_t*) s;
+      }
+      ++p;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    for (;;) {
+      __m128i v = _mm_load_si128((const __m128i*) p);
+      int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero));
+      if (mask) {
+        return p - (const uint16_t*) s + (__builtin_ctz(mask) >> 1);
+      }
+      p += 8;
+    }
+#else
+    while (*p) {
+      ++p;
+    }
+    return p - (const uint16_t*) s;
+#endif
+  }
+
+  inline size_t
+  transcoder::
+  ascii(const uint16_t* s,
+        size_t n,
+        char* out) {
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i high = _mm_set1_epi16((short) 0xff80);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+      __m128i a = _mm_loadu_si128((const __m128i*) (s + i));
+      __m128i b = _mm_loadu_si128((const __m128i*) (s + i + 8));
+      __m128i any = _mm_and_si128(_mm_or_si128(a, b), high);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(any, zero)) != 0xffff) {
+        break;
+      }
+      _mm_storeu_si128((__m128i*) (out + i), _mm_packus_epi16(a, b));
+    }
+    for (; i + 8 <= n; i += 8) {
+      __m128i a = _mm_loadu_si128((const __m128i*) (s + i));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(a, high), zero)) != 0xffff) {
+        break;
+      }
+      _mm_storel_epi64((__m128i*) (out + i), _mm_packus_epi16(a, a));
+    }
+#endif
+    for (; i < n && s[i] < 0x80; ++i) {
+      out[i] = (char) s[i];
+    }
+    return i;
+  }
+
+  inline size_t
+  transcoder::
+  scalar(const uint16_t* s,
+         size_t n,
+         char* out) {
+
+    char* o = out;
+    for (size_t i = 0; i < n; ++i) {
+
+      uint32_t c = s[i];
+      if (c < 0x80) {
+        *o++ = (char) c;
+        continue;
+      }
+      if (c < 0x800) {
+        *o++ = (char) (0xc0 | (c >> 6));
+        *o++ = (char) (0x80 | (c & 0x3f));
+        continue;
+      }
+      if (c >= 0xd800 && c < 0xdc00 && i + 1 < n &&
+          s[i + 1] >= 0xdc00 && s[i + 1] < 0xe000) {
+        c = 0x10000 + ((c - 0xd800) << 10) + (s[++i] - 0xdc00);
+        *o++ = (char) (0xf0 | (c >> 18));
+        *o++ = (char) (0x80 | ((c >> 12) & 0x3f));
+        *o++ = (char) (0x80 | ((c >> 6) & 0x3f));
+        *o++ = (char) (0x80 | (c & 0x3f));
+        continue;
+      }
+      if (c >= 0xd800 && c < 0xe000) {
+        c = 0xfffd;
+      }
+      *o++ = (char) (0xe0 | (c >> 12));
+      *o++ = (char) (0x80 | ((c >> 6) & 0x3f));
+      *o++ = (char) (0x80 | (c & 0x3f));
+    }
+    return o - out;
+  }
+
+  inline void
+  transcoder::
+  utf8(const XMLCh* s,
+       std::string& out) {
+
+    if (! s) {
+      out.clear();
+      return;
+    }
+    utf8(s, length(s), out);
+  }
+
+  inline void
+  transcoder::
+  utf8(const XMLCh* s,
+       size_t n,
+       std::string& out) {
+
+    /// optimistic, all ASCII is one byte per code unit
+    const uint16_t* p = (const uint16_t*) s;
+    out.resize(n);
+    if (! n) {
+      return;
+    }
+    size_t done = ascii(p, n, &out[0]);
+    if (done == n) {
+      return;
+    }
+    /// a surrogate pair is two units for four bytes, three is the worst
+    out.resize(done + 3 * (n - done));
+    size_t written = scalar(p + done, n - done, &out[done]);
+    out.resize(done + written);
+  }
+
+}}
@@ -1,82 +1,488 @@
-#include <fstream>
-#include <sstream>
+#include <sched.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <atomic>
+#include <chrono>
 #include <thread>
 #include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
 #include <zlib_adapter.hpp>
+#include "zlib_frame.hpp"
 
 namespace test {
 
-  class parallel_mangler {
+  /**
+   * Class: Scaling Harness
+   *
+   * Compression throughput as threads are added. Each step of the
+   * sweep starts its workers, lets them set up, pins them if asked,
+   * then releases them together; each runs zlib_adapter compress and
+   * uncompress rounds, or frame compress, verify and uncompress ones,
+   * until the step's time is up. Nothing is printed until every worker
+   * is done.
+   *
+   * Pinning is compact, filling a node's cores before the next node's,
+   * or spread, one node after another with a worker allowed anywhere
+   * on its node. Nodes come from /sys, a machine without them is one
+   * node. A worker compresses the one shared input or its own copy,
+   * made after pinning so it lands on the worker's node.
+   *
+   * Reported per step: aggregate MB/s of input, per thread MB/s at
+   * the slowest, median and fastest, round latency percentiles, and
+   * the time both directions spend in zlib's allocator, through the
+   * compress_settings zalloc hook. Latencies go to a histogram sized
+   * before the clock starts, nothing is allocated while timing.
+   */
+  class scaling_harness {
   public:
 
-    parallel_mangler();
-    void exec();
+    enum pinning { unpinned, compact, spread };
+    enum codec { adapter, frames };
+
+    scaling_harness(double seconds, unsigned threads, pinning pin, bool copies, codec c);
+    bool exec();
 
   private:
 
-    typedef std::vector<std::thread>  threads_t;
+    typedef std::chrono::steady_clock clock;
+    typedef std::vector<int> cpus_t;
 
-    std::string  contents;
-    threads_t    threads;
+    /// allocator time, one per worker, the zalloc hook's opaque
+    struct allocations {
+      allocations() : calls(0), ns(0) {}
+      uint64_t  calls;
+      uint64_t  ns;
+    };
 
+    /// 64 buckets an octave of nanoseconds, within 1.6% of the value
+    struct histogram {
+      static const unsigned sub = 64;
+      histogram() : counts(sub * 59, 0), total(0) {}
+      void add(uint64_t ns);
+      void merge(const histogram& other);
+      uint64_t percentile(double p) const;
+      static uint64_t lower(size_t bucket);
+      std::vector<uint64_t>  counts;
+      uint64_t               total;
+    };
+
+    struct worker {
+      worker() : rounds(0), bytes(0), failed(0), ns(0) {}
+      uint64_t               rounds;
+      uint64_t               bytes;
+      uint64_t               failed;
+      uint64_t               ns;
+      histogram              latencies;
+      allocations            allocs;
+      std::string            error;
+    };
+
+    static voidpf timed_alloc(voidpf opaque, uInt items, uInt size);
+    static void timed_free(voidpf opaque, voidpf address);
+    static bool parse_cpus(const std::string& list, cpus_t& out);
+
+    void topology();
+    bool pin(unsigned index) const;
+    void work(unsigned index, worker& w);
+    void step(unsigned threads);
+
+    std::string          contents_;
+    double               seconds_;
+    unsigned             threads_;
+    pinning              pin_;
+    bool                 copies_;
+    codec                codec_;
+    std::vector<cpus_t>  nodes_;
+    cpus_t               order_;
+    std::atomic<bool>    go_;
+    std::atomic<bool>    stop_;
+    std::atomic<unsigned> ready_;
   };
 
-  parallel_mangler::
-  parallel_mangler() {
+  scaling_harness::
+  scaling_harness(double seconds,
+                  unsigned threads,
+                  pinning pin,
+                  bool copies,
+                  codec c) :
+    seconds_(seconds),
+    threads_(threads),
+    pin_(pin),
+    copies_(copies),
+    codec_(c),
+    go_(false),
+    stop_(false),
+    ready_(0) {
 
     /// load binary file
     std::ifstream ifs("./libstuff");
     std::ostringstream oss;
     oss << ifs.rdbuf();
     ifs.close();
-    contents = oss.str();
-
+    contents_ = oss.str();
+    topology();
   }
 
-  void
-  parallel_mangler::
-  exec() {
+  bool
+  scaling_harness::
+  parse_cpus(const std::string& list,
+             cpus_t& out) {
 
-    using namespace mangle;
+    /// the kernel's list format, e.g. "0-3,8-11", for cpus and nodes
+    std::istringstream iss(list);
+    std::string range;
+    while (std::getline(iss, range, ',')) {
+      if (range.empty()) {
+        continue;
+      }
+      std::string::size_type dash = range.find('-');
+      int first = ::atoi(range.c_str());
+      int last = dash == std::string::npos ? first : ::atoi(range.c_str() + dash + 1);
+      if (last < first) {
+        return false;
+      }
+      for (int c = first; c <= last; ++c) {
+        out.push_back(c);
+      }
+    }
+    return ! out.empty();
+  }
 
-    /// launch 10 threads - each compress, uncompress and compare
-    for (int i = 0; i < 10; ++i) {
-      std::thread t([this]() {
+  void
+  scaling_harness::
+  topology() {
 
-        support::error_code err;
-        mangle::bytes output;
-        std::string uncomp;
+    /// only cpus this process may run on count
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool masked = ::sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
 
-        if (! zlib_adapter::compress(err, output, contents)) {
-          std::cout << "Failed to compress: "
-                    << err
-                    << std::endl;
+    /// node numbers may have holes, the online list has them all
+    std::string list;
+    cpus_t online;
+    std::ifstream nodes("/sys/devices/system/node/online");
+    std::getline(nodes, list);
+    parse_cpus(list, online);
+    for (size_t n = 0; n < online.size(); ++n) {
+      std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(online[n]) + "/cpulist");
+      list.clear();
+      std::getline(ifs, list);
+      cpus_t cpus, usable;
+      parse_cpus(list, cpus);
+      for (size_t i = 0; i < cpus.size(); ++i) {
+        if (! masked || CPU_ISSET(cpus[i], &allowed)) {
+          usable.push_back(cpus[i]);
         }
-        else if (! zlib_adapter::uncompress(err, uncomp, output)) {
-          std::cout << "Failed to uncompress: "
-                    << err
-                    << std::endl;
+      }
+      if (! usable.empty()) {
+        nodes_.push_back(usable);
+      }
+    }
+    if (nodes_.empty()) {
+      cpus_t all;
+      for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (masked ? CPU_ISSET(c, &allowed) : c < (int) std::thread::hardware_concurrency()) {
+          all.push_back(c);
         }
-        else if (contents != uncomp) {
-          std::cout << "Results don't match. Contents: "
-                    << contents
-                    << ". Output: "
-                    << uncomp
-                    << std::endl;
+      }
+      if (! all.empty()) {
+        nodes_.push_back(all);
+      }
+    }
+    for (size_t n = 0; n < nodes_.size(); ++n) {
+      order_.insert(order_.end(), nodes_[n].begin(), nodes_[n].end());
+    }
+  }
+
+  bool
+  scaling_harness::
+  pin(unsigned index) const {
+
+    /// no cpu list to pin to, the thread runs where the kernel puts it
+    if (order_.empty()) {
+      return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pin_ == compact) {
+      CPU_SET(order_[index % order_.size()], &set);
+    }
+    else {
+      const cpus_t& node = nodes_[index % nodes_.size()];
+      for (size_t i = 0; i < node.size(); ++i) {
+        CPU_SET(node[i], &set);
+      }
+    }
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+  }
+
+  voidpf
+  scaling_harness::
+  timed_alloc(voidpf opaque,
+              uInt items,
+              uInt size) {
+
+    allocations* a = (allocations*) opaque;
+    clock::time_point start = clock::now();
+    voidpf p = ::calloc(items, size);
+    a->ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    ++a->calls;
+    return p;
+  }
+
+  void
+  scaling_harness::
+  timed_free(voidpf opaque,
+             voidpf address) {
+
+    allocations* a = (allocations*) opaque;
+    clock::time_point start = clock::now();
+    ::free(address);
+    a->ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    ++a->calls;
+  }
+
+  void
+  scaling_harness::
+  work(unsigned index,
+       worker& w) {
+
+    if (pin_ != unpinned && ! pin(index)) {
+      w.error = "Failed to pin thread " + std::to_string(index);
+    }
+    /// a private copy is first touched here, after pinning
+    std::string own;
+    if (copies_) {
+      own.assign(contents_.begin(), contents_.end());
+    }
+    const std::string& contents = copies_ ? own : contents_;
+
+    mangle::compress_settings settings;
+    settings.zalloc = &scaling_harness::timed_alloc;
+    settings.zfree = &scaling_harness::timed_free;
+    settings.opaque = &w.allocs;
+    support::error_code err;
+    mangle::bytes output;
+    std::string uncomp;
+
+    ++ready_;
+    while (! go_) {
+      std::this_thread::yield();
+    }
+    clock::time_point begin = clock::now();
+    while (! stop_) {
+
+      clock::time_point start = clock::now();
+      output.clear();
+      uncomp.clear();
+
+      /// zlib checks its adler32 as it inflates, the frame its crcs,
+      /// neither needs the whole binary compared
+      bool result = false;
+      if (codec_ == adapter) {
+        result = mangle::zlib_adapter::compress(err, output, contents, settings) &&
+                 mangle::zlib_adapter::uncompress(err, uncomp, output.data(), output.size(), settings);
+        if (result && uncomp.size() != contents.size()) {
+          support::error_code::attach_or_create(err, -1, "Round trip changed the size");
+          result = false;
         }
-        else {
-          std::cout << "really..." << std::endl;
+      }
+      else {
+        result = mangle::frame::compress(err, output, contents, settings) &&
+                 mangle::frame::verify(err, &output[0], output.size()) &&
+                 mangle::frame::uncompress(err, uncomp, &output[0], output.size());
+      }
+      clock::time_point end = clock::now();
+      if (! result) {
+        if (! w.failed++) {
+          std::ostringstream oss;
+          oss << err;
+          w.error = oss.str();
         }
-      });
-      threads.push_back(std::move(t));
+        err = support::error_code();
+        continue;
+      }
+      w.latencies.add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+      w.bytes += contents.size();
+      ++w.rounds;
+    }
+    w.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count();
+  }
+
+  void
+  scaling_harness::histogram::
+  add(uint64_t ns) {
+
+    /// exact below 64, then the top seven bits pick the bucket
+    size_t bucket = ns;
+    if (ns >= sub) {
+      unsigned shift = 63 - __builtin_clzll(ns) - 6;
+      bucket = (shift + 1) * sub + ((ns >> shift) - sub);
+    }
+    ++counts[bucket];
+    ++total;
+  }
+
+  void
+  scaling_harness::histogram::
+  merge(const histogram& other) {
+    for (size_t i = 0; i < counts.size(); ++i) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+  }
+
+  uint64_t
+  scaling_harness::histogram::
+  lower(size_t bucket) {
+    if (bucket < sub) {
+      return bucket;
+    }
+    return uint64_t(bucket % sub + sub) << (bucket / sub - 1);
+  }
+
+  uint64_t
+  scaling_harness::histogram::
+  percentile(double p) const {
+
+    if (! total) {
+      return 0;
+    }
+    uint64_t rank = (uint64_t) (p * (total - 1) + 0.5) + 1;
+    uint64_t seen = 0;
+    size_t last = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+      if (! counts[i]) {
+        continue;
+      }
+      seen += counts[i];
+      last = i;
+      if (seen >= rank) {
+        break;
+      }
+    }
+    return lower(last);
+  }
+
+  void
+  scaling_harness::
+  step(unsigned threads) {
+
+    std::vector<worker> workers(threads);
+    std::vector<std::thread> running;
+    go_ = false;
+    stop_ = false;
+    ready_ = 0;
+    for (unsigned i = 0; i < threads; ++i) {
+      running.push_back(std::thread(&scaling_harness::work, this, i, std::ref(workers[i])));
+    }
+    /// released together once all are set up, stopped together
+    while (ready_ < threads) {
+      std::this_thread::yield();
+    }
+    clock::time_point start = clock::now();
+    go_ = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds_));
+    stop_ = true;
+    for (size_t i = 0; i < running.size(); ++i) {
+      running[i].join();
+    }
+    double wall = std::chrono::duration<double>(clock::now() - start).count();
+
+    uint64_t bytes = 0, rounds = 0, failed = 0, alloc_calls = 0, alloc_ns = 0, busy_ns = 0;
+    std::vector<double> rates;
+    histogram latencies;
+    for (size_t i = 0; i < workers.size(); ++i) {
+      const worker& w = workers[i];
+      bytes += w.bytes;
+      rounds += w.rounds;
+      failed += w.failed;
+      alloc_calls += w.allocs.calls;
+      alloc_ns += w.allocs.ns;
+      busy_ns += w.ns;
+      rates.push_back(w.ns ? w.bytes / (w.ns / 1e9) / (1 << 20) : 0);
+      latencies.merge(w.latencies);
+      if (! w.error.empty()) {
+        std::cout << "  thread " << i << ": " << w.error << std::endl;
+      }
+    }
+    std::sort(rates.begin(), rates.end());
+
+    std::cout << std::setw(8) << threads
+              << std::setw(9) << rounds
+              << std::setw(7) << failed
+              << std::setw(11) << bytes / wall / (1 << 20)
+              << std::setw(9) << rates.front()
+              << std::setw(9) << rates[rates.size() / 2]
+              << std::setw(9) << rates.back()
+              << std::setw(9) << latencies.percentile(0.5) / 1e6
+              << std::setw(9) << latencies.percentile(0.99) / 1e6
+              << std::setw(9) << latencies.percentile(0.999) / 1e6
+              << std::setw(9) << latencies.percentile(1) / 1e6
+              << std::setw(9) << (rounds ? alloc_calls / rounds : 0)
+              << std::setw(8) << (busy_ns ? 100.0 * alloc_ns / busy_ns : 0)
+              << std::endl;
+  }
+
+  bool
+  scaling_harness::
+  exec() {
+
+    if (contents_.empty()) {
+      std::cout << "Nothing to compress, ./libstuff is missing or empty" << std::endl;
+      return false;
+    }
+    const char* pins[] = { "unpinned", "compact", "spread" };
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << (codec_ == adapter ? "zlib_adapter compress, uncompress " : "frame compress, verify, uncompress ")
+              << contents_.size() << " bytes, "
+              << seconds_ << " s a step, " << pins[pin_] << ", "
+              << (copies_ ? "an input per thread" : "one shared input") << ", "
+              << order_.size() << " cpus on " << nodes_.size() << " nodes" << std::endl;
+    std::cout << std::setw(8) << "threads"
+              << std::setw(9) << "rounds"
+              << std::setw(7) << "failed"
+              << std::setw(11) << "MB/s"
+              << std::setw(9) << "min"
+              << std::setw(9) << "median"
+              << std::setw(9) << "max"
+              << std::setw(9) << "p50 ms"
+              << std::setw(9) << "p99 ms"
+              << std::setw(9) << "p99.9 ms"
+              << std::setw(9) << "max ms"
+              << std::setw(9) << "allocs"
+              << std::setw(8) << "alloc%" << std::endl;
+
+    /// powers of two, and the top count if it isn't one
+    for (unsigned t = 1; t < threads_; t <<= 1) {
+      step(t);
     }
-    /// wait for them
-    for (auto& t : threads)
-      t.join();
+    step(threads_);
+    return true;
   }
 }
 
-int main() {
-  test::parallel_mangler pm;
-  pm.exec();
+int main(int argc, char* argv[]) {
+
+  /// [seconds a step] [max threads] [unpinned|compact|spread] [shared|copy] [adapter|frame]
+  double seconds = argc > 1 ? ::atof(argv[1]) : 2;
+  unsigned threads = argc > 2 ? ::atoi(argv[2]) : std::thread::hardware_concurrency();
+  std::string pin = argc > 3 ? argv[3] : "unpinned";
+  std::string input = argc > 4 ? argv[4] : "shared";
+  std::string codec = argc > 5 ? argv[5] : "adapter";
+
+  test::scaling_harness::pinning p = test::scaling_harness::unpinned;
+  if (pin == "compact") {
+    p = test::scaling_harness::compact;
+  }
+  else if (pin == "spread") {
+    p = test::scaling_harness::spread;
+  }
+  test::scaling_harness sh(seconds, threads ? threads : 1, p, input == "copy",
+                           codec == "frame" ? test::scaling_harness::frames : test::scaling_harness::adapter);
+  return sh.exec() ? 0 : 1;
 }
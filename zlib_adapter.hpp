@@ -8,11 +8,44 @@
 #include <sstream>
 #include <iostream>
 #include <error_code.hpp>
+#include "alloc_stats.hpp"
 
 namespace mangle {
 
   typedef std::vector<unsigned char> bytes;
 
+  /**
+   * Class: Compress Settings
+   *
+   * The deflateInit2 knobs. The defaults are what compress() always
+   * used. zalloc, zfree and opaque are handed to zlib as they are,
+   * Z_NULL for malloc and free, by uncompress() too.
+   */
+  struct compress_settings {
+
+    compress_settings() :
+      level(Z_BEST_COMPRESSION),
+      strategy(Z_DEFAULT_STRATEGY),
+      mem_level(8),
+      zalloc(Z_NULL),
+      zfree(Z_NULL),
+      opaque(Z_NULL)
+    {}
+
+    int         level;
+    int         strategy;
+    int         mem_level;
+    alloc_func  zalloc;
+    free_func   zfree;
+    voidpf      opaque;
+  };
+
+  /// zalloc and zfree that go through support::alloc_stats, charging
+  /// the alloc_counter passed as opaque, or the current alloc_scope
+  /// when opaque is Z_NULL
+  voidpf counting_zalloc(voidpf opaque, uInt items, uInt size);
+  void counting_zfree(voidpf opaque, voidpf address);
+
   /**
    * Class: Zlib Adapter
    *
@@ -27,11 +60,44 @@ namespace mangle {
                          bytes& out,
                          const std::string& in);
 
+    static bool compress(support::error_code& err,
+                         bytes& out,
+                         const std::string& in,
+                         const compress_settings& settings);
+
     static bool uncompress(support::error_code& err,
                            std::string& out,
                            const bytes& in);
+
+    /// from a caller's buffer, e.g. a pooled read buffer
+    static bool uncompress(support::error_code& err,
+                           std::string& out,
+                           const unsigned char* in,
+                           size_t size);
+
+    /// only the allocator of the settings applies
+    static bool uncompress(support::error_code& err,
+                           std::string& out,
+                           const unsigned char* in,
+                           size_t size,
+                           const compress_settings& settings);
   };
 
+  inline voidpf
+  counting_zalloc(voidpf opaque,
+                  uInt items,
+                  uInt size) {
+    support::alloc_counter* owner = opaque ? (support::alloc_counter*) opaque
+                                           : support::alloc_scope::current();
+    return support::alloc_stats::allocate((size_t) items * size, owner);
+  }
+
+  inline void
+  counting_zfree(voidpf opaque,
+                 voidpf address) {
+    support::alloc_stats::deallocate(address);
+  }
+
   /**
    * Compress
    */
@@ -40,20 +106,29 @@ namespace mangle {
   compress(support::error_code& err,
            bytes& out,
            const std::string& in) {
+    return compress(err, out, in, compress_settings());
+  }
+
+  inline bool
+  zlib_adapter::
+  compress(support::error_code& err,
+           bytes& out,
+           const std::string& in,
+           const compress_settings& settings) {
 
     /// local vars, buffers..
     int ret = 0;
     z_stream strm;
-    unsigned char input[chunk_size] = {0};
     unsigned char output[chunk_size] = {0};
 
     /// init zlib structure
-    strm.zalloc = Z_NULL;
-    strm.zfree  = Z_NULL;
-    strm.opaque = Z_NULL;
+    strm.zalloc = settings.zalloc;
+    strm.zfree  = settings.zfree;
+    strm.opaque = settings.opaque;
 
     /// init zlib deflater
-    ret = deflateInit(&strm, Z_BEST_COMPRESSION);
+    ret = deflateInit2(&strm, settings.level, Z_DEFLATED, MAX_WBITS,
+                       settings.mem_level, settings.strategy);
     if (ret != Z_OK) {
       std::ostringstream oss;
       oss << "Failed to initialize zlib for compression: " << ret;
@@ -101,6 +176,25 @@ namespace mangle {
   uncompress(support::error_code& err,
              std::string& out,
              const bytes& in) {
+    return uncompress(err, out, in.data(), in.size());
+  }
+
+  inline bool
+  zlib_adapter::
+  uncompress(support::error_code& err,
+             std::string& out,
+             const unsigned char* in,
+             size_t size) {
+    return uncompress(err, out, in, size, compress_settings());
+  }
+
+  inline bool
+  zlib_adapter::
+  uncompress(support::error_code& err,
+             std::string& out,
+             const unsigned char* in,
+             size_t size,
+             const compress_settings& settings) {
 
     /// local vars, buffers..
     int ret = 0;
@@ -108,13 +202,13 @@ namespace mangle {
     unsigned char output[chunk_size] = {0};
 
     /// init zlib structure
-    strm.zalloc = Z_NULL;
-    strm.zfree  = Z_NULL;
-    strm.opaque = Z_NULL;
+    strm.zalloc = settings.zalloc;
+    strm.zfree  = settings.zfree;
+    strm.opaque = settings.opaque;
  
     /// set input to supplied bytes, we compress all in one shot
-    strm.avail_in = in.size();
-    strm.next_in  = (unsigned char *) &in[0];
+    strm.avail_in = size;
+    strm.next_in  = (unsigned char *) in;
 
     /// init zlib deflater
     ret = inflateInit(&strm);
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <error_code.hpp>
+#include "zlib_adapter.hpp"
+
+namespace mangle {
+
+  /**
+   * Class: Adaptive Compressor
+   *
+   * Picks the deflate settings to meet a budget instead of always
+   * paying for Z_BEST_COMPRESSION. The budget is a throughput in MB/s
+   * or a latency per call. The compressor times each call and steps
+   * the level down when it is over budget and back up when there is
+   * room, at most once per 'window' calls so one odd message does not
+   * swing it.
+   *
+   * Every 'sample_every' calls the head of the input is compressed at
+   * level 1 to see what kind of data it is:
+   *   - barely compressible: Z_HUFFMAN_ONLY, matching would be wasted
+   *   - long runs: Z_RLE
+   *   - binary, small deltas: Z_FILTERED
+   *   - anything else: Z_DEFAULT_STRATEGY
+   * memLevel follows the typical input size.
+   *
+   * One deflater is kept and re-tuned with deflateParams, only a new
+   * memLevel re-initializes it. Not thread safe, one per thread.
+   */
+  class adaptive_compressor {
+  public:
+
+    enum target {
+      throughput,
+      latency
+    };
+
+    /// what it did, for the metrics feed
+    struct counters {
+      counters();
+      uint64_t  calls;
+      uint64_t  bytes_in;
+      uint64_t  bytes_out;
+      uint64_t  nanos;
+      uint64_t  samples;
+      uint64_t  raised;
+      uint64_t  lowered;
+      uint64_t  strategy_changes;
+      uint64_t  reinits;
+      uint64_t  per_level[10];
+      uint64_t  per_strategy[5];
+    };
+
+    static const size_t sample_size = 4096;
+    static const unsigned sample_every = 64;
+    static const unsigned window = 16;
+
+    /// MB/s for throughput, microseconds per call for latency
+    adaptive_compressor(target t, double budget);
+    ~adaptive_compressor();
+
+    bool compress(support::error_code& err, bytes& out, const std::string& in);
+
+    const compress_settings& settings() const;
+    const counters& stats() const;
+
+  private:
+
+    adaptive_compressor(const adaptive_compressor&);
+    adaptive_compressor& operator=(const adaptive_compressor&);
+
+    void sample(const std::string& in);
+    void adjust();
+    bool prepare(support::error_code& err);
+
+    target             target_;
+    double             budget_;
+    compress_settings  settings_;
+    counters           counters_;
+    z_stream           strm_;
+    bool               ready_;
+    int                ready_mem_level_;
+
+    /// per window
+    unsigned           calls_;
+    uint64_t           bytes_;
+    uint64_t           nanos_;
+    double             typical_size_;
+  };
+
+  inline
+  adaptive_compressor::counters::
+  counters() :
+    calls(0),
+    bytes_in(0),
+    bytes_out(0),
+    nanos(0),
+    samples(0),
+    raised(0),
+    lowered(0),
+    strategy_changes(0),
+    reinits(0) {
+    ::memset(per_level, 0, sizeof(per_level));
+    ::memset(per_strategy, 0, sizeof(per_strategy));
+  }
+
+  inline
+  adaptive_compressor::
+  adaptive_compressor(target t,
+                      double budget) :
+    target_(t),
+    budget_(budget),
+    ready_(false),
+    ready_mem_level_(0),
+    calls_(0),
+    bytes_(0),
+    nanos_(0),
+    typical_size_(0) {
+
+    /// start in the middle and let the timings move it
+    settings_.level = 6;
+    ::memset(&strm_, 0, sizeof(strm_));
+  }
+
+  inline
+  adaptive_compressor::
+  ~adaptive_compressor() {
+    if (ready_) {
+      deflateEnd(&strm_);
+    }
+  }
+
+  inline const compress_settings&
+  adaptive_compressor::
+  settings() const {
+    return settings_;
+  }
+
+  inline const adaptive_compressor::counters&
+  adaptive_compressor::
+  stats() const {
+    return counters_;
+  }
+
+  inline void
+  adaptive_compressor::
+  sample(const std::string& in) {
+
+    ++counters_.samples;
+    size_t n = in.size() < sample_size ? in.size() : sample_size;
+    if (n < 64) {
+      return;
+    }
+
+    /// how much level 1 gets out of the head of the input
+    unsigned char out[sample_size + 64];
+    z_stream strm;
+    ::memset(&strm, 0, sizeof(strm));
+    if (deflateInit(&strm, 1) != Z_OK) {
+      return;
+    }
+    strm.next_in = (unsigned char*) in.data();
+    strm.avail_in = n;
+    strm.next_out = out;
+    strm.avail_out = sizeof(out);
+    deflate(&strm, Z_FINISH);
+    double ratio = double(n) / (sizeof(out) - strm.avail_out);
+    deflateEnd(&strm);
+
+    size_t runs = 0;
+    size_t binary = 0;
+    for (size_t i = 0; i < n; ++i) {
+      unsigned char c = in[i];
+      runs += i > 0 && c == (unsigned char) in[i - 1];
+      binary += c < 9 || (c > 13 && c < 32) || c > 126;
+    }
+
+    int strategy = Z_DEFAULT_STRATEGY;
+    if (ratio < 1.1) {
+      strategy = Z_HUFFMAN_ONLY;
+    }
+    else if (runs * 2 > n) {
+      strategy = Z_RLE;
+    }
+    else if (binary * 4 > n && ratio < 2) {
+      strategy = Z_FILTERED;
+    }
+    if (strategy != settings_.strategy) {
+      settings_.strategy = strategy;
+      ++counters_.strategy_changes;
+    }
+  }
+
+  inline void
+  adaptive_compressor::
+  adjust() {
+
+    /// over budget by 10% steps down, under by 30% steps up
+    double seconds = nanos_ / 1e9;
+    bool slow = false;
+    bool fast = false;
+    if (target_ == throughput) {
+      double speed = bytes_ / seconds / 1e6;
+      slow = speed < budget_ * 0.9;
+      fast = speed > budget_ * 1.3;
+    }
+    else {
+      double micros = nanos_ / 1e3 / calls_;
+      slow = micros > budget_ * 1.1;
+      fast = micros < budget_ * 0.7;
+    }
+    if (slow && settings_.level > 1) {
+      --settings_.level;
+      ++counters_.lowered;
+    }
+    else if (fast && settings_.level < 9) {
+      ++settings_.level;
+      ++counters_.raised;
+    }
+
+    /// a bigger hash for big inputs, a smaller one to init fast for small
+    double size = double(bytes_) / calls_;
+    typical_size_ = typical_size_ ? (typical_size_ + size) / 2 : size;
+    settings_.mem_level = typical_size_ < 4096 ? 6 : typical_size_ > 256 * 1024 ? 9 : 8;
+
+    calls_ = 0;
+    bytes_ = 0;
+    nanos_ = 0;
+  }
+
+  inline bool
+  adaptive_compressor::
+  prepare(support::error_code& err) {
+
+    if (ready_ && ready_mem_level_ != settings_.mem_level) {
+      deflateEnd(&strm_);
+      ready_ = false;
+      ++counters_.reinits;
+    }
+    int ret = Z_OK;
+    if (! ready_) {
+      ::memset(&strm_, 0, sizeof(strm_));
+      ret = deflateInit2(&strm_, settings_.level, Z_DEFLATED, MAX_WBITS,
+                         settings_.mem_level, settings_.strategy);
+      ready_ = ret == Z_OK;
+      ready_mem_level_ = settings_.mem_level;
+    }
+    else {
+      /// nothing pending after a reset, so the new params apply at once
+      ret = deflateReset(&strm_);
+      if (ret == Z_OK) {
+        ret = deflateParams(&strm_, settings_.level, settings_.strategy);
+      }
+    }
+    if (ret != Z_OK) {
+      std::ostringstream oss;
+      oss << "Failed to initialize zlib for compression: " << ret;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      return false;
+    }
+    return true;
+  }
+
+  inline bool
+  adaptive_compressor::
+  compress(support::error_code& err,
+           bytes& out,
+           const std::string& in) {
+
+    if (counters_.calls % sample_every == 0) {
+      sample(in);
+    }
+    /// the sample's own level 1 deflate is not this level's cost
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (! prepare(err)) {
+      return false;
+    }
+
+    /// one shot, the bound always fits
+    out.resize(deflateBound(&strm_, in.size()));
+    strm_.next_in = (unsigned char*) in.data();
+    strm_.avail_in = in.size();
+    strm_.next_out = out.empty() ? 0 : &out[0];
+    strm_.avail_out = out.size();
+    int ret = deflate(&strm_, Z_FINISH);
+    if (ret != Z_STREAM_END) {
+      std::ostringstream oss;
+      oss << "Failed to deflate: " << ret;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      deflateEnd(&strm_);
+      ready_ = false;
+      return false;
+    }
+    out.resize(out.size() - strm_.avail_out);
+
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    ++counters_.calls;
+    counters_.bytes_in += in.size();
+    counters_.bytes_out += out.size();
+    counters_.nanos += nanos;
+    ++counters_.per_level[settings_.level];
+    ++counters_.per_strategy[settings_.strategy];
+
+    ++calls_;
+    bytes_ += in.size();
+    nanos_ += nanos;
+    if (calls_ == window) {
+      adjust();
+    }
+    return true;
+  }
+
+}
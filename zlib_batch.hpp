@@ -0,0 +1,368 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <error_code.hpp>
+#include "zlib_adapter.hpp"
+#include "zlib_frame.hpp"
+
+namespace mangle {
+
+  /**
+   * Class: Batch Writer
+   *
+   * Compresses a sequence of messages into one raw deflate stream, so a
+   * small message is compressed against the ones before it instead of
+   * a cold window. Each message ends on a sync flush, which byte aligns
+   * it, and every 'restart' messages a full flush forgets the window,
+   * leaving a point extraction can start from. Smaller restart, cheaper
+   * extraction, worse ratio.
+   *
+   * The deflater is kept from batch to batch, finish() resets it.
+   *
+   * Layout, little endian:
+   *   magic "ZBAT", version, count, restart   4 x uint32
+   *   per message: raw size, deflated size    2 x uint32
+   *   the deflate stream
+   */
+  class batch_writer {
+  public:
+
+    static const uint32_t magic = 0x5441425a;  /// "ZBAT"
+    static const uint32_t version = 1;
+
+    explicit batch_writer(int level = Z_DEFAULT_COMPRESSION,
+                          uint32_t restart = 64);
+    ~batch_writer();
+
+    bool add(support::error_code& err, const std::string& message);
+    bool add(support::error_code& err, const char* message, size_t size);
+
+    /// the framed batch into out, then starts the next batch
+    bool finish(support::error_code& err, bytes& out);
+
+    size_t size() const;
+
+  private:
+
+    batch_writer(const batch_writer&);
+    batch_writer& operator=(const batch_writer&);
+
+    bool deflate(support::error_code& err, const char* in, size_t size, int flush);
+
+    z_stream               strm_;
+    bool                   ready_;
+    int                    level_;
+    uint32_t               restart_;
+    std::vector<uint32_t>  frames_;
+    bytes                  stream_;
+  };
+
+  /**
+   * Class: Batch View
+   *
+   * Reads a batch in place, the buffer must outlive the view. A message
+   * is inflated from the restart point before it, skipping the output
+   * of the messages in between.
+   */
+  class batch_view {
+  public:
+
+    batch_view();
+
+    bool open(support::error_code& err, const unsigned char* in, size_t size);
+
+    size_t size() const;
+    size_t raw_size(size_t i) const;
+
+    /// message i into out
+    bool extract(support::error_code& err, size_t i, std::string& out) const;
+
+    /// every message, in one pass
+    bool extract_all(support::error_code& err, std::vector<std::string>& out) const;
+
+  private:
+
+    /// inflates messages [first, last], keeps only those from 'keep' on
+    bool inflate(support::error_code& err, size_t first, size_t last,
+                 size_t keep, std::vector<std::string>& out) const;
+
+    /// a little endian uint32 of the layout
+    static uint32_t field(const unsigned char* at);
+
+    const unsigned char*   stream_;
+    uint32_t               count_;
+    uint32_t               restart_;
+    std::vector<uint32_t>  raw_;
+    std::vector<uint64_t>  offsets_;
+  };
+
+  inline
+  batch_writer::
+  batch_writer(int level,
+               uint32_t restart) :
+    ready_(false),
+    level_(level),
+    restart_(restart ? restart : 1) {
+    ::memset(&strm_, 0, sizeof(strm_));
+  }
+
+  inline
+  batch_writer::
+  ~batch_writer() {
+    if (ready_) {
+      deflateEnd(&strm_);
+    }
+  }
+
+  inline size_t
+  batch_writer::
+  size() const {
+    return frames_.size() / 2;
+  }
+
+  inline bool
+  batch_writer::
+  deflate(support::error_code& err,
+          const char* in,
+          size_t size,
+          int flush) {
+
+    strm_.next_in = (unsigned char*) in;
+    strm_.avail_in = size;
+    do {
+      /// straight into the stream, grown ahead of each step
+      size_t used = stream_.size();
+      size_t room = deflateBound(&strm_, strm_.avail_in) + 16;
+      stream_.resize(used + room);
+      strm_.next_out = &stream_[used];
+      strm_.avail_out = room;
+      int ret = ::deflate(&strm_, flush);
+      stream_.resize(used + room - strm_.avail_out);
+      if (ret == Z_STREAM_ERROR) {
+        std::ostringstream oss;
+        oss << "Failed to deflate message: " << ret;
+        support::error_code::attach_or_create(err, -1, oss.str());
+        return false;
+      }
+    }
+    while (strm_.avail_out == 0 || strm_.avail_in > 0);
+    return true;
+  }
+
+  inline bool
+  batch_writer::
+  add(support::error_code& err,
+      const std::string& message) {
+    return add(err, message.data(), message.size());
+  }
+
+  inline bool
+  batch_writer::
+  add(support::error_code& err,
+      const char* message,
+      size_t size) {
+
+    if (! ready_) {
+      /// raw deflate, the frame index stands in for the zlib wrapper
+      int ret = deflateInit2(&strm_, level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+      if (ret != Z_OK) {
+        std::ostringstream oss;
+        oss << "Failed to initialize zlib for compression: " << ret;
+        support::error_code::attach_or_create(err, -1, oss.str());
+        return false;
+      }
+      ready_ = true;
+    }
+    /// both sizes go into the index as uint32
+    if (size > UINT32_MAX || deflateBound(&strm_, size) > UINT32_MAX) {
+      support::error_code::attach_or_create(err, -1, "Message too large for a batch");
+      return false;
+    }
+    size_t before = stream_.size();
+    bool restart = (frames_.size() / 2 + 1) % restart_ == 0;
+    if (! deflate(err, message, size, restart ? Z_FULL_FLUSH : Z_SYNC_FLUSH)) {
+      return false;
+    }
+    frames_.push_back(size);
+    frames_.push_back(stream_.size() - before);
+    return true;
+  }
+
+  inline bool
+  batch_writer::
+  finish(support::error_code& err,
+         bytes& out) {
+
+    uint32_t head[] = { magic, version, (uint32_t) size(), restart_ };
+    out.clear();
+    out.reserve(sizeof(head) + frames_.size() * sizeof(uint32_t) + stream_.size());
+    for (size_t i = 0; i < 4 + frames_.size(); ++i) {
+
+      /// little endian whatever the host
+      uint32_t value = i < 4 ? head[i] : frames_[i - 4];
+      for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back((unsigned char) (value >> shift));
+      }
+    }
+    out.insert(out.end(), stream_.begin(), stream_.end());
+
+    frames_.clear();
+    stream_.clear();
+    if (ready_ && deflateReset(&strm_) != Z_OK) {
+      deflateEnd(&strm_);
+      ready_ = false;
+    }
+    return true;
+  }
+
+  inline
+  batch_view::
+  batch_view() :
+    stream_(0),
+    count_(0),
+    restart_(1)
+  {}
+
+  inline size_t
+  batch_view::
+  size() const {
+    return count_;
+  }
+
+  inline size_t
+  batch_view::
+  raw_size(size_t i) const {
+    return raw_[i];
+  }
+
+  inline bool
+  batch_view::
+  open(support::error_code& err,
+       const unsigned char* in,
+       size_t size) {
+
+    uint32_t head[4];
+    if (size < sizeof(head)) {
+      support::error_code::attach_or_create(err, -1, "Batch truncated");
+      return false;
+    }
+    for (size_t i = 0; i < 4; ++i) {
+      head[i] = field(in + 4 * i);
+    }
+    if (head[0] != batch_writer::magic || head[1] != batch_writer::version || ! head[3]) {
+      support::error_code::attach_or_create(err, -1, "Not a compressed batch");
+      return false;
+    }
+    size_t index = sizeof(head) + size_t(head[2]) * 2 * sizeof(uint32_t);
+    if (size < index) {
+      support::error_code::attach_or_create(err, -1, "Batch truncated");
+      return false;
+    }
+    const unsigned char* frames = in + sizeof(head);
+    raw_.resize(head[2]);
+    offsets_.assign(1, 0);
+    for (size_t i = 0; i < head[2]; ++i) {
+      raw_[i] = field(frames + 8 * i);
+      offsets_.push_back(offsets_.back() + field(frames + 8 * i + 4));
+
+      /// room is made for the raw size before inflating, hold it to
+      /// what the deflated size can hold, as frames do
+      if (raw_[i] / frame::max_ratio > offsets_[i + 1] - offsets_[i]) {
+        support::error_code::attach_or_create(err, -1, "Batch corrupt");
+        return false;
+      }
+    }
+    if (size - index < offsets_.back()) {
+      support::error_code::attach_or_create(err, -1, "Batch truncated");
+      return false;
+    }
+    stream_ = in + index;
+    count_ = head[2];
+    restart_ = head[3];
+    return true;
+  }
+
+  inline uint32_t
+  batch_view::
+  field(const unsigned char* at) {
+    return uint32_t(at[0]) | (uint32_t(at[1]) << 8) | (uint32_t(at[2]) << 16) | (uint32_t(at[3]) << 24);
+  }
+
+  inline bool
+  batch_view::
+  inflate(support::error_code& err,
+          size_t first,
+          size_t last,
+          size_t keep,
+          std::vector<std::string>& out) const {
+
+    z_stream strm;
+    ::memset(&strm, 0, sizeof(strm));
+    int ret = inflateInit2(&strm, -15);
+    if (ret != Z_OK) {
+      std::ostringstream oss;
+      oss << "Failed to initialize zlib for decompression: " << ret;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      return false;
+    }
+    std::string skipped;
+    for (size_t i = first; i <= last; ++i) {
+
+      /// each message ends byte aligned, feed exactly its frame
+      std::string& text = i < keep ? skipped : out[i - keep];
+      text.resize(raw_[i]);
+      strm.next_in = (unsigned char*) stream_ + offsets_[i];
+      strm.avail_in = offsets_[i + 1] - offsets_[i];
+      strm.next_out = (unsigned char*) &text[0];
+      strm.avail_out = raw_[i];
+      do {
+        ret = ::inflate(&strm, Z_SYNC_FLUSH);
+      }
+      while (ret == Z_OK && strm.avail_in > 0);
+
+      if ((ret != Z_OK && ret != Z_BUF_ERROR) || strm.avail_in || strm.avail_out) {
+        std::ostringstream oss;
+        oss << "Failed to inflate message " << i << ": " << ret;
+        support::error_code::attach_or_create(err, -1, oss.str());
+        inflateEnd(&strm);
+        return false;
+      }
+    }
+    inflateEnd(&strm);
+    return true;
+  }
+
+  inline bool
+  batch_view::
+  extract(support::error_code& err,
+          size_t i,
+          std::string& out) const {
+
+    if (i >= count_) {
+      support::error_code::attach_or_create(err, -1, "No such message in batch");
+      return false;
+    }
+    size_t first = i - i % restart_;
+    std::vector<std::string> one(1);
+    if (! inflate(err, first, i, i, one)) {
+      return false;
+    }
+    out.swap(one[0]);
+    return true;
+  }
+
+  inline bool
+  batch_view::
+  extract_all(support::error_code& err,
+              std::vector<std::string>& out) const {
+
+    out.resize(count_);
+    return count_ == 0 || inflate(err, 0, count_ - 1, 0, out);
+  }
+
+}
@@ -0,0 +1,435 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <string>
+#include <sstream>
+#include <error_code.hpp>
+#include "crc32c.hpp"
+#include "zlib_adapter.hpp"
+
+namespace mangle {
+
+  /**
+   * Class: Frame
+   *
+   * A compressed message that checks itself. The header carries the
+   * sizes and two CRC-32Cs, one of the deflated payload, so a frame can
+   * be verified in storage or on the wire without inflating it, and one
+   * of the content, checked as it inflates. The payload is raw deflate,
+   * the content CRC does the job of the zlib adler32 at a fraction of
+   * the cost.
+   *
+   * Header, little endian, 36 bytes:
+   *   magic "ZFRM"   uint32      raw size        uint64
+   *   version        uint16      payload size    uint64
+   *   flags          uint16      payload crc     uint32
+   *                              content crc     uint32
+   *                              header crc      uint32, of the 32 before
+   */
+  class frame {
+  public:
+
+    static const uint32_t magic = 0x4d52465a;  /// "ZFRM"
+    static const uint16_t version = 1;
+    static const size_t header_size = 36;
+
+    /// deflate never does better than this, a header claiming more
+    /// content than its payload can hold is a lie
+    static const uint64_t max_ratio = 1032;
+
+    struct header {
+      uint64_t  raw_size;
+      uint64_t  payload_size;
+      uint32_t  payload_crc;
+      uint32_t  content_crc;
+    };
+
+    static bool compress(support::error_code& err,
+                         bytes& out,
+                         const std::string& in,
+                         const compress_settings& settings = compress_settings());
+
+    /// header and payload crc, nothing is inflated
+    static bool verify(support::error_code& err, const unsigned char* in, size_t size);
+
+    /// a frame of more than 'limit' bytes of content is refused
+    static bool uncompress(support::error_code& err,
+                           std::string& out,
+                           const unsigned char* in,
+                           size_t size,
+                           uint64_t limit = default_limit);
+
+    static const uint64_t default_limit = uint64_t(1) << 30;
+
+    /// reads and checks the header alone
+    static bool parse(support::error_code& err,
+                      const unsigned char* in,
+                      size_t size,
+                      header& h);
+
+  private:
+
+    /// header fields, little endian whatever the host
+    static void put(unsigned char* at, uint64_t value, size_t bytes);
+    static uint64_t get(const unsigned char* at, size_t bytes);
+  };
+
+  /**
+   * Class: Frame Inflater
+   *
+   * Inflates a frame fed in pieces as they arrive, checking both CRCs
+   * on the way, so a bad frame is caught as soon as its end is seen,
+   * without holding all of it. Output goes to the end of the string
+   * passed to feed(), which must be the same string for a whole frame.
+   * Room for the content is made once the header is in, only if its
+   * raw size is within 'limit' and what the payload size can hold.
+   */
+  class frame_inflater {
+  public:
+
+    explicit frame_inflater(uint64_t limit = frame::default_limit);
+    ~frame_inflater();
+
+    bool feed(support::error_code& err,
+              const unsigned char* in,
+              size_t size,
+              std::string& out);
+
+    /// the whole frame arrived and checked out
+    bool done() const;
+
+    /// ready for the next frame
+    void reset();
+
+  private:
+
+    frame_inflater(const frame_inflater&);
+    frame_inflater& operator=(const frame_inflater&);
+
+    bool start(support::error_code& err, std::string& out);
+    bool finish(support::error_code& err);
+
+    unsigned char   head_[frame::header_size];
+    size_t          filled_;
+    frame::header   header_;
+    z_stream        strm_;
+    bool            ready_;
+    bool            ended_;
+    bool            done_;
+    size_t          base_;
+    uint64_t        limit_;
+    uint64_t        consumed_;
+    uint64_t        produced_;
+    uint32_t        payload_crc_;
+    uint32_t        content_crc_;
+  };
+
+  inline bool
+  frame::
+  compress(support::error_code& err,
+           bytes& out,
+           const std::string& in,
+           const compress_settings& settings) {
+
+    z_stream strm;
+    ::memset(&strm, 0, sizeof(strm));
+    strm.zalloc = settings.zalloc;
+    strm.zfree  = settings.zfree;
+    strm.opaque = settings.opaque;
+    int ret = deflateInit2(&strm, settings.level, Z_DEFLATED, -MAX_WBITS,
+                           settings.mem_level, settings.strategy);
+    if (ret != Z_OK) {
+      std::ostringstream oss;
+      oss << "Failed to initialize zlib for compression: " << ret;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      return false;
+    }
+
+    /// one shot into room the bound guarantees
+    out.resize(header_size + deflateBound(&strm, in.size()));
+    strm.next_in = (unsigned char*) in.data();
+    strm.avail_in = in.size();
+    strm.next_out = &out[header_size];
+    strm.avail_out = out.size() - header_size;
+    ret = deflate(&strm, Z_FINISH);
+    deflateEnd(&strm);
+    if (ret != Z_STREAM_END) {
+      std::ostringstream oss;
+      oss << "Failed to deflate frame: " << ret;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      return false;
+    }
+    uint64_t payload = out.size() - header_size - strm.avail_out;
+    out.resize(header_size + payload);
+
+    unsigned char* h = &out[0];
+    put(h, magic, 4);
+    put(h + 4, version, 2);
+    put(h + 6, 0, 2);
+    put(h + 8, in.size(), 8);
+    put(h + 16, payload, 8);
+    put(h + 24, support::crc32c::compute(0, h + header_size, payload), 4);
+    put(h + 28, support::crc32c::compute(0, in.data(), in.size()), 4);
+    put(h + 32, support::crc32c::compute(0, h, 32), 4);
+    return true;
+  }
+
+  inline bool
+  frame::
+  parse(support::error_code& err,
+        const unsigned char* in,
+        size_t size,
+        header& h) {
+
+    if (size < header_size) {
+      support::error_code::attach_or_create(err, -1, "Frame truncated");
+      return false;
+    }
+    if (get(in, 4) != magic || get(in + 4, 2) != version) {
+      support::error_code::attach_or_create(err, -1, "Not a frame");
+      return false;
+    }
+    if (get(in + 32, 4) != support::crc32c::compute(0, in, 32)) {
+      support::error_code::attach_or_create(err, -1, "Frame header checksum mismatch");
+      return false;
+    }
+    h.raw_size = get(in + 8, 8);
+    h.payload_size = get(in + 16, 8);
+    h.payload_crc = get(in + 24, 4);
+    h.content_crc = get(in + 28, 4);
+    return true;
+  }
+
+  inline void
+  frame::
+  put(unsigned char* at,
+      uint64_t value,
+      size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      at[i] = (unsigned char) (value >> (8 * i));
+    }
+  }
+
+  inline uint64_t
+  frame::
+  get(const unsigned char* at,
+      size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      value |= uint64_t(at[i]) << (8 * i);
+    }
+    return value;
+  }
+
+  inline bool
+  frame::
+  verify(support::error_code& err,
+         const unsigned char* in,
+         size_t size) {
+
+    header h;
+    if (! parse(err, in, size, h)) {
+      return false;
+    }
+    if (size - header_size != h.payload_size) {
+      support::error_code::attach_or_create(err, -1, "Frame size mismatch");
+      return false;
+    }
+    if (h.payload_crc != support::crc32c::compute(0, in + header_size, h.payload_size)) {
+      support::error_code::attach_or_create(err, -1, "Frame payload checksum mismatch");
+      return false;
+    }
+    return true;
+  }
+
+  inline bool
+  frame::
+  uncompress(support::error_code& err,
+             std::string& out,
+             const unsigned char* in,
+             size_t size,
+             uint64_t limit) {
+
+    /// the whole frame is here, its payload size can be held to it
+    /// before anything is allocated
+    header h;
+    if (! parse(err, in, size, h)) {
+      return false;
+    }
+    if (size - header_size != h.payload_size) {
+      support::error_code::attach_or_create(err, -1, "Frame size mismatch");
+      return false;
+    }
+    frame_inflater fi(limit);
+    if (! fi.feed(err, in, size, out)) {
+      return false;
+    }
+    if (! fi.done()) {
+      support::error_code::attach_or_create(err, -1, "Frame truncated");
+      return false;
+    }
+    return true;
+  }
+
+  inline
+  frame_inflater::
+  frame_inflater(uint64_t limit) :
+    ready_(false),
+    limit_(limit) {
+    reset();
+  }
+
+  inline
+  frame_inflater::
+  ~frame_inflater() {
+    if (ready_) {
+      inflateEnd(&strm_);
+    }
+  }
+
+  inline void
+  frame_inflater::
+  reset() {
+
+    if (ready_) {
+      inflateEnd(&strm_);
+      ready_ = false;
+    }
+    ::memset(&strm_, 0, sizeof(strm_));
+    filled_ = 0;
+    ended_ = false;
+    done_ = false;
+    base_ = 0;
+    consumed_ = 0;
+    produced_ = 0;
+    payload_crc_ = 0;
+    content_crc_ = 0;
+  }
+
+  inline bool
+  frame_inflater::
+  done() const {
+    return done_;
+  }
+
+  inline bool
+  frame_inflater::
+  start(support::error_code& err,
+        std::string& out) {
+
+    if (! frame::parse(err, head_, filled_, header_)) {
+      return false;
+    }
+    /// the header crc says it arrived intact, not that it is honest
+    if (header_.raw_size > limit_) {
+      std::ostringstream oss;
+      oss << "Frame raw size " << header_.raw_size << " over the limit of " << limit_;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      return false;
+    }
+    if (header_.raw_size / frame::max_ratio > header_.payload_size) {
+      support::error_code::attach_or_create(err, -1, "Frame raw size out of reach of its payload");
+      return false;
+    }
+    int ret = inflateInit2(&strm_, -MAX_WBITS);
+    if (ret != Z_OK) {
+      std::ostringstream oss;
+      oss << "Failed to initialize zlib for decompression: " << ret;
+      support::error_code::attach_or_create(err, -1, oss.str());
+      return false;
+    }
+    ready_ = true;
+
+    /// the size is known, inflate straight into place
+    base_ = out.size();
+    out.resize(base_ + header_.raw_size);
+    return header_.payload_size > 0 || finish(err);
+  }
+
+  inline bool
+  frame_inflater::
+  finish(support::error_code& err) {
+
+    if (! ended_ || produced_ != header_.raw_size) {
+      support::error_code::attach_or_create(err, -1, "Frame payload does not inflate to its size");
+      return false;
+    }
+    if (payload_crc_ != header_.payload_crc) {
+      support::error_code::attach_or_create(err, -1, "Frame payload checksum mismatch");
+      return false;
+    }
+    if (content_crc_ != header_.content_crc) {
+      support::error_code::attach_or_create(err, -1, "Frame content checksum mismatch");
+      return false;
+    }
+    done_ = true;
+    return true;
+  }
+
+  inline bool
+  frame_inflater::
+  feed(support::error_code& err,
+       const unsigned char* in,
+       size_t size,
+       std::string& out) {
+
+    while (size) {
+
+      if (filled_ < frame::header_size) {
+        size_t take = frame::header_size - filled_;
+        take = take < size ? take : size;
+        ::memcpy(head_ + filled_, in, take);
+        filled_ += take;
+        in += take;
+        size -= take;
+        if (filled_ == frame::header_size && ! start(err, out)) {
+          return false;
+        }
+        continue;
+      }
+
+      uint64_t left = header_.payload_size - consumed_;
+      if (done_ || ! left) {
+        support::error_code::attach_or_create(err, -1, "Data past the end of the frame");
+        return false;
+      }
+      size_t take = left < size ? left : size;
+      payload_crc_ = support::crc32c::compute(payload_crc_, in, take);
+
+      unsigned char* next = (unsigned char*) &out[base_ + produced_];
+      strm_.next_in = (unsigned char*) in;
+      strm_.avail_in = take;
+      strm_.next_out = next;
+      strm_.avail_out = header_.raw_size - produced_;
+      int ret = Z_OK;
+      while (strm_.avail_in && ! ended_) {
+        ret = inflate(&strm_, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+          ended_ = true;
+        }
+        else if (ret != Z_OK) {
+          break;
+        }
+      }
+      size_t made = (header_.raw_size - produced_) - strm_.avail_out;
+      content_crc_ = support::crc32c::compute(content_crc_, next, made);
+      produced_ += made;
+      if ((ret != Z_OK && ret != Z_STREAM_END) || strm_.avail_in) {
+        std::ostringstream oss;
+        oss << "Failed to inflate frame: " << ret;
+        support::error_code::attach_or_create(err, -1, oss.str());
+        return false;
+      }
+      consumed_ += take;
+      in += take;
+      size -= take;
+      if (consumed_ == header_.payload_size && ! finish(err)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+}
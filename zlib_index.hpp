@@ -0,0 +1,481 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <zlib.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <error_code.hpp>
+
+namespace mangle {
+
+  /**
+   * Class: Inflate Index
+   *
+   * Access points into one ordinary zlib or gzip stream, so later reads
+   * can inflate it on several cores. The first read is serial: it
+   * inflates the whole stream and, at a deflate block boundary every
+   * 'span' bytes of output, records where the block starts (to the
+   * bit) and the 32K of output before it, the window the next block
+   * may refer back into. From a point, a raw inflate primed with the
+   * leftover bits and the window decodes its segment on its own.
+   *
+   * The index can be saved next to the archive and loaded by later
+   * runs. Parallel output is checked against the stream's own trailer,
+   * so it is the serial output or an error.
+   */
+  class inflate_index {
+  public:
+
+    enum format {
+      zlib,
+      gzip
+    };
+
+    static const size_t window_size = 32768;
+    static const size_t default_span = 1 << 20;
+
+    inflate_index();
+
+    /// the first read, inflates all of 'in' into 'out' and records the points
+    bool build(support::error_code& err,
+               std::string& out,
+               const unsigned char* in,
+               size_t size,
+               size_t span = default_span);
+
+    /// segments on 'threads' threads, 'in' must be the indexed stream
+    bool inflate(support::error_code& err,
+                 std::string& out,
+                 const unsigned char* in,
+                 size_t size,
+                 unsigned threads) const;
+
+    bool save(support::error_code& err, std::string& out) const;
+    bool load(support::error_code& err, const unsigned char* in, size_t size);
+
+    size_t points() const;
+    uint64_t total_in() const;
+    uint64_t total_out() const;
+
+  private:
+
+    static const uint32_t magic = 0x5844495a;  /// "ZIDX"
+    static const uint32_t version = 1;
+
+    struct point {
+      uint64_t     in;
+      uint64_t     out;
+      int          bits;
+      std::string  window;
+    };
+
+    /// inflates segment i into out, its check value into 'check'
+    bool segment(support::error_code& err,
+                 size_t i,
+                 const unsigned char* in,
+                 size_t size,
+                 unsigned char* out,
+                 uint32_t& check) const;
+
+    uint32_t trailer(const unsigned char* in) const;
+
+    /// zlib counts in uInt, these hand it at most UINT_MAX at a time
+    static void refill(z_stream& strm, const unsigned char*& in, const unsigned char* end);
+    static void drain(z_stream& strm, unsigned char* end);
+    uint32_t checksum(const unsigned char* data, uint64_t size) const;
+
+    /// the saved index's fields, little endian whatever the host
+    static void put(std::string& out, uint64_t value, size_t bytes);
+    static uint64_t get(const unsigned char* in, size_t bytes);
+
+    static void failed(support::error_code& err, const char* what, int ret);
+
+    format              format_;
+    uint64_t            total_in_;
+    uint64_t            total_out_;
+    std::vector<point>  points_;
+  };
+
+  inline
+  inflate_index::
+  inflate_index() :
+    format_(zlib),
+    total_in_(0),
+    total_out_(0)
+  {}
+
+  inline size_t
+  inflate_index::
+  points() const {
+    return points_.size();
+  }
+
+  inline uint64_t
+  inflate_index::
+  total_in() const {
+    return total_in_;
+  }
+
+  inline uint64_t
+  inflate_index::
+  total_out() const {
+    return total_out_;
+  }
+
+  inline void
+  inflate_index::
+  failed(support::error_code& err,
+         const char* what,
+         int ret) {
+    std::ostringstream oss;
+    oss << "Failed to " << what << ": " << ret;
+    support::error_code::attach_or_create(err, -1, oss.str());
+  }
+
+  inline bool
+  inflate_index::
+  build(support::error_code& err,
+        std::string& out,
+        const unsigned char* in,
+        size_t size,
+        size_t span) {
+
+    z_stream strm;
+    ::memset(&strm, 0, sizeof(strm));
+
+    /// 15 + 32, zlib or gzip header detected
+    int ret = inflateInit2(&strm, 47);
+    if (ret != Z_OK) {
+      failed(err, "initialize zlib for decompression", ret);
+      return false;
+    }
+    points_.clear();
+    const unsigned char* next = in;
+
+    /// output in large steps, the size of the archive is not known
+    const size_t step = 256 * 1024;
+    size_t produced = 0;
+    size_t last = 0;
+    out.resize(step);
+    do {
+
+      if (produced == out.size()) {
+        out.resize(out.size() * 2);
+      }
+      refill(strm, next, in + size);
+      strm.next_out = (unsigned char*) &out[produced];
+      strm.avail_out = 0;
+      drain(strm, (unsigned char*) &out[0] + out.size());
+
+      /// Z_BLOCK returns at the end of each block header
+      ret = ::inflate(&strm, Z_BLOCK);
+      produced = strm.next_out - (unsigned char*) &out[0];
+      if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR ||
+          ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR ||
+          (ret == Z_BUF_ERROR && strm.avail_in == 0 && next == in + size)) {
+        failed(err, "inflate", ret);
+        inflateEnd(&strm);
+        return false;
+      }
+
+      /// bit 7: at the start of a block, bit 6: it was the last block
+      if ((strm.data_type & 128) && ! (strm.data_type & 64) &&
+          (produced == 0 || produced - last > span)) {
+        point p;
+        p.in = strm.total_in;
+        p.out = produced;
+        p.bits = strm.data_type & 7;
+        size_t w = produced < window_size ? produced : window_size;
+        p.window.assign(&out[produced - w], w);
+        points_.push_back(p);
+        last = produced;
+      }
+    }
+    while (ret != Z_STREAM_END);
+
+    out.resize(produced);
+    format_ = strm.total_in >= 18 && in[0] == 0x1f && in[1] == 0x8b ? gzip : zlib;
+    total_in_ = strm.total_in;
+    total_out_ = produced;
+    inflateEnd(&strm);
+    return true;
+  }
+
+  inline uint32_t
+  inflate_index::
+  trailer(const unsigned char* in) const {
+
+    /// adler32 big endian for zlib, crc32 then the size little endian for gzip
+    if (format_ == zlib) {
+      const unsigned char* t = in + total_in_ - 4;
+      return (uint32_t(t[0]) << 24) | (uint32_t(t[1]) << 16) | (uint32_t(t[2]) << 8) | t[3];
+    }
+    const unsigned char* t = in + total_in_ - 8;
+    return (uint32_t(t[3]) << 24) | (uint32_t(t[2]) << 16) | (uint32_t(t[1]) << 8) | t[0];
+  }
+
+  inline void
+  inflate_index::
+  put(std::string& out,
+      uint64_t value,
+      size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      out += (char) (value >> (8 * i));
+    }
+  }
+
+  inline uint64_t
+  inflate_index::
+  get(const unsigned char* in,
+      size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      value |= uint64_t(in[i]) << (8 * i);
+    }
+    return value;
+  }
+
+  inline void
+  inflate_index::
+  refill(z_stream& strm,
+         const unsigned char*& in,
+         const unsigned char* end) {
+    if (strm.avail_in == 0 && in < end) {
+      uInt chunk = end - in < UINT_MAX ? end - in : UINT_MAX;
+      strm.next_in = (unsigned char*) in;
+      strm.avail_in = chunk;
+      in += chunk;
+    }
+  }
+
+  inline void
+  inflate_index::
+  drain(z_stream& strm,
+        unsigned char* end) {
+    if (strm.avail_out == 0 && strm.next_out < end) {
+      strm.avail_out = end - strm.next_out < UINT_MAX ? end - strm.next_out : UINT_MAX;
+    }
+  }
+
+  inline uint32_t
+  inflate_index::
+  checksum(const unsigned char* data,
+           uint64_t size) const {
+    uint32_t check = format_ == zlib ? adler32(0, Z_NULL, 0) : crc32(0, Z_NULL, 0);
+    while (size > 0) {
+      uInt chunk = size < UINT_MAX ? size : UINT_MAX;
+      check = format_ == zlib ? adler32(check, data, chunk) : crc32(check, data, chunk);
+      data += chunk;
+      size -= chunk;
+    }
+    return check;
+  }
+
+  inline bool
+  inflate_index::
+  segment(support::error_code& err,
+          size_t i,
+          const unsigned char* in,
+          size_t size,
+          unsigned char* out,
+          uint32_t& check) const {
+
+    const point& p = points_[i];
+    uint64_t end = i + 1 < points_.size() ? points_[i + 1].out : total_out_;
+
+    z_stream strm;
+    ::memset(&strm, 0, sizeof(strm));
+    int ret = inflateInit2(&strm, -15);
+    if (ret != Z_OK) {
+      failed(err, "initialize raw inflate", ret);
+      return false;
+    }
+    /// the block may start part way into a byte
+    uint64_t start = p.in - (p.bits ? 1 : 0);
+    if (p.bits) {
+      inflatePrime(&strm, p.bits, in[start] >> (8 - p.bits));
+      ++start;
+    }
+    if (! p.window.empty()) {
+      inflateSetDictionary(&strm, (const Bytef*) p.window.data(), p.window.size());
+    }
+    const unsigned char* next = in + start;
+    strm.next_out = out + p.out;
+
+    /// a segment stops short of the stream end when its output is full
+    do {
+      refill(strm, next, in + size);
+      drain(strm, out + end);
+      ret = ::inflate(&strm, Z_NO_FLUSH);
+    }
+    while (ret == Z_OK && strm.next_out < out + end);
+    inflateEnd(&strm);
+
+    if (strm.next_out < out + end || (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)) {
+      failed(err, "inflate segment", ret);
+      return false;
+    }
+    check = checksum(out + p.out, end - p.out);
+    return true;
+  }
+
+  inline bool
+  inflate_index::
+  inflate(support::error_code& err,
+          std::string& out,
+          const unsigned char* in,
+          size_t size,
+          unsigned threads) const {
+
+    if (points_.empty() || size < total_in_) {
+      support::error_code::attach_or_create(err, -1, "Index does not match the stream");
+      return false;
+    }
+    out.resize(total_out_);
+    unsigned char* base = (unsigned char*) &out[0];
+
+    std::vector<uint32_t> checks(points_.size());
+    std::vector<support::error_code> errors(points_.size());
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+
+    /// segments are claimed in order, the threads share nothing else
+    std::vector<std::thread> workers;
+    unsigned count = threads ? threads : 1;
+    if (count > points_.size()) {
+      count = points_.size();
+    }
+    for (unsigned t = 0; t < count; ++t) {
+      workers.push_back(std::thread([&]() {
+        size_t i = 0;
+        while (ok && (i = next++) < points_.size()) {
+          if (! segment(errors[i], i, in, size, base, checks[i])) {
+            ok = false;
+          }
+        }
+      }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t) {
+      workers[t].join();
+    }
+    if (! ok) {
+      for (size_t i = 0; i < errors.size(); ++i) {
+        if (errors[i].code()) {
+          err.attach(errors[i]);
+        }
+      }
+      support::error_code::attach_or_create(err, -1, "Parallel inflate failed");
+      return false;
+    }
+
+    /// stitch the per segment checks together and hold them to the trailer
+    uint32_t check = format_ == zlib ? adler32(0, Z_NULL, 0) : crc32(0, Z_NULL, 0);
+    for (size_t i = 0; i < points_.size(); ++i) {
+      uint64_t end = i + 1 < points_.size() ? points_[i + 1].out : total_out_;
+      z_off_t length = end - points_[i].out;
+      check = format_ == zlib ?
+        adler32_combine(check, checks[i], length) :
+        crc32_combine(check, checks[i], length);
+    }
+    if (check != trailer(in)) {
+      support::error_code::attach_or_create(err, -1, "Parallel inflate check value mismatch");
+      return false;
+    }
+    return true;
+  }
+
+  inline bool
+  inflate_index::
+  save(support::error_code& err,
+       std::string& out) const {
+
+    /// magic, version, format, points, total in and out, then per point
+    /// in, out, bits, window size and the window
+    std::string s;
+    put(s, magic, 4);
+    put(s, version, 4);
+    put(s, format_, 4);
+    put(s, points_.size(), 4);
+    put(s, total_in_, 8);
+    put(s, total_out_, 8);
+    for (size_t i = 0; i < points_.size(); ++i) {
+      const point& p = points_[i];
+      put(s, p.in, 8);
+      put(s, p.out, 8);
+      put(s, p.bits, 4);
+      put(s, p.window.size(), 4);
+      s += p.window;
+    }
+    out.swap(s);
+    return true;
+  }
+
+  inline bool
+  inflate_index::
+  load(support::error_code& err,
+       const unsigned char* in,
+       size_t size) {
+
+    const unsigned char* p = in;
+    const unsigned char* end = in + size;
+    uint64_t head[4];
+    uint64_t totals[2];
+    if (size < 32) {
+      support::error_code::attach_or_create(err, -1, "Inflate index truncated");
+      return false;
+    }
+    for (size_t i = 0; i < 4; ++i, p += 4) {
+      head[i] = get(p, 4);
+    }
+    for (size_t i = 0; i < 2; ++i, p += 8) {
+      totals[i] = get(p, 8);
+    }
+    if (head[0] != magic || head[1] != version || head[2] > gzip) {
+      support::error_code::attach_or_create(err, -1, "Not an inflate index");
+      return false;
+    }
+
+    /// trailer() reads back from the end, there must be a header and a trailer
+    if (totals[0] < (head[2] == gzip ? 18u : 6u)) {
+      support::error_code::attach_or_create(err, -1, "Inflate index corrupt");
+      return false;
+    }
+    if (head[3] > (size - 32) / 24) {
+      support::error_code::attach_or_create(err, -1, "Inflate index truncated");
+      return false;
+    }
+
+    std::vector<point> points(head[3]);
+    for (size_t i = 0; i < points.size(); ++i) {
+      if (end - p < 24) {
+        support::error_code::attach_or_create(err, -1, "Inflate index truncated");
+        return false;
+      }
+      uint64_t where[] = { get(p, 8), get(p + 8, 8) };
+      uint64_t sizes[] = { get(p + 16, 4), get(p + 20, 4) };
+      p += 24;
+      if (sizes[0] > 7 || sizes[1] > window_size || (size_t) (end - p) < sizes[1] ||
+          where[0] >= totals[0] || where[0] < 1 || where[1] > totals[1] ||
+          (i > 0 && where[1] <= points[i - 1].out)) {
+        support::error_code::attach_or_create(err, -1, "Inflate index corrupt");
+        return false;
+      }
+      points[i].in = where[0];
+      points[i].out = where[1];
+      points[i].bits = sizes[0];
+      points[i].window.assign((const char*) p, sizes[1]);
+      p += sizes[1];
+    }
+    format_ = (format) head[2];
+    total_in_ = totals[0];
+    total_out_ = totals[1];
+    points_.swap(points);
+    return true;
+  }
+
+}